@@ -1,643 +1,1878 @@
-/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
- *
- * Hecho por: Hugo Mateo
- * Última revisión: 12/06/2022
- * 
- * Sintaxis de la configuración ASM: 
- * En la primera línea deberá poner BIN o HEX, dependiendo de la salida deseada.
- * Si la segunda línea es LOGISIM_OUT (puede no serlo), la salida tendrá sintaxis logisim
- * Si la segunda línea es VHDL_OUT (puede no serlo), la salida tendrá sintaxis VHDL
- * Si la segunda línea (si no hay ni VHDL_OUT ni LOGISIM_OUT) o la tercera (si aparece uno de ellos) línea es SALTO_RELATIVO
- *      los parámetros de configuración que comiencen por ## serán saltos relativos a PC
- *      las direcciones de salto se calcularán relativas a PC 
- * 
- * Primero va el nombre de la instrucción, con su codificación entre < >.
- * Tras ello van los parámetros. Las **** tras una palabra son bits indeterminados que 
- *      serán sustituidos por el valor que haya tras la palabra.
- * 
- * En configuración:
- * Un parámetro que comience con # será o bien un valor (que comience por #) o bien una etiqueta.
- * Un parámetro que comience con & será relleno fijo, y deberá especificarse su valor en la configuración
- *     con 1s y 0s. En la programación ASM el parámetro no aparecerá.
- * Si la línea comienza con & se considerará se definirá como una palabra especial que se sustituirá automáticamente por aquello que haya en tras el igual.
- * Al programar:
- * Una línea sin espacios será una etiqueta.
- * Cuando aparezca un ';' se descartará el resto de la línea (comentarios).
- * Si una etiqueta tiene un =, se le asignará el valor que la siga.
- * Si no tiene un = se le asignará la posición de la siguiente instrucción válida (se obvian todas las etiquetas).
- * Por tanto, toda instrucción tiene que tener al menos un parámetro además del nombre.
- * 
- * Algunos ejemplos de configuración y su uso:
- *  fichero configuración:
- * 
- *     HEX
- *     LOGISIM_OUT
- *     SALTO_RELATIVO
- *     
- *     &ADD_CODE=&00001 
- *    
- *     ADDFP<000000> rs*****fp rt*****fp rd*****fp &000000 &ADD_CODE 
- *     MOV<000001> rXXXXX &00000 #XXXXXXXXXXXXXXXX
- *     BEQ<000011> rXXXXX rXXXXX ##XXXXXXXXXXXXXXXX  
- *     ST<000100> rDirXXXXX rDatXXXXX &0000000000000000  
- * 
- * fichero programa:
- *
- *     MOV r1 #3
- *     dir_pantalla=0x10f
- *     MOV r1 dir_pantalla
- * 
- *     ADDFP rs1fp rt2fp rd3fp
- *     MOV r0 #'a'
- *     ST rDir1 rDat0
- *     fin
- *     BEQ r0 r0 fin
- * 
- * ------------------ ADVERTENCIA: La última línea de todos los ficheros debe terminar en \n, si no se perderá la línea -------------------- 
- *                                 En las etiquetas se deben separar los comentarios del código con '\t', o se confundirá con una instrucción
- *                                 Funciona en linux y en windows, pero cuidado con usar un txt de windows en linux y viceversa
- * 
- * NOTA: Los bits de tamaño de instrucción totales deben definirse antes de la compilación
- * 
- *    Mejoras pendientes:
- * 
- *    Errores conocidos: 
- *      Los comentarios dan problemas a veces, de momento es mejor compilar código sin ellos
- * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
-
-
-
-#include <iostream>
-#include <fstream>
-#include <string>
-#include <bitset>
-#include <map>
-#include <list>
-#include <vector>
-#include <sstream>
-#include <algorithm>
-
-using namespace std;
-
-
-
-bool gl_hex_out;                                     // Da la salida en hexadecimal en lugar de en binario
-bool gl_logisim_out;                                 // Imprime la salida en un formato compatible con la rom de logisim
-bool gl_vhdl_out;                                    // Imprime la salida en un formato compatible con las memorias VHDL
-bool gl_salto_relativo;                              // Si se habilita, los saltos se calcularán relativos a PC
-const int TAMANYO_INSTRUCCION = 32;                  // Tamaño de una instrucción en bits
-
-const char CH_VARIABLE_CONFIG = '*';                 // Caracter que indica un dato variable en configuración
-const char CH_CONSTANTE_CONFIG = '&';                // Caracter que indica un dato fijo en configuración
-const char CH_ETIQUETA_CONFIG = '#';                 // Caracter que indica una etiqueta en configuración
-
-map <string, int> gl_etiquetas;                      // Diccionario global de dirección-etiqueta
-map <string, vector<string>> gl_instrucciones;       // Diccionario global de instrucciones
-map <string, string> gl_constantes_config;           // Lista de constantes en configuración
-
-
-// Excepciones
-
-class exception_wrong_config_syntax : public exception
-{
-    public:
-
-    string msg;
-
-    exception_wrong_config_syntax(string _msg)
-    {
-        msg = _msg; 
-    }
-
-    const char * what() const throw() override
-    {
-        return msg.c_str();
-    }
-};
-
-class exception_unknown_instruction : public exception
-{
-    public:
-    
-    string msg;
-
-    exception_unknown_instruction (string instruction, int linea)
-    {
-        stringstream ss;
-        ss << "Instruccion desconocida: \"" << instruction << "\" en la linea " << linea;
-        msg = ss.str();
-    }
-
-    const char * what() const throw() override
-    {
-        
-        return msg.c_str();
-    }
-};
-
-class exception_wrong_instruction_syntax : public exception
-{
-    public:
-
-    string msg;
-
-    exception_wrong_instruction_syntax (string instruction, int linea, string encontrado, string esperado)
-    {
-        stringstream ss;
-        ss << "Error en la sintaxis de la instruccion \"" << instruction << "\" en la linea " << linea << ": Se ha encontrado \"" << 
-            encontrado << "\", se esperaba \"" << esperado << "\"";
-        msg = ss.str();
-    }
-
-    const char * what() const throw() override
-    {
-        return msg.c_str();
-    }
-};
-
-class exception_wrong_label : public exception
-{
-    public:
-
-    string msg;
-
-    exception_wrong_label (string etiqueta, int linea)
-    {
-        stringstream ss;
-        ss << "Etiqueta desconocida \"" << etiqueta << "\" en la linea " << linea;
-        msg = ss.str();
-    }
-
-    const char * what() const throw() override
-    {
-        return msg.c_str();
-    }
-};
-
-class exception_wrong_number_of_parameters : public exception
-{
-    public:
-
-    string msg;
-
-    exception_wrong_number_of_parameters (string instruction, int linea)
-    {
-        stringstream ss;
-        ss << "Numero de parametros incorrecto en la instruccion \"" << instruction << "\" en la linea " << linea;
-        msg = ss.str();
-    }
-
-    const char * what() const throw() override
-    {
-        return msg.c_str();
-    }
-};
-
-
-
-// Funciones auxiliares
-
-// Convierte un bitset a un string hexadecimal
-
-string binToHex (bitset<TAMANYO_INSTRUCCION> binario)
-{
-    stringstream hexadecimal;
-    hexadecimal << hex << uppercase << binario.to_ulong();
-    string salida = hexadecimal.str();
-
-    if (salida.size() < TAMANYO_INSTRUCCION / 4)
-        salida = string(TAMANYO_INSTRUCCION / 4 - salida.size(), '0') + salida;
-    
-    if (TAMANYO_INSTRUCCION % 4 != 0)
-        salida = "0" + salida;
-
-    return salida;
-}
-
-
-// Convierte un string binario a un string hexadecimal
-
-string binSToHex (string binarioString)
-{
-    bitset<TAMANYO_INSTRUCCION> binario {binarioString};
-    stringstream hexadecimal;
-    hexadecimal << hex << uppercase << binario.to_ulong();
-    
-    string salida = hexadecimal.str();
-
-    if (salida.size() < TAMANYO_INSTRUCCION / 4)
-        salida = string(TAMANYO_INSTRUCCION / 4 - salida.size(), '0') + salida;
-
-    if (TAMANYO_INSTRUCCION % 4 != 0)
-        salida = "0" + salida;
-
-    return salida;
-}
-
-
-
-// Convierte un string a decimal
-// El string puede ser un decimal, hexadecimal comenzado con 0x o un caracter entre ''
-
-int to_decimal(string numero)
-{
-    if (numero[0] == '0' && numero[1] == 'x')                               // Hexadecimal
-    {
-        int decimal;
-        stringstream ss;
-        ss << numero;
-        ss >> hex >> decimal;
-        return decimal;
-    }
-    else if  (numero[0] == '\'' && numero[numero.length()-1] == '\'')       // Caracter
-    {
-        return numero[1];
-    }
-    else                                                                    // Decimal
-    {
-        return stoi(numero);
-    }
-}
-
-
-
-// Clases
-
-class instruccion
-{
-    private:
-        
-        string nombre;                                         // Nombre de la instrucción
-        bitset<TAMANYO_INSTRUCCION> instruccionBinario;        // Instrucción final en binario
-        vector<string> tokens;                                 // Vector con los tokens de entrada de la instrucción
-        int i_linea;                                           // Número de línea de la instrucción
-        int i_PC;                                              // Número de PC de la instrucción
-    
-    public:
-        
-        // Constructor
-        instruccion (vector<string> _tokens, int _i_linea, int _i_PC) : tokens (_tokens)
-        {   
-            if (gl_instrucciones.find(_tokens[0]) == gl_instrucciones.end())
-            {
-                throw exception_unknown_instruction(_tokens[0], _i_linea);
-            }
-
-            nombre = _tokens[0];
-            i_linea = _i_linea;
-            i_PC = _i_PC;
-
-            int nParametros = 0;
-            for (string elemento : gl_instrucciones[nombre])                  // Cuenta el número de parámetros que no sean relleno
-            {   
-                if (elemento[0] != '&')
-                {
-                    nParametros++;
-                }
-            }
-
-            if (tokens.size() != nParametros)                                 // Número de parámetros incorrecto
-            {
-                exception_wrong_number_of_parameters exc (tokens[0], i_linea);
-                throw exc;
-            }
-        }
-        
-        // Devuelve la instrucción ensamblador, legible por humanos 
-        std::string to_string ()                               
-        {
-            string salida = "";
-            for (string token : tokens)
-            {
-                salida += token + " ";   
-            }
-            return salida;
-        }                  
-
-        // Ensambla la instrucción y la devuelve en binario, legible por la máquina
-        std::string to_bin ()                                  
-        {   
-            string salida = gl_instrucciones[nombre][0];
-
-            for (int str = 1, tok = 1; str < gl_instrucciones[nombre].size(); str++)
-            {   
-                if (gl_instrucciones[nombre][str][0] == CH_ETIQUETA_CONFIG)                        // Es una constante
-                {
-                    int direccion;
-                    if (tokens[tok][0] != CH_ETIQUETA_CONFIG)                                                 // Es una etiqueta
-                    {
-                        if (gl_etiquetas.find(tokens[tok]) == gl_etiquetas.end())                             // La etiqueta no existe
-                        {
-                            exception_wrong_label exc (tokens[tok], i_linea);
-                            throw exc;
-                        }
-
-                        if (gl_salto_relativo && gl_instrucciones[nombre][str][1] == CH_ETIQUETA_CONFIG)
-                        {
-                            direccion = gl_etiquetas[tokens[tok]] - (i_PC + 1);                               // Dirección relativa a la instrucción
-                        }
-                        else
-                        {
-                            direccion = gl_etiquetas[tokens[tok]];                                            // Obtiene la dirección de la etiqueta 
-                        }                                               
-                    }
-                    else direccion = to_decimal(tokens[tok].erase(0, 1));                                     // Obtiene la dirección del número
-
-                    int nBits = count (gl_instrucciones[nombre][str].begin(),                                 // Número de bits de la dirección
-                                            gl_instrucciones[nombre][str].end(), CH_VARIABLE_CONFIG);     
-                    bitset<TAMANYO_INSTRUCCION> direccionBinario {(long long unsigned int)direccion};         // Convierte el número a binario
-
-                    for (int i = nBits - 1; i >= 0; i--)
-                    {
-                        salida += direccionBinario[i] ? "1" : "0";                                            // Añade los bits correspondientes a la instrucción
-                    }
-
-                    tok++;                                                                                    // Avanza el contador de los tokens
-                }
-
-                else if (gl_instrucciones[nombre][str][0] == CH_CONSTANTE_CONFIG)                             // Es una constante (relleno)
-                {
-                    salida += gl_instrucciones[nombre][str].substr(1);
-                }
-
-                else                                                                             // Es un parámetro normal
-                {
-                    int inicioNumero = gl_instrucciones[nombre][str].find(CH_VARIABLE_CONFIG);                // Posición del primer caracter del número
-                    int finNumero = gl_instrucciones[nombre][str].find_last_of(CH_VARIABLE_CONFIG);           // Posición del último caracter del número
-                    int nBits = finNumero - inicioNumero + 1;                                                 // Número de bits del número
-                    
-                    string encontrado = tokens[tok].substr(0, inicioNumero);                                  // Parte inicial del token (previa al número)
-                    string resto = tokens[tok].substr(inicioNumero);                                          // Parte final del token (después del número)
-
-                    int inicioCaracFin = resto.find_first_not_of("1234567890");                               // Posición del primer caracter no numérico
-                    string encontradoFinal = "";
-                    if (inicioCaracFin != -1)
-                        encontradoFinal = resto.substr(inicioCaracFin);                                       // Parte inicial del token (previa al número)
-
-                    string esperado = gl_instrucciones[nombre][str].substr(0, inicioNumero);                  // Parte inicial esperada
-                    string esperadoFinal = "";
-                    if (gl_instrucciones[nombre][str].size() >= finNumero + 1)                                // Si hay caracteres al final del parámetro
-                        esperadoFinal = gl_instrucciones[nombre][str].substr(finNumero + 1);                  // Parte final esperada
-
-                    if (encontrado != esperado || encontradoFinal != esperadoFinal)                           // Nombre del parámetro incorrecto
-                    {
-                        if (esperadoFinal != "" || encontradoFinal != "")
-                        {
-                            exception_wrong_instruction_syntax exc (tokens[0], i_linea, tokens[tok], esperado + "*" + esperadoFinal);
-                            throw exc;
-                        }
-                        exception_wrong_instruction_syntax exc (tokens[0], i_linea, encontrado, esperado);
-                        throw exc;
-                    }
-
-                    string numero = tokens[tok].substr(inicioNumero);                                         // Quita los caracteres no numéricos
-                    bitset<TAMANYO_INSTRUCCION> numeroBinario {(long long unsigned int)to_decimal(numero)};   // Convierte el número a binario
-
-                    for (int i = nBits - 1; i >= 0; i--)
-                    {
-                        salida += numeroBinario[i] ? "1" : "0";                                               // Añade los bits correspondientes a la instrucción
-                    }
-
-                    tok++;                                                                                    // Avanza el contador de los tokens
-                }
-            }
-
-            return salida;
-        }
-
-        // Ensambla la instrucción y la devuelve en hexadecimal, legible por la máquina
-        std::string to_hex ()                                  
-        {
-            return binSToHex (this->to_bin());
-        }
-};
-
-
-
-// Tokeniza un string separado por espacios en un vector de strings
-void stringToVector (string s, vector<string> &vect)
-{
-    stringstream ss (s);
-    string token;
-    while (getline (ss, token, ' '))
-    {
-        vect.push_back (token);
-    }
-}	
-
-
-
-
-int main(int argc, char * argv[])
-{
-    ifstream f_entrada, f_config;
-    ofstream f_salida;
-
-    if (argc == 4)                            // Se ha introducido un parámetro
-    {
-        f_entrada.open(argv[2]);              // Fichero de entrada
-        f_salida.open(argv[3]);               // Fichero de salida    
-        f_config.open(argv[1]);               // Fichero de configuración  
-
-        if (f_entrada.is_open() && f_salida.is_open() && f_config.is_open())                  // El fichero existía
-        {
-            string linea;                                                       // Variable de lectura
-
-            getline (f_config, linea);                                          // Lee la primera línea del fichero de configuración
-
-            try
-            {
-                if (linea == "HEX") gl_hex_out = true;                          // Salida en hexadecimal
-                else if (linea == "BIN") gl_hex_out = false;                    // Salida en binario
-                else                                                            // Sintaxis incorrecta
-                {
-                    exception_wrong_config_syntax exc ("La primera linea debe ser HEX o BIN");
-                    throw exc;
-                }
-
-                getline (f_config, linea);                                      // Lee la segunda línea del fichero de configuración
-
-                if (linea == "LOGISIM_OUT")                                     // Activa la salida para logisim
-                {
-                    gl_logisim_out = true;
-                    getline (f_config, linea);                                  // Lee la siguiente línea del fichero de configuración
-                }
-                else
-                    gl_logisim_out = false;
-
-                if (linea == "VHDL_OUT")                                        // Activa la salida para VHDL
-                {
-                    gl_vhdl_out = true;
-                    getline (f_config, linea);                                  // Lee la siguiente línea del fichero de configuración
-                }
-                else 
-                    gl_vhdl_out = false;
-
-                if (linea == "SALTO_RELATIVO")                                  // Activa los saltos relativos a PC
-                {
-                    gl_salto_relativo = true;
-                    getline (f_config, linea);                                  // Lee la siguiente línea del fichero de configuración
-                }
-                else
-                    gl_salto_relativo = false;
-
-                while (!f_config.eof())
-                {
-                    if (linea != "")
-                    {
-                        if (linea[0] == CH_CONSTANTE_CONFIG)                                            // Es una constante de configuración
-                            gl_constantes_config[linea.substr(0, linea.find('='))] =                    // Añade el valor tras el '=' a la tabla de constantes
-                                linea.substr(linea.find('=') + 1);
-                        else
-                        {
-                            int pos1 = linea.find("<");                                                     // Posición del inicio de los bits de instrucción
-                            int pos2 = linea.find(">");                                                     // Posición del final de los bits de instrucción
-                            string nombre = linea.substr(0, pos1);                                          // Nombre de la instrucción
-                            string bits = linea.substr(pos1 + 1, pos2 - (pos1 + 1));                        // Bits de operación
-
-                            vector<string> estructura;                                                      // Vector de tokens de la instrucción
-                            bits = bits + linea.substr(pos2 + 1);                                           // Añade los bits de la instrucción
-
-                            stringToVector(bits, estructura);                                               // Tokeniza la estructura de la instrucción
-
-                            for (string &str : estructura)                                                  // Transforma las etiquetas de configuración en su valor 
-                            {
-                                if (str[0] == CH_CONSTANTE_CONFIG                                           // Es una etiqueta interna de configuración
-                                    && 
-                                    count(str.begin(), str.end(), '0') 
-                                    + 
-                                    count(str.begin(), str.end(), '1') 
-                                    + 
-                                    1
-                                    !=  
-                                    str.size())                                 
-                                {
-                                    if (gl_constantes_config.find(str) == gl_constantes_config.end())       // No existe la etiqueta
-                                    {
-                                        exception_wrong_config_syntax exc ("La constante " + str + " no existe");
-                                        throw exc;
-                                    }
-
-                                    str = gl_constantes_config[str];                                        // Cambia el nombre de la etiqueta por su valor
-                                }
-                            }
-
-                            gl_instrucciones [nombre] = estructura;                                         // Añade la estructura a la tabla de instrucciones
-                        }
-                    }
-
-                    getline (f_config, linea);                                                // Lee la siguiente línea del fichero de configuración
-                }
-
-
-
-                // Comienza la lectura y tokenizado del código
-
-                vector<string> param;                                       // Variable para tokenizar la instrucción
-                string salida;                                              // Variable para almacenar la instrucción ya traducida a binario
-                int i_PC = 0;                                               // Lleva la cuenta del número de línea para almacenar etiquetas de salto
-                int posEspacio;                                             // Variable auxiliar para tokenizar la instrucción
-                int i_numLinea = 0;                                         // Lleva la cuenta del número de línea para mostrar errores
-                list <instruccion*> codigo;                                 // Lista de instrucciones del repertorio
-
-                getline (f_entrada, linea);                                 // Lee la primera línea
-
-                while (!f_entrada.eof())
-                {
-                    i_numLinea++;                                           // Incrementa el número de línea
-
-                    linea.find(";") != string::npos ?                       // Busca un comentario
-                        linea = linea.substr(0, linea.find(";"))            // Elimina el comentario
-                        :   
-                        linea;                                              // No hay un comentario
-
-                    if (linea != "" && linea.find(" ") != -1)                   // Es una instrucción 
-                    {
-                        std::replace( linea.begin(), linea.end(), '\t', ' ');               // Elimina los tabuladores
-                        stringstream ss (linea);                                            // Convierte la línea en un flujo de datos
-                        string token;                                                       // Variable para almacenar el token
-
-                        while (getline(ss, token, ' '))
-                            if (token != "")
-                                param.push_back(token);
-
-                        instruccion* inst = new instruccion (param, i_numLinea, i_PC);      // Crea la instrucción
-                        codigo.push_back(inst);                                             // Añade la instrucción al código
-                        param.clear();                                                      // Limpia el vector de parámetros
-
-                        i_PC++;                                                             // Incrementa el contador de instrucción (Para etiquetas de salto)
-                    }   
-                    else if (linea != "")                                       // Es una etiqueta de salto
-                    {
-                        if (linea.find('=') != -1)                                     // Almacena el valor de la etiqueta
-                            gl_etiquetas[linea.substr(0, linea.find('='))] 
-                            = 
-                            to_decimal(linea.substr(linea.find('=') + 1));
-
-                        else
-                            gl_etiquetas[linea] = i_PC;                                // Almacena la posición de la etiqueta                     
-                    }
-
-                    getline (f_entrada, linea);                                        // Lee la siguiente línea
-                }
-
-
-
-                // Comienza el ensamblado
-
-                if (gl_logisim_out)                                                    // Imprime la cabecera de memoria de logisim
-                {
-                    f_salida << "v2.0 raw\n";
-                }
-                
-                int contador = 0;                                                      // Contador de instrucciones
-                for (instruccion *inst : codigo)                                       // Recorre la lista de instrucciones
-                {   
-                    if (gl_hex_out)
-                    {
-                        salida = inst->to_hex();                                       // Traduce la instrucción a hexadecimal
-                    }
-                    else
-                    {
-                        salida = inst->to_bin();                                       // Traduce la instrucción a binario
-                    }
-
-                    // Imprime la instrucción en la salida
-                    if (gl_logisim_out)                                                // Código para rom de logisim
-                        f_salida << salida << " ";
-
-                    else if (gl_vhdl_out)
-                        f_salida << "X\"" << salida << "\", ";
-
-                    else                                                               // Código estándar
-                        f_salida << salida << endl;
-
-                    if (contador == 7 && (gl_logisim_out || gl_vhdl_out))              // Si se ha alcanzado el número máximo de instrucciones por línea
-                    {
-                        f_salida << endl;
-                        contador = 0;
-                    }
-                    else
-                        contador++;                                                    // Incrementa el contador de instrucciones
-                }
-            }
-            catch (const exception& e)
-            {
-                cout << e.what() << endl;
-            }
-        }
-        else if (!f_config.is_open())           // Fichero de configuración incorrecto 
-            cerr << "No se ha encontrado el archivo " << argv[1] << endl;
-
-        else if (!f_entrada.is_open())           // Fichero a ensamblar incorrecto 
-            cerr << "No se ha encontrado el archivo " << argv[2] << endl;
-        
-        else if (!f_config.is_open())           // No se ha podido crear o escribir el en fichero 
-            cerr << "No se ha podido escribir el fichero " << argv[3] << endl;
-            
-    }
-    else                // Parámetros incorrectos
-    {
-        cerr << "Invocar como: ./cumpilador.exe fichero_config fichero_entrada fichero_salida" << endl;
-    }
-}
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ * Hecho por: Hugo Mateo
+ * Última revisión: 12/06/2022
+ * 
+ * Sintaxis de la configuración ASM: 
+ * En la primera línea deberá poner BIN o HEX, dependiendo de la salida deseada.
+ * Si la segunda línea es LOGISIM_OUT (puede no serlo), la salida tendrá sintaxis logisim
+ * Si la segunda línea es VHDL_OUT (puede no serlo), la salida tendrá sintaxis VHDL
+ * Si la segunda línea (si no hay ni VHDL_OUT ni LOGISIM_OUT) o la tercera (si aparece uno de ellos) línea es SALTO_RELATIVO
+ *      los parámetros de configuración que comiencen por ## serán saltos relativos a PC
+ *      las direcciones de salto se calcularán relativas a PC 
+ * Tras ellas puede ir TAMANYO_INSTRUCCION=N, con N entre 1 y 128, para cambiar el tamaño de instrucción (32 por defecto).
+ *      La salida HEX muestra N bits de cada instrucción. Las instrucciones más largas se recortan por la derecha
+ *      y las más cortas se rellenan con ceros a la izquierda.
+ * 
+ * Primero va el nombre de la instrucción, con su codificación entre < >.
+ * Tras ello van los parámetros. Las **** tras una palabra son bits indeterminados que 
+ *      serán sustituidos por el valor que haya tras la palabra.
+ * 
+ * En configuración:
+ * Un parámetro que comience con # será o bien un valor (que comience por #) o bien una etiqueta.
+ * Un parámetro que comience con & será relleno fijo, y deberá especificarse su valor en la configuración
+ *     con 1s y 0s. En la programación ASM el parámetro no aparecerá.
+ * Si la línea comienza con & se considerará se definirá como una palabra especial que se sustituirá automáticamente por aquello que haya en tras el igual.
+ * Al programar:
+ * Una línea sin espacios será una etiqueta.
+ * Cuando aparezca un ';' se descartará el resto de la línea (comentarios).
+ * Si una etiqueta tiene un =, se le asignará el valor que la siga.
+ * Si no tiene un = se le asignará la posición de la siguiente instrucción válida (se obvian todas las etiquetas).
+ * Directivas de colocación, que mueven el PC de las instrucciones y etiquetas que las siguen:
+ *     .org N           Continúa en la dirección N, que no puede ser anterior al PC actual
+ *     .align N         Continúa en el siguiente múltiplo de N
+ *     .space N         Reserva N palabras sin contenido
+ *     .fill N [valor]  Ocupa N palabras con valor (0 por defecto), extendido al tamaño de instrucción
+ *     Los huecos de .org, .align y .space se escriben como palabras a 0, salvo en ihex, que salta a la nueva
+ *     dirección, y en readmemh, que la indica con @direccion. Un programa con .org o .align se lee en un solo hilo.
+ * Directivas de datos:
+ *     .word v1 v2 ...  Una palabra por valor (decimal, 0x o 'c'), extendido al tamaño de instrucción
+ *     .ascii "texto"   Una palabra por caracter. Admite espacios, ';' y las secuencias \n \t \r \0 \\ y \"
+ *     .incbin "ruta"   Incluye el fichero, proyectado en memoria, en palabras de TAMANYO_INSTRUCCION / 8 bytes
+ *                      (debe ser múltiplo de 8) en el orden de --endian; la última se completa con ceros.
+ *                      En la salida binaria el fichero se copia tal cual. La ruta es relativa al directorio actual.
+ * Por tanto, toda instrucción tiene que tener al menos un parámetro además del nombre.
+ * 
+ * Algunos ejemplos de configuración y su uso:
+ *  fichero configuración:
+ * 
+ *     HEX
+ *     LOGISIM_OUT
+ *     SALTO_RELATIVO
+ *     
+ *     &ADD_CODE=&00001 
+ *    
+ *     ADDFP<000000> rs*****fp rt*****fp rd*****fp &000000 &ADD_CODE 
+ *     MOV<000001> rXXXXX &00000 #XXXXXXXXXXXXXXXX
+ *     BEQ<000011> rXXXXX rXXXXX ##XXXXXXXXXXXXXXXX  
+ *     ST<000100> rDirXXXXX rDatXXXXX &0000000000000000  
+ * 
+ * fichero programa:
+ *
+ *     MOV r1 #3
+ *     dir_pantalla=0x10f
+ *     MOV r1 dir_pantalla
+ * 
+ *     ADDFP rs1fp rt2fp rd3fp
+ *     MOV r0 #'a'
+ *     ST rDir1 rDat0
+ *     fin
+ *     BEQ r0 r0 fin
+ * 
+ * Los ficheros pueden tener finales de línea de linux (\n) o de windows (\r\n), y la última línea no necesita \n.
+ * Los tokens se pueden separar con espacios o tabuladores.
+ * 
+ * NOTA: La codificación usa palabras de 16, 32, 64 o 128 bits según la instrucción más larga de la configuración
+ * NOTA: El ensamblador está en libcumpilador.h y libcumpilador.cpp, que se pueden usar como biblioteca sin este programa.
+ * NOTA: Compilar con C++17, por ejemplo: g++ -O2 -std=c++17 -pthread cumpilador.cpp diferencial.cpp libcumpilador.cpp -o cumpilador.exe
+ *       En Windows con MinGW puede hacer falta añadir -lpsapi para --stats.
+ * 
+ * Opciones:
+ *      -j N        Ensambla con N hilos (0 para usar todos los núcleos). Por defecto se usa uno.
+ *      --streaming Ensambla en una sola pasada, escribiendo cada instrucción según se lee. La memoria solo crece
+ *                  con las referencias a etiquetas aún no definidas. Se ignora -j.
+ *      --formato F Formato del fichero de salida:
+ *                      texto     BIN o HEX según la configuración, con LOGISIM_OUT o VHDL_OUT (por defecto)
+ *                      binario   Imagen binaria con cada palabra en (TAMANYO_INSTRUCCION + 7) / 8 bytes
+ *                      ihex      Intel HEX, con un registro de datos por instrucción y direcciones de hasta 32 bits
+ *                      readmemh  Una palabra hexadecimal por línea, para $readmemh de Verilog
+ *                  Salvo en texto, todas las palabras ocupan TAMANYO_INSTRUCCION bits, como en la salida HEX.
+ *      --endian E  Orden de los bytes de cada palabra en binario e ihex: little (por defecto) o big.
+ *      --compactar Con LOGISIM_OUT, escribe las palabras iguales seguidas como N*valor; con VHDL_OUT, como
+ *                  "i to j => X"valor"", omitiendo las que son 0, que cubre "others". Solo en el formato texto.
+ *                  El ensamblado se hace en un hilo y se ignora --streaming.
+ *      --stats     Muestra por la salida de errores el tiempo de cada fase (configuración, lectura, etiquetas,
+ *                  codificación y salida), las instrucciones, las etiquetas, las búsquedas de mnemónicos y etiquetas,
+ *                  las reservas de memoria del almacén, los bytes leídos y escritos y el pico de memoria.
+ *                  Con --stats=json se muestra como un objeto JSON en una línea.
+ *      --incremental C  Guarda en el fichero C el hash, el PC, la codificación y las etiquetas de cada instrucción.
+ *                  En la siguiente ejecución solo se codifican las instrucciones cuyo texto o PC han cambiado o que usan
+ *                  etiquetas que se han movido. Si todas ocupan lo mismo que antes, solo se corrigen en el fichero de salida
+ *                  las que han cambiado; si no, se reescribe. La caché se descarta si cambia la configuración o el formato.
+ *                  La salida no debe modificarse entre ejecuciones, y se escribe siempre con finales de línea \n.
+ *                  Se ignora --streaming.
+ *      --cache-isa I  Guarda en el fichero I la configuración ya compilada, como una imagen binaria que se proyecta en
+ *                  memoria: la tabla hash de los mnemónicos tal cual, la codificación de cada instrucción (base, bits y
+ *                  campos con su posición, máscara, prefijo y sufijo), las opciones de la cabecera y el hash del texto de
+ *                  la configuración. En las siguientes ejecuciones la configuración se carga de la imagen sin leer su texto;
+ *                  si el texto ha cambiado o la imagen es de otra versión, se vuelve a leer y se reescribe la imagen.
+ *                  Sirve en el modo normal, con --objetivo y con --lote, y con --stats su carga cuenta como configuración.
+ *      --objetivo T=F  Escribe la salida de tipo T en el fichero F. Se puede repetir para obtener varias salidas del
+ *                  mismo ensamblado, y entonces solo se dan la configuración y el programa. El programa se lee y se
+ *                  codifica una sola vez (con -j, en varios hilos) y cada objetivo se escribe a la vez en su propio hilo.
+ *                  Los tipos sustituyen a la cabecera de la configuración:
+ *                      hex, bin                   Texto HEX o BIN, una palabra por línea
+ *                      logisim, vhdl              Sintaxis LOGISIM_OUT o VHDL_OUT, con los dígitos BIN o HEX de la
+ *                                                 configuración; con -hex o -bin (logisim-hex...) se eligen los dígitos
+ *                      binario, ihex, readmemh    Como en --formato
+ *                  Respetan --endian y --compactar. Con --stats se muestra el tiempo de ensamblado y de escritura.
+ *      --benchmark Genera una configuración y un programa sintéticos, los ensambla en memoria y muestra el tiempo,
+ *                  las líneas/s y los MB/s de la carga de la configuración, la primera pasada, la codificación y la
+ *                  emisión (a un flujo que descarta la salida). No se dan ficheros, sino parámetros clave=valor:
+ *                      lineas=1000000 instrucciones=64 bits=32 etiquetas=5 comentarios=10 relativos=20 semilla=1
+ *                  (etiquetas, comentarios y relativos son porcentajes). Respeta -j y --formato.
+ *      --diferencial  Comprueba que los motores dan la misma salida que el ensamblador original. Genera configuraciones
+ *                  y programas aleatorios (parámetros con prefijo y sufijo como rs*****fp, constantes &, saltos ## relativos,
+ *                  literales 'c', 0x y negativos, etiquetas con valor, tabuladores y líneas con errores) y ensambla cada uno
+ *                  con una copia del algoritmo original (ensamblarReferencia) y con cada motor: secuencial, hilos (-j, al
+ *                  menos 4), streaming, programa (ensamblarPrograma) y objeto (un módulo enlazado).
+ *                  Compara las salidas de texto palabra a palabra; si los dos fallan, no hay diferencia aunque el mensaje
+ *                  cambie. Streaming no se compara en los casos que redefinen etiquetas, donde usa el último valor definido
+ *                  antes de cada uso. Los casos con diferencias se reducen con el primer motor que difiere, quitando primero
+ *                  instrucciones y después cualquier línea del programa y de la configuración mientras la diferencia se
+ *                  repita, y se guardan en salida_N_config.txt y salida_N_programa.txt. Los parámetros son clave=valor:
+ *                      casos=1000 lineas=40 instrucciones=8 grandes=2 errores=1 semilla=1 guardar=5 salida=diferencia
+ *                  (grandes, los casos con 200 veces más líneas, para que se lean y codifiquen en varios hilos, y errores
+ *                  son porcentajes). El caso k usa la semilla semilla + k, y con casos=1 se repite solo ese.
+ *                  Devuelve 1 si hay alguna diferencia.
+ *      --lote M    Carga la configuración una vez y ensambla todos los programas del manifiesto M, cada uno con sus
+ *                  propias etiquetas. Solo se da el fichero de configuración. Cada línea de M es "entrada salida";
+ *                  las vacías y las que empiezan por ';' se ignoran. Con "-" los trabajos se leen de la entrada
+ *                  estándar según llegan. Con -j se ensamblan N programas a la vez, cada uno en un solo hilo.
+ *                  Los errores se muestran precedidos del fichero de entrada, y --stats da la suma de todos los programas.
+ *                  Se ignora --incremental.
+ *      --diagnostico  Antes de ensamblar, revisa todo el programa en una sola pasada sin detenerse en el primer error y
+ *                  muestra cada problema como "programa:linea:columna: error|aviso: mensaje", ordenados y sin repetir.
+ *                  Son errores los que detienen el ensamblado (instrucción desconocida, número de parámetros, sintaxis
+ *                  de un operando, número incorrecto, etiqueta desconocida, en cada uso); son avisos los valores y
+ *                  etiquetas que no caben en su campo y se recortan, los hexadecimales que se saturan a INT_MAX y las
+ *                  etiquetas redefinidas. Si hay errores no se crea la salida. Con solo la configuración y el
+ *                  programa, solo se revisa.
+ *      --desensamblar  Lee una imagen en el formato de --formato y --endian y escribe el programa que la genera. Se
+ *                  dan la configuración, la imagen y el programa de salida. Cada palabra se clasifica con un trie sobre los
+ *                  bits fijos de las instrucciones (opcode y relleno &), que en cada nodo mira hasta 8 bits a la vez.
+ *                  Los parámetros llevan el prefijo y el sufijo de la configuración (rs3, rt1fp...), los saltos relativos
+ *                  ## dentro del programa van a etiquetas etiqueta_PC, los demás valores se escriben como #valor y las
+ *                  palabras que no son ninguna instrucción quedan como comentarios. En texto se aceptan las salidas BIN
+ *                  y HEX, con LOGISIM_OUT o VHDL_OUT, y en readmemh las direcciones @ y los comentarios //.
+ *                  En BIN cada palabra se decodifica con todos sus bits, entre las instrucciones de su tamaño; en los
+ *                  demás formatos es un error que a una instrucción más larga que la palabra le falten bits de operandos.
+ *      --objeto    Ensambla un módulo por separado a un objeto reubicable. Se dan la configuración, el módulo y el objeto.
+ *                  Las etiquetas de ".global etiqueta ..." las pueden usar los demás módulos, y las que el módulo usa
+ *                  sin definir se buscan al enlazar. El objeto guarda las palabras, los símbolos locales y globales y las
+ *                  reubicaciones de los campos # con posiciones o etiquetas externas y de los ## con valores o etiquetas
+ *                  externas. En un módulo, .org y .align son relativos a su inicio, y .incbin usa el orden de --endian.
+ *                  Al ensamblar un programa entero, .global no tiene efecto.
+ *      --enlazar   Enlaza los objetos, uno tras otro en el orden dado desde el PC 0, y escribe el programa en el formato
+ *                  de --formato, con --endian y --compactar. Se dan la configuración, la salida y los objetos, que deben
+ *                  ser de la misma configuración. Así solo se vuelven a ensamblar los módulos que cambian.
+ *      --generar-isa  Escribe una cabecera de C++ con la configuración para una configuración que no cambia. Se dan la
+ *                  configuración y la cabecera. Tiene la configuración, sus opciones, tablas constexpr con la codificación
+ *                  base, los bits y los parámetros de cada instrucción, un hash perfecto de los mnemónicos y un codificador
+ *                  con un caso por instrucción, con los desplazamientos y máscaras de sus campos como constantes.
+ *                  Compilando con -DCUMPILADOR_ISA='"cabecera.h"', la configuración generada (con el mismo texto) se
+ *                  ensambla con ellos, y el compilador puede integrar y plegar cada campo; las demás configuraciones
+ *                  se siguen leyendo en tiempo de ejecución.
+ *      --simular   Ensambla el programa en memoria y lo ejecuta en un simulador funcional. Solo se dan la configuración
+ *                  y el programa. Cada palabra se predecodifica una vez en su operación y sus campos, y se ejecuta con
+ *                  despacho directo (goto computado con GCC y Clang, switch con otros compiladores). La semántica se
+ *                  asigna por el mnemónico: ADD, SUB, AND y OR (rs rt rd), LW y SW (rs rt #desplazamiento), BEQ
+ *                  (rs rt #destino), ADDFP y SUBFP (sobre los registros FP), LWFP, SWFP y NOP; los operandos son los
+ *                  campos de la configuración en su orden. Se detiene al ejecutar un salto a sí mismo, al salir del
+ *                  programa o al llegar a una instrucción sin semántica. Muestra los pasos, los MIPS simulados, y los
+ *                  registros y la memoria distintos de 0.
+ *                      --pasos N     Máximo de instrucciones a ejecutar (sin límite por defecto)
+ *                      --memoria N   Palabras de 32 bits de la memoria de datos, redondeado a potencia de 2 (65536)
+ *                      --datos F     Contenido inicial de la memoria: palabras hexadecimales separadas por espacios
+ *                                    o líneas desde la dirección 0, @direccion para cambiar de dirección y // o ;
+ *                                    para comentarios, como el formato readmemh
+ *                      --perfil      Cuenta las ejecuciones de cada instrucción y las muestra por mnemónico, junto
+ *                                    con las instrucciones más ejecutadas
+ * 
+ *    Mejoras pendientes:
+ * 
+ *    Errores conocidos: 
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <bitset>
+#include <map>
+#include <unordered_map>
+#include <list>
+#include <deque>
+#include <vector>
+#include <sstream>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <climits>
+#include <string_view>
+#include <charconv>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <chrono>
+#include <random>
+#include <iomanip>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include "libcumpilador.h"
+#include "diferencial.h"
+
+using namespace std;
+using namespace cumpilador;
+
+
+
+// Excepciones de los ficheros, la biblioteca no usa ninguno
+
+class exception_file : public exception
+{
+    public:
+
+    string msg;
+
+    exception_file (string accion, string fichero)
+    {
+        msg = "No se ha podido " + accion + " el fichero " + fichero;
+    }
+
+    const char * what() const throw() override
+    {
+        return msg.c_str();
+    }
+};
+
+
+
+// Pico de memoria residente del proceso en KiB, o 0 si no se puede saber
+size_t picoMemoria ()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS contadores;
+    if (GetProcessMemoryInfo (GetCurrentProcess(), &contadores, sizeof(contadores)))
+        return contadores.PeakWorkingSetSize / 1024;
+#else
+    struct rusage uso;
+    if (getrusage (RUSAGE_SELF, &uso) == 0)
+#ifdef __APPLE__
+        return uso.ru_maxrss / 1024;                 // En bytes en macOS
+#else
+        return uso.ru_maxrss;
+#endif
+#endif
+    return 0;
+}
+
+
+// Muestra las estadísticas del ensamblado como texto o como un objeto JSON
+
+void mostrarEstadisticas (ostream &salida, const estadisticas_ensamblado &e, bool json)
+{
+    double msTotal = e.msConfig + e.msLectura + e.msEtiquetas + e.msCodificacion + e.msSalida;
+    size_t pico = picoMemoria();
+
+    salida << fixed << setprecision(3);
+
+    if (json)
+    {
+        salida << "{\"tiempos_ms\": {\"configuracion\": " << e.msConfig << ", \"lectura\": " << e.msLectura
+               << ", \"etiquetas\": " << e.msEtiquetas << ", \"codificacion\": " << e.msCodificacion
+               << ", \"salida\": " << e.msSalida << ", \"total\": " << msTotal << "}"
+               << ", \"instrucciones\": " << e.instrucciones << ", \"reutilizadas\": " << e.reutilizadas << ", \"etiquetas\": " << e.etiquetas
+               << ", \"busquedas_mnemonico\": " << e.almacen.busquedasMnemonico
+               << ", \"busquedas_etiqueta\": " << e.almacen.busquedasEtiqueta + e.definiciones
+               << ", \"reservas_memoria\": " << e.almacen.reservas << ", \"bytes_reservados\": " << e.almacen.bytesReservados
+               << ", \"bytes_leidos\": " << e.bytesLeidos << ", \"bytes_escritos\": " << e.bytesEscritos
+               << ", \"pico_memoria_kib\": " << pico << "}" << endl;
+        return;
+    }
+
+    salida << "Tiempos (ms):" << endl
+           << "  Configuracion        " << setw(12) << e.msConfig << endl
+           << "  Lectura              " << setw(12) << e.msLectura << endl
+           << "  Etiquetas            " << setw(12) << e.msEtiquetas << endl
+           << "  Codificacion         " << setw(12) << e.msCodificacion << endl
+           << "  Salida               " << setw(12) << e.msSalida << endl
+           << "  Total                " << setw(12) << msTotal << endl
+           << "Instrucciones:         " << e.instrucciones << endl
+           << "Reutilizadas:          " << e.reutilizadas << endl
+           << "Etiquetas:             " << e.etiquetas << endl
+           << "Busquedas mnemonico:   " << e.almacen.busquedasMnemonico << endl
+           << "Busquedas etiqueta:    " << e.almacen.busquedasEtiqueta + e.definiciones << endl
+           << "Reservas de memoria:   " << e.almacen.reservas << " (" << e.almacen.bytesReservados << " bytes)" << endl
+           << "Bytes leidos:          " << e.bytesLeidos << endl
+           << "Bytes escritos:        " << e.bytesEscritos << endl
+           << "Pico de memoria:       " << pico << " KiB" << endl;
+}
+
+
+// Caché del ensamblado incremental, con lo necesario para saber qué instrucciones hay que volver a codificar
+// Las etiquetas de las referencias son posiciones en nombresEtiquetas, que guarda todas las de la tabla de etiquetas
+template <typename palabra_t>
+struct cache_incremental
+{
+    vector<string> nombresEtiquetas;                 // Nombre de cada etiqueta
+    vector<int32_t> valoresEtiquetas;                // Valor de cada etiqueta
+    vector<uint8_t> etiquetasDefinidas;              // La etiqueta estaba definida
+    vector<uint64_t> hashes;                         // Hash del nombre y los operandos de cada instrucción
+    vector<int32_t> pcs;                             // PC de cada instrucción
+    vector<uint8_t> nBits;                           // Bits de la codificación de cada instrucción
+    vector<palabra_t> palabras;                      // Codificación de cada instrucción
+    vector<uint64_t> posiciones;                     // Posición de cada palabra en la salida
+    vector<uint32_t> primeraReferencia;              // Primera referencia de cada instrucción, con una más al final
+    vector<uint32_t> referencias;                    // Etiquetas usadas por las instrucciones, en orden
+    uint64_t bytesSalida = 0;                        // Tamaño del fichero de salida
+};
+
+const char MAGIA_CACHE[8] = {'C', 'U', 'M', 'P', 'C', 'A', 'C', 'H'};  // Inicio de un fichero de caché
+const uint32_t VERSION_CACHE = 1;                                      // Se cambia si cambia el formato de la caché
+
+
+// Hash del nombre y los operandos de la instrucción i, sin espacios ni comentarios
+
+uint64_t hashInstruccion (const almacen_instrucciones &codigo, size_t i)
+{
+    const plan_instruccion &plan = codigo.plan(i);
+    uint64_t hash = hashTexto (plan.nombre);
+
+    for (int c = 0; c < plan.campos.size(); c++)
+        hash = hashTexto (codigo.operando(i, c), hashTexto (" ", hash));
+
+    return hash;
+}
+
+
+// Lee la caché de ruta. Devuelve false si no existe, es de otra versión, se hizo con otra clave o está incompleta
+
+template <typename palabra_t>
+bool leerCache (const char *ruta, uint64_t clave, cache_incremental<palabra_t> &cache)
+{
+    fichero_mapeado f (ruta);
+    string_view datos = f.contenido();
+    const char *p = datos.data(), *fin = datos.data() + datos.size();
+
+    uint32_t version;
+    uint64_t claveCache;
+    if (!f.is_open() || datos.size() < sizeof(MAGIA_CACHE) + sizeof(version) + sizeof(claveCache)
+        || memcmp (p, MAGIA_CACHE, sizeof(MAGIA_CACHE)) != 0)
+        return false;
+
+    p += sizeof(MAGIA_CACHE);
+    memcpy (&version, p, sizeof(version));
+    p += sizeof(version);
+    memcpy (&claveCache, p, sizeof(claveCache));
+    p += sizeof(claveCache);
+    if (version != VERSION_CACHE || claveCache != clave)
+        return false;
+
+    vector<char> nombres;                                                       // Nombres de las etiquetas, separados por '\0'
+    vector<uint64_t> bytesSalida;
+    if (!leerVector (p, fin, nombres) || !leerVector (p, fin, cache.valoresEtiquetas) || !leerVector (p, fin, cache.etiquetasDefinidas)
+        || !leerVector (p, fin, cache.hashes) || !leerVector (p, fin, cache.pcs) || !leerVector (p, fin, cache.nBits)
+        || !leerVector (p, fin, cache.palabras) || !leerVector (p, fin, cache.posiciones)
+        || !leerVector (p, fin, cache.primeraReferencia) || !leerVector (p, fin, cache.referencias)
+        || !leerVector (p, fin, bytesSalida) || bytesSalida.size() != 1)
+        return false;
+
+    for (size_t inicio = 0; inicio < nombres.size(); )
+    {
+        size_t finNombre = find (nombres.begin() + inicio, nombres.end(), '\0') - nombres.begin();
+        cache.nombresEtiquetas.emplace_back (&nombres[inicio], finNombre - inicio);
+        inicio = finNombre + 1;
+    }
+    cache.bytesSalida = bytesSalida[0];
+
+    size_t n = cache.hashes.size();                                             // Comprueba que todo cuadra
+    if (cache.nombresEtiquetas.size() != cache.valoresEtiquetas.size() || cache.etiquetasDefinidas.size() != cache.valoresEtiquetas.size()
+        || cache.pcs.size() != n || cache.nBits.size() != n || cache.palabras.size() != n || cache.posiciones.size() != n
+        || cache.primeraReferencia.size() != n + 1 || cache.primeraReferencia.back() != cache.referencias.size())
+        return false;
+
+    for (size_t i = 0; i < n; i++)                                              // Las referencias de cada instrucción y su palabra
+        if (cache.primeraReferencia[i] > cache.primeraReferencia[i + 1]         // en la salida van en orden y dentro de ella
+            || cache.posiciones[i] > cache.bytesSalida || (i > 0 && cache.posiciones[i] < cache.posiciones[i - 1]))
+            return false;
+
+    for (uint32_t etiqueta : cache.referencias)
+        if (etiqueta >= cache.nombresEtiquetas.size())
+            return false;
+
+    return true;
+}
+
+
+// Escribe la caché en ruta
+
+template <typename palabra_t>
+void escribirCache (const char *ruta, uint64_t clave, const cache_incremental<palabra_t> &cache)
+{
+    ofstream f (ruta, ios::out | ios::binary | ios::trunc);
+    if (!f.is_open())
+        throw exception_file ("escribir", ruta);
+
+    vector<char> nombres;
+    for (const string &nombre : cache.nombresEtiquetas)
+    {
+        nombres.insert (nombres.end(), nombre.begin(), nombre.end());
+        nombres.push_back ('\0');
+    }
+
+    f.write (MAGIA_CACHE, sizeof(MAGIA_CACHE));
+    f.write ((const char *) &VERSION_CACHE, sizeof(VERSION_CACHE));
+    f.write ((const char *) &clave, sizeof(clave));
+    escribirVector (f, nombres);
+    escribirVector (f, cache.valoresEtiquetas);
+    escribirVector (f, cache.etiquetasDefinidas);
+    escribirVector (f, cache.hashes);
+    escribirVector (f, cache.pcs);
+    escribirVector (f, cache.nBits);
+    escribirVector (f, cache.palabras);
+    escribirVector (f, cache.posiciones);
+    escribirVector (f, cache.primeraReferencia);
+    escribirVector (f, cache.referencias);
+    escribirVector (f, vector<uint64_t> (1, cache.bytesSalida));
+
+    if (!f)
+        throw exception_file ("escribir", ruta);
+}
+
+
+// Carga en isa el texto de configuración con la caché de juego de instrucciones compilado de ruta (sin ella, si es nullptr)
+// Si la imagen de ruta es de este texto se usa sin leer la configuración; si no existe o está desfasada, se lee el texto y
+// se reescribe. Se escribe en un fichero temporal que se renombra, para que otras ejecuciones no lean una imagen a medias
+
+void cargarConfiguracionCacheada (string_view texto, const char *ruta, configuracion_isa &isa)
+{
+    if (ruta != nullptr)
+    {
+        fichero_mapeado f_isa (ruta);
+        if (f_isa.is_open() && cargarIsaCompilada (f_isa.contenido(), texto, isa))
+            return;
+    }
+
+    cargarConfiguracion (texto, isa);
+    if (ruta == nullptr)
+        return;
+
+    string temporal = string(ruta) + "." + std::to_string (chrono::steady_clock::now().time_since_epoch().count()) + ".tmp";
+    {
+        ofstream f (temporal, ios::out | ios::binary | ios::trunc);
+        if (!f.is_open())
+            throw exception_file ("escribir", temporal);
+        escribirIsaCompilada (f, isa, texto);
+        if (!f)
+            throw exception_file ("escribir", temporal);
+    }
+
+#ifdef _WIN32
+    remove (ruta);                                                              // En Windows rename no sustituye el fichero
+#endif
+    if (rename (temporal.c_str(), ruta) != 0)
+    {
+        remove (temporal.c_str());
+        throw exception_file ("escribir", ruta);
+    }
+}
+
+
+// Ensamblado incremental: la primera pasada es la normal, pero solo se vuelven a codificar las instrucciones
+// cuyo texto ha cambiado, cuyo PC se ha movido o que usan etiquetas cuyo valor ha cambiado desde la ejecución
+// que escribió la caché. Si todas las palabras ocupan lo mismo que antes, se corrigen en el fichero de salida
+// las que han cambiado; si no, se reescribe entero. La clave identifica la configuración y el formato de salida.
+
+template <typename palabra_t>
+void ensamblarIncremental (string_view texto, int nHilos, const modo_salida &modo, const char *rutaSalida, const char *rutaCache,
+                           uint64_t clave, contexto_ensamblado &ctx)
+{
+    clave = hashTexto (std::to_string(sizeof(palabra_t)), clave);             // Las palabras de la caché son de este tipo
+
+    auto inicio = chrono::steady_clock::now();
+    double msEtiquetasAntes = ctx.estadisticas.msEtiquetas;
+
+    almacen_instrucciones codigo (ctx.isa, texto.data(), ctx.etiquetas);                 // Instrucciones del programa, en orden
+    primeraPasada (texto, nHilos, codigo, ctx);
+
+    ctx.estadisticas.msLectura += milisegundosDesde (inicio) - (ctx.estadisticas.msEtiquetas - msEtiquetasAntes);
+    ctx.estadisticas.almacen = codigo.contadores();
+    ctx.estadisticas.instrucciones = codigo.size();
+
+    string directivas;                                                          // Las directivas no están en la caché: forman parte de la clave
+    for (const relleno_memoria &relleno : codigo.rellenos)
+    {
+        directivas += std::to_string(relleno.antesDe) + " " + std::to_string(relleno.n) + " " + std::to_string(relleno.valor) + (relleno.hueco ? " h" : " f");
+        for (int valor : relleno.valores)
+            directivas += " " + std::to_string(valor);
+        if (relleno.binario)
+            directivas += " " + std::to_string(hashTexto (relleno.binario->contenido()));
+        directivas += "\n";
+    }
+    clave = hashTexto (directivas, clave);
+
+    inicio = chrono::steady_clock::now();
+
+    cache_incremental<palabra_t> anterior;
+    bool hayCache = leerCache (rutaCache, clave, anterior);
+
+    vector<char> movida (anterior.nombresEtiquetas.size());                    // Etiquetas de la caché cuyo valor ha cambiado
+    for (size_t k = 0; k < movida.size(); k++)
+    {
+        int id = ctx.etiquetas.buscar(anterior.nombresEtiquetas[k]);
+        movida[k] = id < 0 || !ctx.etiquetas.definida(id) || !anterior.etiquetasDefinidas[k] || ctx.etiquetas.direccion(id) != anterior.valoresEtiquetas[k];
+    }
+
+    cache_incremental<palabra_t> nueva;
+    size_t n = codigo.size();
+
+    for (size_t id = 0; id < ctx.etiquetas.size(); id++)
+    {
+        nueva.nombresEtiquetas.emplace_back (ctx.etiquetas.nombre(id));
+        nueva.valoresEtiquetas.push_back (ctx.etiquetas.definida(id) ? ctx.etiquetas.direccion(id) : 0);
+        nueva.etiquetasDefinidas.push_back (ctx.etiquetas.definida(id));
+    }
+
+    nueva.hashes.resize (n);
+    nueva.pcs.resize (n);
+    nueva.nBits.resize (n);
+    nueva.palabras.resize (n);
+    nueva.primeraReferencia.resize (n + 1);
+
+    vector<size_t> cambiadas;                                                   // Instrucciones codificadas de nuevo
+
+    for (size_t i = 0; i < n; i++)
+    {
+        instruccion inst (codigo, i);
+        const plan_instruccion &plan = inst.obtenerPlan();
+
+        nueva.hashes[i] = hashInstruccion (codigo, i);
+        nueva.pcs[i] = codigo.pcs[i];
+        nueva.nBits[i] = plan.nBits;
+        nueva.primeraReferencia[i] = nueva.referencias.size();
+
+        for (int c = 0; c < plan.campos.size(); c++)
+            if (codigo.simbolo(i, c) >= 0)
+                nueva.referencias.push_back (codigo.simbolo(i, c));
+
+        bool reutilizable = hayCache && i < anterior.hashes.size()
+                            && anterior.hashes[i] == nueva.hashes[i] && anterior.pcs[i] == nueva.pcs[i];
+
+        for (uint32_t r = reutilizable ? anterior.primeraReferencia[i] : 0; reutilizable && r < anterior.primeraReferencia[i + 1]; r++)
+            reutilizable = !movida[anterior.referencias[r]];
+
+        if (reutilizable)
+            nueva.palabras[i] = anterior.palabras[i];
+        else
+        {
+            nueva.palabras[i] = inst.codificar<palabra_t>(ctx.etiquetas);
+            cambiadas.push_back (i);
+        }
+    }
+
+    nueva.primeraReferencia[n] = nueva.referencias.size();
+    ctx.estadisticas.reutilizadas = n - cambiadas.size();
+    ctx.estadisticas.msCodificacion += milisegundosDesde (inicio);
+
+    inicio = chrono::steady_clock::now();
+
+    bool parchear = hayCache && anterior.hashes.size() == n && anterior.nBits == nueva.nBits && !modo.compacta();
+    {
+        fichero_mapeado salidaAnterior (rutaSalida);                            // Solo para saber si existe y su tamaño
+        parchear = parchear && salidaAnterior.is_open() && salidaAnterior.contenido().size() == anterior.bytesSalida;
+    }
+
+    vector<char> formateada (MAX_BYTES_PALABRA);
+    for (size_t k = 0; parchear && k < cambiadas.size(); k++)                   // Cada palabra cambiada debe caber en la salida
+    {
+        size_t i = cambiadas[k];
+        size_t bytes = formatearPalabras (modo, &nueva.palabras[i], &nueva.nBits[i], 1, nueva.pcs[i], formateada.data());
+        parchear = bytes <= anterior.bytesSalida - anterior.posiciones[i];
+    }
+
+    if (parchear)                                                               // Corrige en la salida las palabras que han cambiado
+    {
+        fstream f_salida (rutaSalida, ios::in | ios::out | ios::binary);
+
+        if (!f_salida.is_open())
+            throw exception_file ("escribir", rutaSalida);
+
+        for (size_t i : cambiadas)
+        {
+            if (nueva.palabras[i] == anterior.palabras[i])
+                continue;
+
+            size_t bytes = formatearPalabras (modo, &nueva.palabras[i], &nueva.nBits[i], 1, nueva.pcs[i], formateada.data());
+            f_salida.seekp (anterior.posiciones[i]);
+            f_salida.write (formateada.data(), bytes);
+            ctx.estadisticas.bytesEscritos += bytes;
+        }
+
+        if (!f_salida)
+            throw exception_file ("escribir", rutaSalida);
+
+        nueva.posiciones = move (anterior.posiciones);
+        nueva.bytesSalida = anterior.bytesSalida;
+    }
+    else                                                                        // Reescribe la salida entera
+    {
+        ofstream f_salida (rutaSalida, ios::out | ios::binary | ios::trunc);
+        if (!f_salida.is_open())
+            throw exception_file ("escribir", rutaSalida);
+
+        escritor_salida escritor (f_salida, modo);
+        nueva.posiciones.resize (n);
+        size_t r = 0;                                                           // Siguiente directiva por escribir
+
+        for (size_t i = 0; i < n; i++)
+        {
+            for (; r < codigo.rellenos.size() && codigo.rellenos[r].antesDe <= i; r++)
+                escritor.rellenar (codigo.rellenos[r]);
+
+            nueva.posiciones[i] = escritor.posicion();
+            escritor.escribir (&nueva.palabras[i], &nueva.nBits[i], 1);
+        }
+
+        for (; r < codigo.rellenos.size(); r++)
+            escritor.rellenar (codigo.rellenos[r]);
+
+        escritor.terminar ();
+        nueva.bytesSalida = escritor.posicion();
+        ctx.estadisticas.bytesEscritos = nueva.bytesSalida;
+
+        if (!f_salida)
+            throw exception_file ("escribir", rutaSalida);
+    }
+
+    ctx.estadisticas.msSalida += milisegundosDesde (inicio);
+
+    escribirCache (rutaCache, clave, nueva);
+}
+
+
+// Parámetros del modo benchmark, se cambian con clave=valor en la línea de comandos
+struct parametros_benchmark
+{
+    long long lineas = 1000000;                      // Líneas del programa sintético, sin contar las etiquetas que faltan al final
+    int instrucciones = 64;                          // Instrucciones distintas en la configuración
+    int bits = 32;                                   // Tamaño de instrucción
+    double etiquetas = 5;                            // Porcentaje de líneas que son etiquetas
+    double comentarios = 10;                         // Porcentaje de líneas con comentario
+    double relativos = 20;                           // Porcentaje de instrucciones que son saltos relativos
+    unsigned semilla = 1;                            // Semilla del generador, para repetir las mismas entradas
+};
+
+// Forma de una instrucción de la configuración sintética
+struct instruccion_sintetica
+{
+    bool salto;                                      // Tiene una etiqueta relativa
+    int nRegistros;                                  // Parámetros r***** de 5 bits
+    bool inmediato;                                  // Tiene un valor #*** con los bits restantes
+};
+
+
+// Flujo de salida que descarta todo lo que se escribe, para medir la emisión sin el disco
+class flujo_nulo : public streambuf
+{
+    protected:
+
+        streamsize xsputn (const char *, streamsize n) override { return n; }
+        int overflow (int c) override { return c; }
+};
+
+
+// Genera una configuración sintética y devuelve su texto
+// Una de cada cuatro instrucciones (empezando por la primera) es un salto relativo con un registro si cabe;
+// el resto tienen entre uno y tres registros de 5 bits, y el hueco restante como inmediato o relleno
+
+string generarConfiguracion (const parametros_benchmark &par, mt19937_64 &aleatorio, vector<instruccion_sintetica> &formas)
+{
+    int bitsOpcode = 1;                                                         // Bits para codificar todas las instrucciones
+    while ((1LL << bitsOpcode) < par.instrucciones)
+        bitsOpcode++;
+
+    if (par.bits - bitsOpcode < 1)
+        throw exception_wrong_config_syntax ("No caben " + std::to_string(par.instrucciones) + " instrucciones en " + std::to_string(par.bits) + " bits");
+
+    string config = "HEX\nSALTO_RELATIVO\nTAMANYO_INSTRUCCION=" + std::to_string(par.bits) + "\n";
+
+    for (int k = 0; k < par.instrucciones; k++)
+    {
+        instruccion_sintetica forma = {k % 4 == 0, 0, false};
+        int libres = par.bits - bitsOpcode;                                     // Bits sin ocupar de la instrucción
+
+        string opcode (bitsOpcode, '0');
+        for (int b = 0; b < bitsOpcode; b++)
+            opcode[bitsOpcode - 1 - b] = (k >> b) & 1 ? '1' : '0';
+
+        config += "I" + std::to_string(k) + "<" + opcode + ">";
+
+        if (forma.salto)                                                        // Salto: registro y etiqueta relativa
+        {
+            if (libres > 5)
+            {
+                config += " r*****";
+                forma.nRegistros = 1;
+                libres -= 5;
+            }
+            config += " ##" + string(libres, '*');
+        }
+        else
+        {
+            int maxRegistros = 1 + aleatorio() % 3;
+            for (; forma.nRegistros < maxRegistros && libres >= 5; forma.nRegistros++, libres -= 5)
+                config += " r*****";
+
+            forma.inmediato = libres > 0 && aleatorio() % 2;
+            if (forma.inmediato)                                                // Inmediato
+                config += " #" + string(libres, '*');
+            else if (libres > 0)                                                // Relleno
+                config += " &" + string(libres, '0');
+        }
+
+        config += "\n";
+        formas.push_back(forma);
+    }
+
+    return config;
+}
+
+
+// Genera un programa sintético para las instrucciones de generarConfiguracion y devuelve su texto
+// Los saltos van a cualquier etiqueta; las que no han aparecido se definen al final
+
+string generarPrograma (const parametros_benchmark &par, mt19937_64 &aleatorio, const vector<instruccion_sintetica> &formas)
+{
+    const uint64_t ESCALA = 1000000;                                            // Precisión de los porcentajes
+    uint64_t umbralEtiqueta = par.etiquetas / 100 * ESCALA;
+    uint64_t umbralComentario = par.comentarios / 100 * ESCALA;
+    uint64_t umbralRelativo = par.relativos / 100 * ESCALA;
+    long long nEtiquetas = max (1LL, (long long) (par.lineas * par.etiquetas / 100));   // Etiquetas distintas del programa
+    long long definidas = 0;                                                    // Etiquetas ya definidas, en orden
+
+    vector<int> saltos, otras;                                                  // Instrucciones de cada tipo
+    for (int k = 0; k < formas.size(); k++)
+        (formas[k].salto ? saltos : otras).push_back(k);
+
+    string programa;
+    programa.reserve (par.lineas * 24);
+    char numero[24];
+
+    auto anyadirNumero = [&] (const char *prefijo, long long valor)
+    {
+        programa += prefijo;
+        programa.append (numero, to_chars (numero, numero + sizeof(numero), valor).ptr);
+    };
+
+    for (long long l = 0; l < par.lineas; l++)
+    {
+        if (aleatorio() % ESCALA < umbralEtiqueta && definidas < nEtiquetas)   // Etiqueta
+            anyadirNumero ("L", definidas++);
+
+        else
+        {
+            bool salto = otras.empty() || aleatorio() % ESCALA < umbralRelativo;
+            int k = salto ? saltos[aleatorio() % saltos.size()] : otras[aleatorio() % otras.size()];
+
+            anyadirNumero ("I", k);
+            for (int r = 0; r < formas[k].nRegistros; r++)
+                anyadirNumero (" r", aleatorio() % 32);
+            if (formas[k].inmediato)
+                anyadirNumero (" #", aleatorio() % 1000);
+            if (salto)
+                anyadirNumero (" L", aleatorio() % nEtiquetas);
+        }
+
+        if (aleatorio() % ESCALA < umbralComentario)
+            programa += "    ; comentario";
+
+        programa += "\n";
+    }
+
+    for (; definidas < nEtiquetas; definidas++)                                 // Define las etiquetas que faltan
+    {
+        anyadirNumero ("L", definidas);
+        programa += "\n";
+    }
+
+    return programa;
+}
+
+
+// Codifica todo el almacén con palabras de tipo palabra_t, y después formatea y emite la salida a un flujo nulo
+// Devuelve los tiempos de cada fase en milisegundos y los bytes emitidos
+
+template <typename palabra_t>
+void medirSegundaPasada (const almacen_instrucciones &codigo, const tabla_etiquetas &etiquetas, const modo_salida &modo, int nHilos,
+                         double &msCodificacion, double &msEmision, size_t &bytesEmitidos)
+{
+    vector<palabra_t> palabras (codigo.size());
+    vector<uint8_t> nBits (codigo.size());
+    vector<exception_ptr> errores (nHilos);
+
+    auto inicio = chrono::steady_clock::now();
+
+    auto codificarTramo = [&] (int h)                                           // Cada hilo codifica un tramo contiguo
+    {
+        size_t desde = codigo.size() * h / nHilos, hasta = codigo.size() * (h + 1) / nHilos;
+        try
+        {
+            codificarBloque (codigo, etiquetas, desde, hasta - desde, palabras.data() + desde, nBits.data() + desde);
+        }
+        catch (...)
+        {
+            errores[h] = current_exception();
+        }
+    };
+
+    vector<thread> hilos;
+    for (int h = 1; h < nHilos; h++)
+        hilos.emplace_back (codificarTramo, h);
+    codificarTramo (0);
+    for (thread &hilo : hilos)
+        hilo.join();
+
+    for (exception_ptr &error : errores)
+        if (error)
+            rethrow_exception (error);
+
+    msCodificacion = milisegundosDesde (inicio);
+
+    flujo_nulo nulo;
+    ostream salida (&nulo);
+
+    inicio = chrono::steady_clock::now();
+    escritor_salida escritor (salida, modo);
+    escritor.escribir (palabras.data(), nBits.data(), palabras.size());
+    bytesEmitidos = escritor.posicion();
+    escritor.terminar ();
+    msEmision = milisegundosDesde (inicio);
+}
+
+
+// Modo benchmark: genera una configuración y un programa sintéticos con los parámetros dados como clave=valor,
+// los ensambla en memoria y muestra el tiempo y el rendimiento de cada fase
+
+int ejecutarBenchmark (const vector<char *> &argumentos, int nHilos, formato_salida formato, bool littleEndian)
+{
+    parametros_benchmark par;
+
+    for (const char *argumento : argumentos)
+    {
+        string arg = argumento;
+        size_t igual = arg.find('=');
+        string clave = arg.substr(0, igual);
+        string valor = igual == string::npos ? "" : arg.substr(igual + 1);
+
+        try
+        {
+            if (clave == "lineas") par.lineas = stoll(valor);
+            else if (clave == "instrucciones") par.instrucciones = stoi(valor);
+            else if (clave == "bits") par.bits = stoi(valor);
+            else if (clave == "etiquetas") par.etiquetas = stod(valor);
+            else if (clave == "comentarios") par.comentarios = stod(valor);
+            else if (clave == "relativos") par.relativos = stod(valor);
+            else if (clave == "semilla") par.semilla = stoul(valor);
+            else
+            {
+                cerr << "Parametro de benchmark desconocido: " << arg << endl;
+                return 1;
+            }
+        }
+        catch (const std::exception &)
+        {
+            cerr << "Valor incorrecto en el parametro de benchmark " << arg << endl;
+            return 1;
+        }
+    }
+
+    if (par.lineas < 1 || par.instrucciones < 1 || par.instrucciones > MAX_ID_INSTRUCCION || par.bits < 2 || par.bits > MAX_BITS_CODIFICACION)
+    {
+        cerr << "Parametros de benchmark fuera de rango: lineas >= 1, instrucciones entre 1 y " << MAX_ID_INSTRUCCION
+             << ", bits entre 2 y " << MAX_BITS_CODIFICACION << endl;
+        return 1;
+    }
+
+    try
+    {
+        mt19937_64 aleatorio (par.semilla);
+        vector<instruccion_sintetica> formas;
+
+        auto inicio = chrono::steady_clock::now();
+        string config = generarConfiguracion (par, aleatorio, formas);
+        string programa = generarPrograma (par, aleatorio, formas);
+        double msGeneracion = milisegundosDesde (inicio);
+
+        size_t lineasConfig = count (config.begin(), config.end(), '\n');
+        size_t lineasPrograma = count (programa.begin(), programa.end(), '\n');
+
+        inicio = chrono::steady_clock::now();
+        configuracion_isa isa (config);
+        double msConfig = milisegundosDesde (inicio);
+
+        contexto_ensamblado ctx (isa);
+        almacen_instrucciones codigo (isa, programa.data(), ctx.etiquetas);
+        inicio = chrono::steady_clock::now();
+        primeraPasada (programa, nHilos, codigo, ctx);
+        double msPrimera = milisegundosDesde (inicio);
+
+        double msCodificacion, msEmision;
+        size_t bytesEmitidos;
+        conTipoPalabra (isa, [&] (auto palabra)
+        {
+            medirSegundaPasada<decltype(palabra)> (codigo, ctx.etiquetas, modo_salida (isa, formato, littleEndian), nHilos, msCodificacion, msEmision, bytesEmitidos);
+        });
+
+        cout << "Benchmark: " << par.lineas << " lineas, " << par.instrucciones << " instrucciones de " << par.bits << " bits, "
+             << par.etiquetas << "% etiquetas, " << par.comentarios << "% comentarios, " << par.relativos << "% saltos relativos, semilla "
+             << par.semilla << ", " << nHilos << " hilos" << endl;
+        cout << "Configuracion: " << lineasConfig << " lineas, " << config.size() << " bytes" << endl;
+        cout << "Programa: " << lineasPrograma << " lineas, " << programa.size() << " bytes, " << codigo.size()
+             << " instrucciones (generado en " << fixed << setprecision(1) << msGeneracion << " ms)" << endl;
+        cout << "Salida: " << bytesEmitidos << " bytes" << endl << endl;
+
+        auto fila = [] (const char *fase, double ms, size_t lineas, size_t bytes)
+        {
+            double segundos = max (ms, 1e-6) / 1000;
+            cout << left << setw(22) << fase << right << fixed
+                 << setprecision(2) << setw(14) << ms
+                 << setprecision(0) << setw(16) << lineas / segundos
+                 << setprecision(1) << setw(12) << bytes / segundos / (1 << 20) << endl;
+        };
+
+        cout << left << setw(22) << "Fase" << right << setw(14) << "Tiempo (ms)" << setw(16) << "Lineas/s" << setw(12) << "MB/s" << endl;
+        fila ("Carga configuracion", msConfig, lineasConfig, config.size());
+        fila ("Primera pasada", msPrimera, lineasPrograma, programa.size());
+        fila ("Codificacion", msCodificacion, codigo.size(), programa.size());
+        fila ("Emision", msEmision, codigo.size(), bytesEmitidos);
+        fila ("Total", msConfig + msPrimera + msCodificacion + msEmision, lineasPrograma, programa.size());
+    }
+    catch (const exception& e)
+    {
+        cout << e.what() << endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+
+// Programa de un lote: se ensambla el fichero entrada en el fichero salida
+struct trabajo_lote
+{
+    string entrada;                                  // Fichero a ensamblar
+    string salida;                                   // Fichero de salida
+};
+
+
+// Ensambla un programa del lote con su propio contexto, sin hilos dentro del trabajo
+// Los errores se lanzan como excepciones, igual que en el ensamblado de un solo programa
+
+void ensamblarTrabajo (const trabajo_lote &trabajo, const modo_salida &modo, bool streaming, contexto_ensamblado &ctx)
+{
+    fichero_mapeado f_entrada (trabajo.entrada.c_str());
+    if (!f_entrada.is_open())
+        throw exception_file ("encontrar", trabajo.entrada);
+
+    ofstream f_salida (trabajo.salida, modo.formato == SALIDA_BINARIA ? ios::out | ios::binary : ios::out);
+    if (!f_salida.is_open())
+        throw exception_file ("escribir", trabajo.salida);
+
+    ctx.estadisticas.bytesLeidos = f_entrada.contenido().size();
+
+    escritor_salida escritor (f_salida, modo);
+
+    conTipoPalabra (ctx.isa, [&] (auto palabra)
+    {
+        ensamblar<decltype(palabra)> (f_entrada.contenido(), 1, streaming, escritor, ctx);
+    });
+
+    auto inicio = chrono::steady_clock::now();
+    escritor.terminar();
+    ctx.estadisticas.msSalida += milisegundosDesde (inicio);
+    ctx.estadisticas.bytesEscritos = escritor.posicion();
+    ctx.estadisticas.etiquetas = ctx.etiquetas.size();
+}
+
+
+// Modo lote: con la configuración isa ya cargada, ensambla los programas del manifiesto con nHilos trabajos a la vez
+// Cada línea del manifiesto es "entrada salida"; las líneas vacías y las que empiezan por ';' se ignoran.
+// El manifiesto se lee a la vez que se ensambla, así que puede ser la entrada estándar de otro proceso.
+// Los errores de cada programa se muestran precedidos de su fichero de entrada. Devuelve el número de programas con error
+
+size_t ensamblarLote (istream &manifiesto, const configuracion_isa &isa, const modo_salida &modo, int nHilos, bool streaming,
+                      estadisticas_ensamblado &total)
+{
+    deque<trabajo_lote> pendientes;                                             // Trabajos leídos y aún no empezados
+    bool finManifiesto = false;                                                 // Ya no llegarán más trabajos
+    size_t fallidos = 0;                                                        // Programas con error
+    mutex cerrojo;                                                              // Protege la cola, los totales y la salida
+    condition_variable aviso;
+
+    auto trabajador = [&] ()
+    {
+        for (;;)
+        {
+            trabajo_lote trabajo;
+            {
+                unique_lock<mutex> lock (cerrojo);
+                aviso.wait (lock, [&] { return !pendientes.empty() || finManifiesto; });
+                if (pendientes.empty())
+                    return;
+                trabajo = move (pendientes.front());
+                pendientes.pop_front();
+            }
+
+            contexto_ensamblado ctx (isa);                                      // Cada programa tiene sus propias etiquetas
+            string error;
+
+            try
+            {
+                ensamblarTrabajo (trabajo, modo, streaming, ctx);
+            }
+            catch (const exception &e)
+            {
+                error = e.what();
+            }
+
+            lock_guard<mutex> lock (cerrojo);
+            total.anyadir (ctx.estadisticas);
+            if (!error.empty())
+            {
+                fallidos++;
+                cout << trabajo.entrada << ": " << error << endl;
+            }
+        }
+    };
+
+    vector<thread> hilos;
+    for (int h = 0; h < nHilos; h++)
+        hilos.emplace_back (trabajador);
+
+    string linea;
+    while (getline (manifiesto, linea))
+    {
+        istringstream tokens (linea);
+        trabajo_lote trabajo;
+
+        if (!(tokens >> trabajo.entrada) || trabajo.entrada[0] == ';')         // Línea vacía o comentario
+            continue;
+
+        if (!(tokens >> trabajo.salida))
+        {
+            lock_guard<mutex> lock (cerrojo);
+            fallidos++;
+            cout << trabajo.entrada << ": No se ha indicado el fichero de salida" << endl;
+            continue;
+        }
+
+        {
+            lock_guard<mutex> lock (cerrojo);
+            pendientes.push_back (move (trabajo));
+        }
+        aviso.notify_one();
+    }
+
+    {
+        lock_guard<mutex> lock (cerrojo);
+        finManifiesto = true;
+    }
+    aviso.notify_all();
+
+    for (thread &hilo : hilos)
+        hilo.join();
+
+    return fallidos;
+}
+
+
+
+// Modo diagnóstico: revisa el programa sin detenerse en el primer error y muestra todos los errores y avisos
+// como "fichero:linea:columna: error|aviso: mensaje", seguidos del total. Devuelve 0 si no hay errores
+
+int diagnosticarFicheros (const char *rutaConfig, const char *rutaPrograma)
+{
+    fichero_mapeado f_config (rutaConfig);
+    fichero_mapeado f_entrada (rutaPrograma);
+
+    if (!f_config.is_open())
+    {
+        cerr << "No se ha encontrado el archivo " << rutaConfig << endl;
+        return 1;
+    }
+    if (!f_entrada.is_open())
+    {
+        cerr << "No se ha encontrado el archivo " << rutaPrograma << endl;
+        return 1;
+    }
+
+    try
+    {
+        configuracion_isa isa (f_config.contenido());
+        vector<diagnostico> diagnosticos = diagnosticarPrograma (isa, f_entrada.contenido());
+
+        size_t nErrores = 0;
+        for (const diagnostico &d : diagnosticos)
+        {
+            cout << rutaPrograma << ":" << d.linea << ":" << d.columna << ": " << (d.esError ? "error" : "aviso") << ": " << d.mensaje << "\n";
+            nErrores += d.esError;
+        }
+
+        if (!diagnosticos.empty())
+            cout << nErrores << " errores, " << diagnosticos.size() - nErrores << " avisos" << endl;
+
+        return nErrores == 0 ? 0 : 1;
+    }
+    catch (const exception& e)                                                  // Errores de la configuración
+    {
+        cout << e.what() << endl;
+        return 1;
+    }
+}
+
+// Modo desensamblado: lee las palabras de la imagen en el formato dado y escribe el programa que las genera
+
+int desensamblarImagen (const char *rutaConfig, const char *rutaImagen, const char *rutaSalida, formato_salida formato, bool littleEndian)
+{
+    fichero_mapeado f_config (rutaConfig);
+    fichero_mapeado f_imagen (rutaImagen);
+
+    if (!f_config.is_open())
+    {
+        cerr << "No se ha encontrado el archivo " << rutaConfig << endl;
+        return 1;
+    }
+    if (!f_imagen.is_open())
+    {
+        cerr << "No se ha encontrado el archivo " << rutaImagen << endl;
+        return 1;
+    }
+
+    try
+    {
+        configuracion_isa isa (f_config.contenido());
+        modo_salida modo (isa, formato, littleEndian);
+        vector<uint8_t> nBits;
+        vector<palabra128> palabras = leerImagen (modo, f_imagen.contenido(), nBits);
+        string programa = desensamblarPrograma (isa, palabras, nBits, modo.formato == SALIDA_TEXTO && !modo.hexOut);
+
+        ofstream f_salida (rutaSalida, ios::out | ios::binary);
+        if (!f_salida.is_open())
+        {
+            cerr << "No se ha podido escribir el fichero " << rutaSalida << endl;
+            return 1;
+        }
+        f_salida.write (programa.data(), programa.size());
+    }
+    catch (const exception& e)
+    {
+        cout << e.what() << endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+// Modo generación: escribe la cabecera del juego de instrucciones fijo de la configuración, para -DCUMPILADOR_ISA
+
+int generarIsa (const char *rutaConfig, const char *rutaCabecera)
+{
+    fichero_mapeado f_config (rutaConfig);
+
+    if (!f_config.is_open())
+    {
+        cerr << "No se ha encontrado el archivo " << rutaConfig << endl;
+        return 1;
+    }
+
+    try
+    {
+        configuracion_isa isa (f_config.contenido());
+        string cabecera = generarCabeceraIsa (isa, f_config.contenido());
+
+        ofstream f_salida (rutaCabecera, ios::out | ios::binary);
+        if (!f_salida.is_open())
+        {
+            cerr << "No se ha podido escribir el fichero " << rutaCabecera << endl;
+            return 1;
+        }
+        f_salida.write (cabecera.data(), cabecera.size());
+    }
+    catch (const exception& e)
+    {
+        cout << e.what() << endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+// Modo objeto: ensambla un módulo a un objeto reubicable, que se enlaza después con --enlazar
+
+int ensamblarModulo (const char *rutaConfig, const char *rutaPrograma, const char *rutaObjeto, bool littleEndian)
+{
+    fichero_mapeado f_config (rutaConfig);
+    fichero_mapeado f_entrada (rutaPrograma);
+
+    if (!f_config.is_open())
+    {
+        cerr << "No se ha encontrado el archivo " << rutaConfig << endl;
+        return 1;
+    }
+    if (!f_entrada.is_open())
+    {
+        cerr << "No se ha encontrado el archivo " << rutaPrograma << endl;
+        return 1;
+    }
+
+    try
+    {
+        configuracion_isa isa (f_config.contenido());
+        objeto_ensamblado objeto = ensamblarObjeto (isa, f_entrada.contenido(), littleEndian);
+
+        ofstream f_objeto (rutaObjeto, ios::out | ios::binary | ios::trunc);
+        if (!f_objeto.is_open())
+            throw exception_file ("escribir", rutaObjeto);
+
+        escribirObjeto (f_objeto, objeto);
+
+        if (!f_objeto)
+            throw exception_file ("escribir", rutaObjeto);
+    }
+    catch (const exception& e)
+    {
+        cout << e.what() << endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+// Modo enlazado: enlaza los objetos en orden y escribe el programa en el formato de salida
+
+int enlazarModulos (const char *rutaConfig, const char *rutaSalida, const vector<char *> &rutasObjetos, formato_salida formato,
+                    bool littleEndian, bool compactar)
+{
+    fichero_mapeado f_config (rutaConfig);
+
+    if (!f_config.is_open())
+    {
+        cerr << "No se ha encontrado el archivo " << rutaConfig << endl;
+        return 1;
+    }
+
+    try
+    {
+        configuracion_isa isa (f_config.contenido());
+        vector<objeto_ensamblado> objetos;
+
+        for (const char *ruta : rutasObjetos)
+        {
+            fichero_mapeado f_objeto (ruta);
+            if (!f_objeto.is_open())
+            {
+                cerr << "No se ha encontrado el archivo " << ruta << endl;
+                return 1;
+            }
+            objetos.push_back (leerObjeto (f_objeto.contenido(), ruta));
+        }
+
+        programa_ensamblado programa = enlazarObjetos (isa, objetos);
+        modo_salida modo (isa, formato, littleEndian, compactar);
+
+        ofstream f_salida (rutaSalida, formato == SALIDA_BINARIA ? ios::out | ios::binary : ios::out);
+        if (!f_salida.is_open())
+            throw exception_file ("escribir", rutaSalida);
+
+        escribirPrograma (f_salida, modo, programa);
+
+        if (!f_salida)
+            throw exception_file ("escribir", rutaSalida);
+    }
+    catch (const exception& e)
+    {
+        cout << e.what() << endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+// Modo simulación: ensambla el programa en memoria con la configuración y lo ejecuta en el simulador funcional
+// Muestra los pasos, el rendimiento, el motivo de parada, los registros y la memoria distintos de 0 y,
+// con conPerfil, las ejecuciones de cada mnemónico y las instrucciones más ejecutadas
+
+int simularPrograma (const char *rutaConfig, const char *rutaPrograma, const char *rutaDatos, int nHilos, uint64_t maxPasos,
+                     size_t palabrasMemoria, bool conPerfil)
+{
+    fichero_mapeado f_config (rutaConfig);
+    fichero_mapeado f_entrada (rutaPrograma);
+    ifstream f_datos;
+    if (rutaDatos != nullptr)
+        f_datos.open (rutaDatos);
+
+    if (!f_config.is_open())
+    {
+        cerr << "No se ha encontrado el archivo " << rutaConfig << endl;
+        return 1;
+    }
+    if (!f_entrada.is_open())
+    {
+        cerr << "No se ha encontrado el archivo " << rutaPrograma << endl;
+        return 1;
+    }
+    if (rutaDatos != nullptr && !f_datos.is_open())
+    {
+        cerr << "No se ha encontrado el archivo " << rutaDatos << endl;
+        return 1;
+    }
+
+    try
+    {
+        configuracion_isa isa (f_config.contenido());
+        programa_ensamblado programa = ensamblarPrograma (isa, f_entrada.contenido(), nHilos);
+
+        auto inicio = chrono::steady_clock::now();
+        simulador sim (isa, programa, palabrasMemoria);
+        double msPredecodificacion = milisegundosDesde (inicio);
+
+        if (rutaDatos != nullptr)                                                // Contenido inicial de la memoria, como en $readmemh
+        {
+            string token;
+            size_t direccion = 0;
+            while (f_datos >> token)
+            {
+                if (token.compare (0, 2, "//") == 0 || token[0] == ';')            // Comentario hasta el final de la línea
+                {
+                    getline (f_datos, token);
+                    continue;
+                }
+
+                bool esDireccion = token[0] == '@';
+                uint64_t valor;
+                auto [fin, error] = from_chars (token.data() + esDireccion, token.data() + token.size(), valor, 16);
+                if (error != errc() || fin != token.data() + token.size())
+                    throw exception_wrong_number (token, 0);
+
+                if (esDireccion)
+                    direccion = valor;
+                else
+                    sim.memoria[direccion++ & (sim.memoria.size() - 1)] = (uint32_t) valor;
+            }
+        }
+
+        inicio = chrono::steady_clock::now();
+        motivo_parada motivo = sim.ejecutar (maxPasos, conPerfil);
+        double msEjecucion = milisegundosDesde (inicio);
+
+        cout << "Simulacion: " << sim.size() << " instrucciones predecodificadas en " << fixed << setprecision(2) << msPredecodificacion
+             << " ms, " << sim.pasos << " pasos en " << msEjecucion << " ms (" << setprecision(1)
+             << sim.pasos / (max (msEjecucion, 1e-6) * 1000) << " MIPS)" << endl;
+
+        auto lineaPC = [&] (size_t pc) { return pc < sim.size() ? programa.lineas[pc] : 0; };
+        auto direccionPC = [&] (size_t pc) { return pc < programa.direcciones.size() ? (size_t) programa.direcciones[pc] : pc; };  // Con directivas
+        switch (motivo)
+        {
+            case PARADA_FIN:         cout << "Parada: fin del programa" << endl; break;
+            case PARADA_BUCLE:       cout << "Parada: bucle de fin en la linea " << lineaPC (sim.pc) << " (PC " << direccionPC (sim.pc) << ")" << endl; break;
+            case PARADA_LIMITE:      cout << "Parada: limite de pasos alcanzado en el PC " << direccionPC (sim.pc) << endl; break;
+            case PARADA_PC_INVALIDO: cout << "Parada: salto fuera del programa" << endl; break;
+            case PARADA_DESCONOCIDA:
+                cout << "Parada: la instruccion de la linea " << lineaPC (sim.pc) << " (PC " << direccionPC (sim.pc) << ") ";
+                if (sim.plan (sim.pc) < 0) cout << "no coincide con ninguna de la configuracion" << endl;
+                else cout << "\"" << isa.planes[sim.plan (sim.pc)].nombre << "\" no tiene semantica en el simulador" << endl;
+                break;
+        }
+
+        cout << endl << "Registros:" << endl;
+        for (size_t r = 0; r < sim.registros.size(); r++)
+            if (sim.registros[r] != 0)
+                cout << "    r" << left << setw(6) << r << right << setw(12) << (int32_t) sim.registros[r]
+                     << "  0x" << hex << setw(8) << setfill('0') << sim.registros[r] << dec << setfill(' ') << endl;
+        for (size_t r = 0; r < sim.registrosFP.size(); r++)
+            if (sim.registrosFP[r] != 0)
+                cout << "    f" << left << setw(6) << r << right << setw(12) << defaultfloat << setprecision(9) << sim.registrosFP[r]
+                     << fixed << setprecision(1) << endl;
+
+        const size_t MAX_MEMORIA_MOSTRADA = 32;                                  // Palabras de memoria distintas de 0 que se muestran
+        size_t mostradas = 0;
+        cout << endl << "Memoria:" << endl;
+        for (size_t d = 0; d < sim.memoria.size() && mostradas < MAX_MEMORIA_MOSTRADA; d++)
+            if (sim.memoria[d] != 0)
+            {
+                cout << "    [0x" << hex << setw(4) << setfill('0') << d << "]  0x" << setw(8) << sim.memoria[d] << dec << setfill(' ') << endl;
+                mostradas++;
+            }
+
+        if (conPerfil)
+        {
+            map<string, uint64_t> porMnemonico;                                  // Ejecuciones de cada mnemónico
+            for (size_t i = 0; i < sim.size(); i++)
+                if (sim.perfil[i] != 0)
+                    porMnemonico[sim.plan (i) < 0 ? "?" : isa.planes[sim.plan (i)].nombre] += sim.perfil[i];
+
+            vector<pair<uint64_t, string>> ordenados;
+            for (const auto &[nombre, veces] : porMnemonico)
+                ordenados.push_back ({veces, nombre});
+            sort (ordenados.rbegin(), ordenados.rend());
+
+            double total = max (sim.pasos, (uint64_t) 1);
+            cout << endl << "Perfil por instruccion:" << endl;
+            for (const auto &[veces, nombre] : ordenados)
+                cout << "    " << left << setw(12) << nombre << right << setw(16) << veces << setw(8) << setprecision(1) << 100 * veces / total << " %" << endl;
+
+            vector<size_t> inicioLinea = {0, 0};                                 // Inicio de cada línea del programa, desde la 1
+            string_view texto = f_entrada.contenido();
+            for (size_t c = 0; c < texto.size(); c++)
+                if (texto[c] == '\n')
+                    inicioLinea.push_back (c + 1);
+
+            vector<size_t> pcs;
+            for (size_t i = 0; i < sim.size(); i++)
+                if (sim.perfil[i] != 0)
+                    pcs.push_back (i);
+            const size_t MAX_INSTRUCCIONES_PERFIL = 10;                          // Instrucciones más ejecutadas que se muestran
+            size_t nMostradas = min (pcs.size(), MAX_INSTRUCCIONES_PERFIL);
+            partial_sort (pcs.begin(), pcs.begin() + nMostradas, pcs.end(), [&] (size_t a, size_t b) { return sim.perfil[a] > sim.perfil[b]; });
+
+            cout << endl << "Instrucciones mas ejecutadas:" << endl;
+            for (size_t k = 0; k < nMostradas; k++)
+            {
+                size_t i = pcs[k];
+                int linea = programa.lineas[i];
+                string_view codigoLinea;
+                if (linea > 0 && (size_t) linea < inicioLinea.size())
+                {
+                    codigoLinea = texto.substr (inicioLinea[linea]);
+                    codigoLinea = codigoLinea.substr (0, codigoLinea.find_first_of (";\r\n"));
+                    codigoLinea = codigoLinea.substr (0, codigoLinea.find_last_not_of (" \t") + 1);
+                }
+
+                cout << "    linea " << left << setw(8) << linea << "PC " << setw(8) << direccionPC (i) << right << setw(16) << sim.perfil[i]
+                     << setw(8) << 100 * sim.perfil[i] / total << " %    " << codigoLinea << endl;
+            }
+        }
+    }
+    catch (const exception& e)
+    {
+        cout << e.what() << endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+// Fichero de salida de --objetivo
+struct objetivo_salida
+{
+    string tipo;                                     // hex, bin, logisim[-hex|-bin], vhdl[-hex|-bin], binario, ihex o readmemh
+    string ruta;                                     // Fichero de salida
+};
+
+// Modo de salida de un objetivo: el tipo sustituye a la cabecera BIN/HEX y LOGISIM_OUT/VHDL_OUT de la configuración
+// Devuelve false si el tipo no existe
+
+bool modoObjetivo (const string &tipo, const configuracion_isa &isa, bool littleEndian, bool compactar, modo_salida &modo)
+{
+    static const map<string, formato_salida> imagenes = {{"binario", SALIDA_BINARIA}, {"ihex", SALIDA_INTEL_HEX}, {"readmemh", SALIDA_READMEMH}};
+
+    auto imagen = imagenes.find (tipo);
+    modo = modo_salida (isa, imagen != imagenes.end() ? imagen->second : SALIDA_TEXTO, littleEndian, compactar);
+    if (imagen != imagenes.end())
+        return true;
+
+    string sintaxis = tipo.substr (0, tipo.find ('-'));                        // logisim-hex: sintaxis logisim, dígitos hex
+    string digitos = tipo.find ('-') == string::npos ? "" : tipo.substr (tipo.find ('-') + 1);
+
+    if (sintaxis == "hex" || sintaxis == "bin")
+    {
+        if (!digitos.empty())
+            return false;
+        digitos = sintaxis;
+        modo.logisimOut = modo.vhdlOut = false;
+    }
+    else if (sintaxis == "logisim" || sintaxis == "vhdl")
+    {
+        modo.logisimOut = sintaxis == "logisim";
+        modo.vhdlOut = sintaxis == "vhdl";
+    }
+    else
+        return false;
+
+    if (digitos == "hex" || digitos == "bin")
+        modo.hexOut = digitos == "hex";
+    else if (!digitos.empty())
+        return false;
+
+    return true;
+}
+
+// Modo de varios objetivos: ensambla el programa una sola vez en memoria y escribe cada objetivo en su fichero
+// a la vez, un hilo por objetivo, a partir de las mismas palabras codificadas. Con conTiempos muestra lo que ha tardado
+
+int ensamblarObjetivos (const char *rutaConfig, const char *rutaPrograma, const vector<objetivo_salida> &objetivos, int nHilos,
+                        bool littleEndian, bool compactar, bool conTiempos, const char *rutaIsa)
+{
+    fichero_mapeado f_config (rutaConfig);
+    fichero_mapeado f_entrada (rutaPrograma);
+
+    if (!f_config.is_open())
+    {
+        cerr << "No se ha encontrado el archivo " << rutaConfig << endl;
+        return 1;
+    }
+    if (!f_entrada.is_open())
+    {
+        cerr << "No se ha encontrado el archivo " << rutaPrograma << endl;
+        return 1;
+    }
+
+    try
+    {
+        configuracion_isa isa;
+        cargarConfiguracionCacheada (f_config.contenido(), rutaIsa, isa);
+
+        vector<modo_salida> modos (objetivos.size());
+        for (size_t k = 0; k < objetivos.size(); k++)
+        {
+            if (!modoObjetivo (objetivos[k].tipo, isa, littleEndian, compactar, modos[k]))
+            {
+                cerr << "Objetivo de salida desconocido: " << objetivos[k].tipo
+                     << " (hex, bin, logisim, logisim-hex, logisim-bin, vhdl, vhdl-hex, vhdl-bin, binario, ihex o readmemh)" << endl;
+                return 1;
+            }
+        }
+
+        auto inicio = chrono::steady_clock::now();
+        programa_ensamblado programa = ensamblarPrograma (isa, f_entrada.contenido(), nHilos);
+        double msEnsamblado = milisegundosDesde (inicio);
+
+        inicio = chrono::steady_clock::now();
+        vector<exception_ptr> errores (objetivos.size());
+        vector<thread> hilos;
+
+        for (size_t k = 0; k < objetivos.size(); k++)
+        {
+            hilos.emplace_back ([&, k] ()
+            {
+                try
+                {
+                    ofstream f_salida (objetivos[k].ruta, modos[k].formato == SALIDA_BINARIA ? ios::out | ios::binary : ios::out);
+                    if (!f_salida.is_open())
+                        throw exception_file ("escribir", objetivos[k].ruta);
+
+                    escribirPrograma (f_salida, modos[k], programa);
+
+                    if (!f_salida)
+                        throw exception_file ("escribir", objetivos[k].ruta);
+                }
+                catch (...)
+                {
+                    errores[k] = current_exception();
+                }
+            });
+        }
+
+        for (thread &hilo : hilos)
+            hilo.join();
+
+        for (exception_ptr &error : errores)
+            if (error)
+                rethrow_exception (error);
+
+        if (conTiempos)
+            cerr << programa.palabras.size() << " instrucciones ensambladas en " << fixed << setprecision(2) << msEnsamblado << " ms, "
+                 << objetivos.size() << " objetivos escritos a la vez en " << milisegundosDesde (inicio) << " ms" << endl;
+    }
+    catch (const exception& e)
+    {
+        cout << e.what() << endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+
+
+
+
+int main(int argc, char * argv[])
+{
+    ofstream f_salida;
+    formato_salida formato = SALIDA_TEXTO;    // Formato del fichero de salida
+    bool littleEndian = true;                 // Orden de los bytes de cada palabra en la salida binaria e Intel HEX
+    int nHilos = 1;                           // Hilos con los que se ensambla
+    bool streaming = false;                   // Ensambla en una sola pasada con memoria acotada
+    bool compactar = false;                   // Junta las palabras repetidas en la salida de LOGISIM_OUT y VHDL_OUT
+    bool benchmark = false;                   // Mide el rendimiento con una entrada sintética
+    bool diferencial = false;                 // Compara los motores con el ensamblador de referencia en casos aleatorios
+    int estadisticas = 0;                     // Muestra estadísticas: 0 no, 1 en texto, 2 en JSON
+    const char *rutaCache = nullptr;          // Caché del ensamblado incremental
+    const char *rutaLote = nullptr;           // Manifiesto del modo lote, "-" para la entrada estándar
+    const char *rutaIsa = nullptr;            // Caché del juego de instrucciones compilado
+    bool desensamblar = false;                // Convierte una imagen en el programa que la genera
+    bool generar = false;                     // Genera la cabecera del juego de instrucciones fijo
+    bool objeto = false;                      // Ensambla un módulo a un objeto reubicable
+    bool enlazar = false;                     // Enlaza objetos reubicables en un programa
+    bool diagnostico = false;                 // Muestra todos los errores y avisos del programa antes de ensamblar
+    bool simular = false;                     // Ejecuta el programa en el simulador funcional
+    bool perfil = false;                      // Muestra el perfil de ejecución de la simulación
+    uint64_t maxPasos = 0;                    // Máximo de pasos de la simulación, 0 sin límite
+    size_t palabrasMemoria = 1 << 16;         // Palabras de memoria de datos del simulador
+    const char *rutaDatos = nullptr;          // Contenido inicial de la memoria del simulador
+    vector<objetivo_salida> objetivos;        // Ficheros de salida de --objetivo, cada uno con su tipo
+    vector<char *> ficheros;                  // Parámetros que no son opciones
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (string(argv[i]) == "-j" && i + 1 < argc)                       // Número de hilos, 0 para usar todos los núcleos
+        {
+            nHilos = atoi(argv[++i]);
+            if (nHilos <= 0)
+                nHilos = max(1u, thread::hardware_concurrency());
+        }
+        else if (string(argv[i]) == "--streaming")
+            streaming = true;
+        else if (string(argv[i]) == "--compactar")
+            compactar = true;
+        else if (string(argv[i]) == "--benchmark")
+            benchmark = true;
+        else if (string(argv[i]) == "--diferencial")
+            diferencial = true;
+        else if (string(argv[i]) == "--diagnostico")
+            diagnostico = true;
+        else if (string(argv[i]) == "--desensamblar")
+            desensamblar = true;
+        else if (string(argv[i]) == "--generar-isa")
+            generar = true;
+        else if (string(argv[i]) == "--objeto")
+            objeto = true;
+        else if (string(argv[i]) == "--enlazar")
+            enlazar = true;
+        else if (string(argv[i]) == "--simular")
+            simular = true;
+        else if (string(argv[i]) == "--perfil")
+            perfil = true;
+        else if (string(argv[i]) == "--pasos" && i + 1 < argc)             // Máximo de instrucciones a simular
+            maxPasos = strtoull(argv[++i], nullptr, 10);
+        else if (string(argv[i]) == "--memoria" && i + 1 < argc)           // Palabras de la memoria de datos simulada
+            palabrasMemoria = max (1ull, strtoull(argv[++i], nullptr, 10));
+        else if (string(argv[i]) == "--datos" && i + 1 < argc)             // Memoria inicial del simulador
+            rutaDatos = argv[++i];
+        else if (string(argv[i]) == "--objetivo" && i + 1 < argc)          // Salida adicional, tipo=fichero
+        {
+            string objetivo = argv[++i];
+            size_t igual = objetivo.find ('=');
+            if (igual == string::npos || igual == 0 || igual + 1 == objetivo.size())
+            {
+                cerr << "Objetivo incorrecto: " << objetivo << " (se esperaba tipo=fichero)" << endl;
+                return 1;
+            }
+            objetivos.push_back ({objetivo.substr (0, igual), objetivo.substr (igual + 1)});
+        }
+        else if (string(argv[i]) == "--incremental" && i + 1 < argc)       // Fichero de caché del ensamblado incremental
+            rutaCache = argv[++i];
+        else if (string(argv[i]) == "--lote" && i + 1 < argc)              // Manifiesto con los programas a ensamblar
+            rutaLote = argv[++i];
+        else if (string(argv[i]) == "--cache-isa" && i + 1 < argc)         // Imagen del juego de instrucciones compilado
+            rutaIsa = argv[++i];
+        else if (string(argv[i]) == "--stats" || string(argv[i]) == "--stats=texto")
+            estadisticas = 1;
+        else if (string(argv[i]) == "--stats=json")
+            estadisticas = 2;
+        else if (string(argv[i]) == "--formato" && i + 1 < argc)           // Formato del fichero de salida
+        {
+            string nombre = argv[++i];
+            if (nombre == "texto") formato = SALIDA_TEXTO;
+            else if (nombre == "binario") formato = SALIDA_BINARIA;
+            else if (nombre == "ihex") formato = SALIDA_INTEL_HEX;
+            else if (nombre == "readmemh") formato = SALIDA_READMEMH;
+            else
+            {
+                cerr << "Formato de salida desconocido: " << nombre << " (texto, binario, ihex o readmemh)" << endl;
+                return 1;
+            }
+        }
+        else if (string(argv[i]) == "--endian" && i + 1 < argc)            // Orden de los bytes de cada palabra
+        {
+            string orden = argv[++i];
+            if (orden == "little") littleEndian = true;
+            else if (orden == "big") littleEndian = false;
+            else
+            {
+                cerr << "Orden de bytes desconocido: " << orden << " (little o big)" << endl;
+                return 1;
+            }
+        }
+        else
+            ficheros.push_back(argv[i]);
+    }
+
+    if (benchmark)                            // Los parámetros son los del benchmark
+        return ejecutarBenchmark (ficheros, nHilos, formato, littleEndian);
+
+    if (diferencial)                          // Los parámetros son los de los casos aleatorios
+        return ejecutarDiferencial (ficheros, nHilos);
+
+    if (desensamblar && ficheros.size() == 3) // La imagen se lee en el formato de --formato y --endian
+        return desensamblarImagen (ficheros[0], ficheros[1], ficheros[2], formato, littleEndian);
+
+    if (generar && ficheros.size() == 2)      // Se dan la configuración y la cabecera
+        return generarIsa (ficheros[0], ficheros[1]);
+
+    if (objeto && ficheros.size() == 3)       // Se dan la configuración, el módulo y el objeto
+        return ensamblarModulo (ficheros[0], ficheros[1], ficheros[2], littleEndian);
+
+    if (enlazar && ficheros.size() >= 3)      // Se dan la configuración, la salida y los objetos
+        return enlazarModulos (ficheros[0], ficheros[1], vector<char *> (ficheros.begin() + 2, ficheros.end()), formato, littleEndian, compactar);
+
+    if (simular && ficheros.size() == 2)      // Solo se dan la configuración y el programa
+        return simularPrograma (ficheros[0], ficheros[1], rutaDatos, nHilos, maxPasos, palabrasMemoria, perfil);
+
+    if (diagnostico && (ficheros.size() == 2 || ficheros.size() == 3))  // Con errores no se crea la salida
+    {
+        int resultado = diagnosticarFicheros (ficheros[0], ficheros[1]);
+        if (resultado != 0 || (ficheros.size() == 2 && objetivos.empty()))
+            return resultado;
+    }
+
+    if (!objetivos.empty() && ficheros.size() == 2)   // Las salidas van en los objetivos
+        return ensamblarObjetivos (ficheros[0], ficheros[1], objetivos, nHilos, littleEndian, compactar, estadisticas != 0, rutaIsa);
+
+    if (rutaLote != nullptr && ficheros.size() == 1)  // Solo se da la configuración, los programas van en el manifiesto
+    {
+        ifstream f_manifiesto;
+        bool entradaEstandar = string(rutaLote) == "-";
+        if (!entradaEstandar)
+            f_manifiesto.open(rutaLote);
+        fichero_mapeado f_config (ficheros[0]);
+
+        if (!f_config.is_open())
+        {
+            cerr << "No se ha encontrado el archivo " << ficheros[0] << endl;
+            return 1;
+        }
+        if (!entradaEstandar && !f_manifiesto.is_open())
+        {
+            cerr << "No se ha encontrado el archivo " << rutaLote << endl;
+            return 1;
+        }
+
+        estadisticas_ensamblado total;
+        size_t fallidos = 0;
+
+        try
+        {
+            auto inicio = chrono::steady_clock::now();
+            configuracion_isa isa;                                              // La configuración se carga una sola vez
+            cargarConfiguracionCacheada (f_config.contenido(), rutaIsa, isa);
+            total.msConfig = milisegundosDesde (inicio);
+
+            fallidos = ensamblarLote (entradaEstandar ? cin : f_manifiesto, isa, modo_salida (isa, formato, littleEndian, compactar), nHilos, streaming, total);
+        }
+        catch (const exception& e)
+        {
+            cout << e.what() << endl;
+            return 1;
+        }
+
+        if (estadisticas)                                                       // Totales de todos los programas
+            mostrarEstadisticas (cerr, total, estadisticas == 2);
+
+        return fallidos == 0 ? 0 : 1;
+    }
+
+    if (ficheros.size() == 3)                 // Se han introducido los ficheros
+    {
+        fichero_mapeado f_entrada (ficheros[1]);  // Fichero de entrada, proyectado en memoria
+        if (rutaCache == nullptr)                 // Con --incremental la salida se abre al final, para poder corregirla
+            f_salida.open(ficheros[2], formato == SALIDA_BINARIA ? ios::out | ios::binary : ios::out);  // Fichero de salida
+        fichero_mapeado f_config (ficheros[0]);   // Fichero de configuración
+
+        if (f_entrada.is_open() && (rutaCache != nullptr || f_salida.is_open()) && f_config.is_open())  // El fichero existía
+        {
+            configuracion_isa isa;                                              // Juego de instrucciones de la configuración
+            contexto_ensamblado ctx (isa);                                      // Etiquetas y estadísticas del programa
+
+            ctx.estadisticas.bytesLeidos = f_config.contenido().size() + f_entrada.contenido().size();
+
+            try
+            {
+                auto inicio = chrono::steady_clock::now();
+                cargarConfiguracionCacheada (f_config.contenido(), rutaIsa, isa);
+                ctx.estadisticas.msConfig = milisegundosDesde (inicio);
+
+                modo_salida modo (isa, formato, littleEndian, compactar);              // Formato de la salida
+
+                if (rutaCache != nullptr)                                              // Reensambla solo lo que ha cambiado
+                {
+                    uint64_t clave = hashTexto (f_config.contenido());                 // La caché solo vale para esta configuración y formato
+                    clave = hashTexto (std::to_string(formato) + (littleEndian ? "l" : "b") + (modo.compacta() ? "c" : ""), clave);
+
+                    conTipoPalabra (isa, [&] (auto palabra)
+                    {
+                        ensamblarIncremental<decltype(palabra)> (f_entrada.contenido(), nHilos, modo, ficheros[2], rutaCache, clave, ctx);
+                    });
+                }
+                else
+                {
+                    escritor_salida escritor (f_salida, modo);                         // Escritor de la salida, con su propio buffer
+
+                    conTipoPalabra (isa, [&] (auto palabra)
+                    {
+                        ensamblar<decltype(palabra)> (f_entrada.contenido(), nHilos, streaming, escritor, ctx);
+                    });
+
+                    inicio = chrono::steady_clock::now();
+                    escritor.terminar();
+                    ctx.estadisticas.msSalida += milisegundosDesde (inicio);
+                    ctx.estadisticas.bytesEscritos = escritor.posicion();
+                }
+            }
+            catch (const exception& e)
+            {
+                cout << e.what() << endl;
+            }
+
+            ctx.estadisticas.etiquetas = ctx.etiquetas.size();
+            if (estadisticas)                                                   // Las estadísticas van a la salida de errores
+                mostrarEstadisticas (cerr, ctx.estadisticas, estadisticas == 2);
+        }
+        else if (!f_config.is_open())           // Fichero de configuración incorrecto 
+            cerr << "No se ha encontrado el archivo " << ficheros[0] << endl;
+
+        else if (!f_entrada.is_open())           // Fichero a ensamblar incorrecto 
+            cerr << "No se ha encontrado el archivo " << ficheros[1] << endl;
+        
+        else if (!f_salida.is_open())           // No se ha podido crear o escribir el en fichero 
+            cerr << "No se ha podido escribir el fichero " << ficheros[2] << endl;
+            
+    }
+    else                // Parámetros incorrectos
+    {
+        cerr << "Invocar como: ./cumpilador.exe [-j hilos] [--streaming] [--formato texto|binario|ihex|readmemh] [--endian little|big] [--compactar] [--stats[=json]] [--incremental cache] [--cache-isa imagen] [--diagnostico] fichero_config fichero_entrada fichero_salida" << endl;
+        cerr << "            ./cumpilador.exe --diagnostico fichero_config fichero_entrada" << endl;
+        cerr << "            ./cumpilador.exe --objetivo tipo=fichero [--objetivo tipo=fichero ...] [-j hilos] [--endian e] [--compactar] [--stats] [--cache-isa imagen] [--diagnostico] fichero_config fichero_entrada" << endl;
+        cerr << "            ./cumpilador.exe --lote manifiesto|- [-j hilos] [--streaming] [--formato f] [--endian e] [--compactar] [--stats[=json]] [--cache-isa imagen] fichero_config" << endl;
+        cerr << "            ./cumpilador.exe --desensamblar [--formato f] [--endian e] fichero_config fichero_imagen fichero_programa" << endl;
+        cerr << "            ./cumpilador.exe --objeto [--endian e] fichero_config fichero_entrada fichero_objeto" << endl;
+        cerr << "            ./cumpilador.exe --enlazar [--formato f] [--endian e] [--compactar] fichero_config fichero_salida fichero_objeto ..." << endl;
+        cerr << "            ./cumpilador.exe --generar-isa fichero_config fichero_cabecera" << endl;
+        cerr << "            ./cumpilador.exe --simular [--pasos n] [--memoria palabras] [--datos fichero] [--perfil] fichero_config fichero_entrada" << endl;
+        cerr << "            ./cumpilador.exe --benchmark [-j hilos] [--formato f] [clave=valor ...]" << endl;
+        cerr << "            ./cumpilador.exe --diferencial [-j hilos] [clave=valor ...]" << endl;
+    }
+}
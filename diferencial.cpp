@@ -0,0 +1,985 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ * diferencial: modo --diferencial de cumpilador, que compara los motores de libcumpilador con el ensamblador original
+ * El ensamblador de referencia es una copia del algoritmo original y solo lo usa este modo, así que no forma
+ * parte de la biblioteca
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include "diferencial.h"
+#include "libcumpilador.h"
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <bitset>
+#include <map>
+#include <vector>
+#include <sstream>
+#include <algorithm>
+#include <random>
+
+using namespace std;
+using namespace cumpilador;
+
+
+
+// Ensamblador de referencia
+// Es el algoritmo original de cumpilador, con las mismas operaciones sobre strings y bitset, sin estado global
+
+// Programa ensamblado con el ensamblador de referencia
+struct programa_referencia
+{
+    vector<string> palabras;                         // Codificación de cada instrucción como string de bits, con los de su configuración
+    vector<int> lineas;                              // Línea del código de cada instrucción
+    string salida;                                   // Contenido del fichero de salida de texto
+};
+
+
+namespace referencia
+{
+
+const int TAMANYO_INSTRUCCION = 32;                  // Tamaño de una instrucción en bits
+
+
+// Convierte un string binario a un string hexadecimal
+
+string binSToHex (string binarioString)
+{
+    bitset<TAMANYO_INSTRUCCION> binario {binarioString};
+    stringstream hexadecimal;
+    hexadecimal << hex << uppercase << binario.to_ulong();
+
+    string salida = hexadecimal.str();
+
+    if (salida.size() < TAMANYO_INSTRUCCION / 4)
+        salida = string(TAMANYO_INSTRUCCION / 4 - salida.size(), '0') + salida;
+
+    if (TAMANYO_INSTRUCCION % 4 != 0)
+        salida = "0" + salida;
+
+    return salida;
+}
+
+
+// Convierte un string a decimal
+// El string puede ser un decimal, hexadecimal comenzado con 0x o un caracter entre ''
+
+int to_decimal (string numero)
+{
+    if (numero[0] == '0' && numero[1] == 'x')                               // Hexadecimal
+    {
+        int decimal = 0;
+        stringstream ss;
+        ss << numero;
+        ss >> hex >> decimal;
+        return decimal;
+    }
+    else if  (numero[0] == '\'' && numero[numero.length()-1] == '\'')       // Caracter
+    {
+        return numero[1];
+    }
+    else                                                                    // Decimal
+    {
+        return stoi(numero);
+    }
+}
+
+
+// Tokeniza un string separado por espacios en un vector de strings
+
+void stringToVector (string s, vector<string> &vect)
+{
+    stringstream ss (s);
+    string token;
+    while (getline (ss, token, ' '))
+    {
+        vect.push_back (token);
+    }
+}
+
+
+// Configuración y etiquetas de un ensamblado, que en el original eran globales
+struct estado
+{
+    bool hex_out;                                    // Da la salida en hexadecimal en lugar de en binario
+    bool logisim_out;                                // Imprime la salida en un formato compatible con la rom de logisim
+    bool vhdl_out;                                   // Imprime la salida en un formato compatible con las memorias VHDL
+    bool salto_relativo;                             // Si se habilita, los saltos se calcularán relativos a PC
+    map <string, int> etiquetas;                     // Diccionario de dirección-etiqueta
+    map <string, vector<string>> instrucciones;      // Diccionario de instrucciones
+    map <string, string> constantes_config;          // Lista de constantes en configuración
+};
+
+
+class instruccion
+{
+    private:
+
+        const estado *est;                                     // Configuración y etiquetas del ensamblado
+        string nombre;                                         // Nombre de la instrucción
+        vector<string> tokens;                                 // Vector con los tokens de entrada de la instrucción
+        int i_PC;                                              // Número de PC de la instrucción
+
+    public:
+
+        int i_linea;                                           // Número de línea de la instrucción
+
+        instruccion (const estado &_est, vector<string> _tokens, int _i_linea, int _i_PC) : est (&_est), tokens (_tokens)
+        {
+            if (est->instrucciones.find(_tokens[0]) == est->instrucciones.end())
+            {
+                throw exception_unknown_instruction(_tokens[0], _i_linea);
+            }
+
+            nombre = _tokens[0];
+            i_linea = _i_linea;
+            i_PC = _i_PC;
+
+            int nParametros = 0;
+            for (string elemento : est->instrucciones.at(nombre))             // Cuenta el número de parámetros que no sean relleno
+            {
+                if (elemento[0] != '&')
+                {
+                    nParametros++;
+                }
+            }
+
+            if (tokens.size() != nParametros)                                 // Número de parámetros incorrecto
+            {
+                throw exception_wrong_number_of_parameters (tokens[0], i_linea);
+            }
+        }
+
+        // Ensambla la instrucción y la devuelve en binario, legible por la máquina
+        string to_bin ()
+        {
+            const vector<string> &estructura = est->instrucciones.at(nombre);
+            string salida = estructura[0];
+
+            for (int str = 1, tok = 1; str < estructura.size(); str++)
+            {
+                if (estructura[str][0] == CH_ETIQUETA_CONFIG)                                             // Es una constante
+                {
+                    int direccion;
+                    if (tokens[tok][0] != CH_ETIQUETA_CONFIG)                                                 // Es una etiqueta
+                    {
+                        if (est->etiquetas.find(tokens[tok]) == est->etiquetas.end())                         // La etiqueta no existe
+                        {
+                            throw exception_wrong_label (tokens[tok], i_linea);
+                        }
+
+                        if (est->salto_relativo && estructura[str][1] == CH_ETIQUETA_CONFIG)
+                        {
+                            direccion = est->etiquetas.at(tokens[tok]) - (i_PC + 1);                          // Dirección relativa a la instrucción
+                        }
+                        else
+                        {
+                            direccion = est->etiquetas.at(tokens[tok]);                                       // Obtiene la dirección de la etiqueta
+                        }
+                    }
+                    else direccion = to_decimal(tokens[tok].erase(0, 1));                                     // Obtiene la dirección del número
+
+                    int nBits = count (estructura[str].begin(), estructura[str].end(), CH_VARIABLE_CONFIG);  // Número de bits de la dirección
+                    bitset<TAMANYO_INSTRUCCION> direccionBinario {(long long unsigned int)direccion};         // Convierte el número a binario
+
+                    for (int i = nBits - 1; i >= 0; i--)
+                    {
+                        salida += direccionBinario[i] ? "1" : "0";                                            // Añade los bits correspondientes a la instrucción
+                    }
+
+                    tok++;                                                                                    // Avanza el contador de los tokens
+                }
+
+                else if (estructura[str][0] == CH_CONSTANTE_CONFIG)                                           // Es una constante (relleno)
+                {
+                    salida += estructura[str].substr(1);
+                }
+
+                else                                                                             // Es un parámetro normal
+                {
+                    int inicioNumero = estructura[str].find(CH_VARIABLE_CONFIG);                              // Posición del primer caracter del número
+                    int finNumero = estructura[str].find_last_of(CH_VARIABLE_CONFIG);                         // Posición del último caracter del número
+                    int nBits = finNumero - inicioNumero + 1;                                                 // Número de bits del número
+
+                    string encontrado = tokens[tok].substr(0, inicioNumero);                                  // Parte inicial del token (previa al número)
+                    string resto = tokens[tok].substr(inicioNumero);                                          // Parte final del token (después del número)
+
+                    int inicioCaracFin = resto.find_first_not_of("1234567890");                               // Posición del primer caracter no numérico
+                    string encontradoFinal = "";
+                    if (inicioCaracFin != -1)
+                        encontradoFinal = resto.substr(inicioCaracFin);                                       // Parte final del token (tras el número)
+
+                    string esperado = estructura[str].substr(0, inicioNumero);                                // Parte inicial esperada
+                    string esperadoFinal = "";
+                    if (estructura[str].size() >= finNumero + 1)                                              // Si hay caracteres al final del parámetro
+                        esperadoFinal = estructura[str].substr(finNumero + 1);                                // Parte final esperada
+
+                    if (encontrado != esperado || encontradoFinal != esperadoFinal)                           // Nombre del parámetro incorrecto
+                    {
+                        if (esperadoFinal != "" || encontradoFinal != "")
+                            throw exception_wrong_instruction_syntax (tokens[0], i_linea, tokens[tok], esperado + "*" + esperadoFinal);
+                        throw exception_wrong_instruction_syntax (tokens[0], i_linea, encontrado, esperado);
+                    }
+
+                    string numero = tokens[tok].substr(inicioNumero);                                         // Quita los caracteres no numéricos
+                    bitset<TAMANYO_INSTRUCCION> numeroBinario {(long long unsigned int)to_decimal(numero)};   // Convierte el número a binario
+
+                    for (int i = nBits - 1; i >= 0; i--)
+                    {
+                        salida += numeroBinario[i] ? "1" : "0";                                               // Añade los bits correspondientes a la instrucción
+                    }
+
+                    tok++;                                                                                    // Avanza el contador de los tokens
+                }
+            }
+
+            return salida;
+        }
+};
+
+
+// Lee la configuración como el original: la cabecera y después las constantes y las instrucciones
+
+void leerConfiguracion (istream &f_config, estado &est)
+{
+    string linea;                                                       // Variable de lectura
+
+    getline (f_config, linea);                                          // Lee la primera línea del fichero de configuración
+
+    if (linea == "HEX") est.hex_out = true;                             // Salida en hexadecimal
+    else if (linea == "BIN") est.hex_out = false;                       // Salida en binario
+    else                                                                // Sintaxis incorrecta
+        throw exception_wrong_config_syntax ("La primera linea debe ser HEX o BIN");
+
+    getline (f_config, linea);                                          // Lee la segunda línea del fichero de configuración
+
+    est.logisim_out = linea == "LOGISIM_OUT";                           // Activa la salida para logisim
+    if (est.logisim_out)
+        getline (f_config, linea);
+
+    est.vhdl_out = linea == "VHDL_OUT";                                 // Activa la salida para VHDL
+    if (est.vhdl_out)
+        getline (f_config, linea);
+
+    est.salto_relativo = linea == "SALTO_RELATIVO";                     // Activa los saltos relativos a PC
+    if (est.salto_relativo)
+        getline (f_config, linea);
+
+    while (!f_config.eof())
+    {
+        if (linea != "")
+        {
+            if (linea[0] == CH_CONSTANTE_CONFIG)                                            // Es una constante de configuración
+                est.constantes_config[linea.substr(0, linea.find('='))] =                   // Añade el valor tras el '=' a la tabla de constantes
+                    linea.substr(linea.find('=') + 1);
+            else
+            {
+                int pos1 = linea.find("<");                                                 // Posición del inicio de los bits de instrucción
+                int pos2 = linea.find(">");                                                 // Posición del final de los bits de instrucción
+                string nombre = linea.substr(0, pos1);                                      // Nombre de la instrucción
+                string bits = linea.substr(pos1 + 1, pos2 - (pos1 + 1));                    // Bits de operación
+
+                vector<string> estructura;                                                  // Vector de tokens de la instrucción
+                bits = bits + linea.substr(pos2 + 1);                                       // Añade los bits de la instrucción
+
+                stringToVector(bits, estructura);                                           // Tokeniza la estructura de la instrucción
+
+                for (string &str : estructura)                                              // Transforma las etiquetas de configuración en su valor
+                {
+                    if (str[0] == CH_CONSTANTE_CONFIG                                       // Es una etiqueta interna de configuración
+                        && count(str.begin(), str.end(), '0') + count(str.begin(), str.end(), '1') + 1 != str.size())
+                    {
+                        if (est.constantes_config.find(str) == est.constantes_config.end())    // No existe la etiqueta
+                            throw exception_wrong_config_syntax ("La constante " + str + " no existe");
+
+                        str = est.constantes_config[str];                                   // Cambia el nombre de la etiqueta por su valor
+                    }
+                }
+
+                est.instrucciones [nombre] = estructura;                                    // Añade la estructura a la tabla de instrucciones
+            }
+        }
+
+        getline (f_config, linea);                                                          // Lee la siguiente línea del fichero de configuración
+    }
+}
+
+}
+
+
+// Ensambla con el algoritmo original de cumpilador, para comprobar que los demás caminos dan la misma salida
+// Cada instrucción se codifica por separado en un string de bits, con bitset de 32 bits y la configuración y las
+// etiquetas en maps; la salida HEX se obtiene del string con binSToHex. Solo admite la sintaxis original (sin
+// TAMANYO_INSTRUCCION, directivas ni finales de línea \r\n) e instrucciones de hasta 32 bits. Como en el original,
+// una línea es una instrucción si tiene un espacio: con solo tabuladores, o con un comentario tras una etiqueta, no
+// coincide con el lexer. Los errores se lanzan como excepciones, salvo los números incorrectos, que dan los de stoi
+
+programa_referencia ensamblarReferencia (string_view textoConfig, string_view textoPrograma)
+{
+    referencia::estado est;
+    istringstream f_config {string(textoConfig)};
+    istringstream f_entrada {string(textoPrograma)};
+    referencia::leerConfiguracion (f_config, est);
+
+    // Comienza la lectura y tokenizado del código
+
+    vector<string> param;                                       // Variable para tokenizar la instrucción
+    string linea;                                               // Variable de lectura
+    int i_PC = 0;                                               // Lleva la cuenta del número de línea para almacenar etiquetas de salto
+    int i_numLinea = 0;                                         // Lleva la cuenta del número de línea para mostrar errores
+    vector<referencia::instruccion> codigo;                     // Lista de instrucciones del repertorio
+
+    getline (f_entrada, linea);                                 // Lee la primera línea
+
+    while (!f_entrada.eof())
+    {
+        i_numLinea++;                                           // Incrementa el número de línea
+
+        if (linea.find(";") != string::npos)                    // Elimina el comentario
+            linea = linea.substr(0, linea.find(";"));
+
+        if (linea != "" && linea.find(" ") != string::npos)     // Es una instrucción
+        {
+            replace (linea.begin(), linea.end(), '\t', ' ');                    // Elimina los tabuladores
+            stringstream ss (linea);                                            // Convierte la línea en un flujo de datos
+            string token;                                                       // Variable para almacenar el token
+
+            while (getline(ss, token, ' '))
+                if (token != "")
+                    param.push_back(token);
+
+            if (!param.empty())                                                 // En el original una línea de solo espacios leía fuera del vector
+            {
+                codigo.emplace_back (est, param, i_numLinea, i_PC);             // Crea la instrucción
+                param.clear();                                                  // Limpia el vector de parámetros
+
+                i_PC++;                                                         // Incrementa el contador de instrucción (Para etiquetas de salto)
+            }
+        }
+        else if (linea != "")                                   // Es una etiqueta de salto
+        {
+            if (linea.find('=') != string::npos)                                // Almacena el valor de la etiqueta
+                est.etiquetas[linea.substr(0, linea.find('='))] = referencia::to_decimal(linea.substr(linea.find('=') + 1));
+            else
+                est.etiquetas[linea] = i_PC;                                    // Almacena la posición de la etiqueta
+        }
+
+        getline (f_entrada, linea);                                             // Lee la siguiente línea
+    }
+
+    // Comienza el ensamblado
+
+    programa_referencia programa;
+    ostringstream f_salida;
+
+    if (est.logisim_out)                                                   // Imprime la cabecera de memoria de logisim
+        f_salida << "v2.0 raw\n";
+
+    int contador = 0;                                                      // Contador de instrucciones
+    for (referencia::instruccion &inst : codigo)                                       // Recorre la lista de instrucciones
+    {
+        string binario = inst.to_bin();
+        string salida = est.hex_out ? referencia::binSToHex (binario) : binario;       // Traduce la instrucción a hexadecimal o la deja en binario
+
+        programa.palabras.push_back (binario);
+        programa.lineas.push_back (inst.i_linea);
+
+        if (est.logisim_out)                                               // Código para rom de logisim
+            f_salida << salida << " ";
+        else if (est.vhdl_out)
+            f_salida << "X\"" << salida << "\", ";
+        else                                                               // Código estándar
+            f_salida << salida << endl;
+
+        if (contador == 7 && (est.logisim_out || est.vhdl_out))            // Si se ha alcanzado el número máximo de instrucciones por línea
+        {
+            f_salida << endl;
+            contador = 0;
+        }
+        else
+            contador++;                                                    // Incrementa el contador de instrucciones
+    }
+
+    programa.salida = f_salida.str();
+    return programa;
+}
+
+
+
+// Modo diferencial
+
+// Parámetros del modo diferencial, se cambian con clave=valor en la línea de comandos
+struct parametros_diferencial
+{
+    long long casos = 1000;                          // Casos aleatorios a comprobar
+    int lineas = 40;                                 // Líneas de programa de un caso normal
+    int instrucciones = 8;                           // Máximo de instrucciones de cada configuración
+    double grandes = 2;                              // Porcentaje de casos con 200 veces más líneas, que se leen y codifican en varios hilos
+    double errores = 1;                              // Porcentaje de líneas con un error, en los casos grandes 200 veces menor
+    unsigned semilla = 1;                            // Semilla del primer caso; el caso k usa semilla + k
+    int guardar = 5;                                 // Diferencias que se reducen y se guardan en ficheros
+    string salida = "diferencia";                    // Prefijo de los ficheros de las diferencias
+};
+
+// Campo de una instrucción de la configuración aleatoria, para generar sus operandos en el programa
+struct campo_aleatorio
+{
+    char tipo;                                       // 'p' parámetro, '#' valor o etiqueta, 'r' salto relativo ##
+    string prefijo;                                  // Texto antes del número en los parámetros
+    string sufijo;                                   // Texto tras el número en los parámetros
+    int nBits;                                       // Bits del campo
+};
+
+// Instrucción de la configuración aleatoria
+struct instruccion_aleatoria
+{
+    string nombre;                                   // Mnemónico
+    vector<campo_aleatorio> campos;                  // Operandos que se escriben en el programa, en orden
+};
+
+// Resultado de ensamblar un caso con la referencia o con uno de los motores
+struct resultado_diferencial
+{
+    bool correcto = false;                           // Se ha ensamblado sin errores
+    string salida;                                   // Contenido del fichero de salida de texto
+    string error;                                    // Mensaje del error, si no es correcto
+};
+
+// Motores que se comparan con la referencia
+enum motor_diferencial
+{
+    MOTOR_SECUENCIAL,                                // ensamblar en un hilo, con la primera y la segunda pasada
+    MOTOR_HILOS,                                     // ensamblar con la lectura y la codificación repartidas entre hilos
+    MOTOR_STREAMING,                                 // ensamblar en una sola pasada con --streaming
+    MOTOR_PROGRAMA,                                  // ensamblarPrograma en varios hilos y formatearPrograma
+    MOTOR_OBJETO,                                    // ensamblarObjeto y enlazarObjetos con un solo módulo
+    N_MOTORES
+};
+
+const char *NOMBRES_MOTORES[N_MOTORES] = {"secuencial", "hilos", "streaming", "programa", "objeto"};
+
+
+// Genera una configuración aleatoria de instrucciones de hasta 32 bits, como las que admite la referencia
+// Mezcla parámetros con prefijo y sufijo (rs*****fp), valores #, saltos ##, rellenos & y constantes &NOMBRE,
+// y a veces redefine una instrucción
+
+string generarConfiguracionAleatoria (const parametros_diferencial &par, mt19937_64 &aleatorio, vector<instruccion_aleatoria> &formas)
+{
+    auto azar = [&] (int n) { return (int) (aleatorio() % n); };
+    auto bits = [&] (int n)
+    {
+        string b;
+        for (int i = 0; i < n; i++)
+            b += azar(2) ? '1' : '0';
+        return b;
+    };
+
+    const char *PREFIJOS[] = {"r", "rs", "rt", "rd", "f", "R", ""};
+    const char *SUFIJOS[] = {"", "", "", "fp", "h", "x"};
+
+    string config = azar(2) ? "HEX\n" : "BIN\n";
+    if (azar(4) == 0) config += "LOGISIM_OUT\n";
+    if (azar(5) == 0) config += "VHDL_OUT\n";
+    if (azar(2) == 0) config += "SALTO_RELATIVO\n";
+    config += "\n";
+
+    vector<pair<string, int>> constantes;                                       // Nombre y bits de cada constante
+    for (int k = azar(4); k > 0; k--)
+    {
+        int n = 1 + azar(6);
+        constantes.push_back ({"&C" + std::to_string(constantes.size()), n});
+        config += constantes.back().first + "=&" + bits(n) + "\n";
+    }
+    config += "\n";
+
+    formas.clear();
+    int nInstrucciones = 1 + azar(par.instrucciones);
+    for (int k = 0; k < nInstrucciones; k++)
+    {
+        instruccion_aleatoria forma;
+        for (int l = 2 + azar(4); l > 0; l--)
+            forma.nombre += (char) ('A' + azar(26));
+
+        int bitsOpcode = 2 + azar(7);
+        int libres = 32 - bitsOpcode - (azar(5) == 0 ? azar(8) : 0);            // Algunas instrucciones no llegan a 32 bits
+        string linea = forma.nombre + "<" + bits(bitsOpcode) + ">";
+
+        while (libres > 0 && forma.campos.size() < 6)
+        {
+            int tipo = forma.campos.empty() ? 3 + azar(7) : azar(10);           // Al menos un operando
+            if (tipo < 2)                                                       // Constante de configuración o relleno
+            {
+                int c = constantes.empty() ? -1 : azar(constantes.size());
+                if (tipo == 0 && c >= 0 && constantes[c].second <= libres)
+                {
+                    linea += " " + constantes[c].first;
+                    libres -= constantes[c].second;
+                }
+                else
+                {
+                    int n = 1 + azar(min(libres, 6));
+                    linea += " &" + bits(n);
+                    libres -= n;
+                }
+                continue;
+            }
+
+            campo_aleatorio campo;
+            campo.nBits = 1 + azar(min(libres, tipo < 6 ? 8 : 24));
+            if (tipo < 6)                                                       // Parámetro
+            {
+                campo.tipo = 'p';
+                campo.prefijo = PREFIJOS[azar(7)];
+                campo.sufijo = SUFIJOS[azar(6)];
+                linea += " " + campo.prefijo + string(campo.nBits, '*') + campo.sufijo;
+            }
+            else
+            {
+                campo.tipo = tipo < 8 ? '#' : 'r';
+                linea += (campo.tipo == '#' ? " #" : " ##") + string(campo.nBits, '*');
+            }
+
+            forma.campos.push_back (campo);
+            libres -= campo.nBits;
+        }
+
+        config += linea + "\n";
+
+        int repetida = formas.empty() || azar(20) ? -1 : azar(formas.size());   // La nueva definición sustituye a la anterior
+        if (repetida >= 0)
+        {
+            config += formas[repetida].nombre + linea.substr(forma.nombre.size()) + "\n";
+            forma.nombre = formas[repetida].nombre;
+            formas[repetida] = forma;
+        }
+        else
+            formas.push_back (forma);
+    }
+
+    return config;
+}
+
+
+// Genera un programa aleatorio de nLineas líneas para las instrucciones de la configuración aleatoria
+// Tiene etiquetas de posición y con valor (decimal, negativo, 0x o 'c'), comentarios, separadores de espacios y
+// tabuladores y valores que no caben en su campo. Con el porcentaje de errores, una línea tiene una instrucción
+// desconocida, un parámetro de más o de menos, un operando con otra sintaxis, una etiqueta sin definir o una
+// etiqueta con un valor incorrecto. Algunas etiquetas se redefinen, y entonces se pone redefine a true
+
+string generarProgramaAleatorio (const parametros_diferencial &par, mt19937_64 &aleatorio, const vector<instruccion_aleatoria> &formas, long long nLineas,
+                                 bool &redefine)
+{
+    auto azar = [&] (long long n) { return (long long) (aleatorio() % n); };
+    double umbralError = par.errores * 100 * par.lineas / nLineas;             // Los casos grandes tienen tantos errores como los normales
+    auto error = [&] () { return aleatorio() % 10000 < umbralError; };
+
+    const char *SEPARADORES[] = {" ", " ", " ", "  ", "\t ", " \t"};
+    long long nEtiquetas = max (2LL, nLineas / 8);
+    vector<bool> definidas (nEtiquetas), definidasValor (nEtiquetas);       // Etiquetas L y K ya definidas
+    redefine = false;
+
+    auto literal = [&] ()                                                       // Número en cualquiera de sus sintaxis
+    {
+        switch (azar(8))
+        {
+            case 0: return std::to_string (-azar(1000));
+            case 1: { stringstream ss; ss << "0x" << hex << (azar(4) ? azar(1 << 16) : azar(1LL << 32)); return ss.str(); }
+            case 2: return string ("'") + (char) ('!' + azar(26)) + "'";
+            case 3: return "+" + std::to_string (azar(100));
+            default: return std::to_string (azar(azar(2) ? 256 : 1 << 24));
+        }
+    };
+
+    string programa;
+    for (long long l = 0; l < nLineas; l++)
+    {
+        int tipo = azar(100);
+        int tipoError = error() ? azar(5) : -1;                                 // Error de la línea, -1 si no tiene
+        if (tipo < 15)                                                          // Etiqueta de posición o con valor
+        {
+            bool conValor = tipo >= 10;
+            long long e = azar(nEtiquetas);
+            vector<bool> &yaDefinidas = conValor ? definidasValor : definidas;
+            if (yaDefinidas[e] && azar(10))                                     // Pocas se redefinen
+                continue;
+
+            redefine |= yaDefinidas[e];
+            yaDefinidas[e] = true;
+            if (conValor)
+                programa += "K" + std::to_string(e) + "=" + (tipoError == 4 ? "x" + literal() : literal()) + "\n";
+            else
+                programa += "L" + std::to_string(e) + "\n";
+            continue;
+        }
+        if (tipo < 18)                                                          // Comentario
+        {
+            programa += (azar(2) ? "; comentario " : "    ;") + std::to_string(l) + "\n";
+            continue;
+        }
+        if (tipo < 20)                                                          // Línea vacía
+        {
+            programa += "\n";
+            continue;
+        }
+
+        const instruccion_aleatoria &forma = formas[azar(formas.size())];
+        vector<string> tokens = {tipoError == 0 ? forma.nombre + "Z" : forma.nombre};
+        size_t operandoErroneo = azar(forma.campos.size());                     // Operando con el error de sintaxis o de etiqueta
+
+        for (const campo_aleatorio &campo : forma.campos)
+        {
+            bool erroneo = tokens.size() - 1 == operandoErroneo;
+            auto etiqueta = [&] ()
+            {
+                long long e = azar(nEtiquetas);
+                return (erroneo && tipoError == 3 ? "X" : azar(3) ? "L" : "K") + std::to_string(e);
+            };
+
+            if (campo.tipo == 'p')
+            {
+                long long maximo = 1LL << (azar(10) ? campo.nBits : campo.nBits + 4);   // A veces no cabe y se recorta
+                string numero = std::to_string (azar(maximo));
+                if (erroneo && tipoError == 2)
+                    numero = azar(3) == 0 ? "-" + numero : azar(2) ? "0x" + numero : numero + "q";
+                tokens.push_back (campo.prefijo + numero + campo.sufijo);
+            }
+            else if (campo.tipo == '#')
+                tokens.push_back (azar(2) && !(erroneo && tipoError == 3) ? "#" + literal() : etiqueta());
+            else
+                tokens.push_back (azar(8) || (erroneo && tipoError == 3) ? etiqueta() : "#" + literal());
+        }
+
+        if (tipoError == 1)                                                     // Un parámetro de más o de menos
+        {
+            if (azar(2) || tokens.size() == 1)
+                tokens.push_back ("r1");
+            else
+                tokens.pop_back ();
+        }
+
+        string linea = azar(10) ? "" : azar(2) ? "    " : "\t ";
+        for (size_t t = 0; t < tokens.size(); t++)
+            linea += (t == 0 ? "" : SEPARADORES[azar(6)]) + tokens[t];
+        if (azar(5) == 0)
+            linea += azar(2) ? " ; comentario" : "\t;";
+
+        programa += linea + "\n";
+    }
+
+    for (long long e = 0; e < nEtiquetas; e++)                                  // Define las etiquetas que faltan
+    {
+        if (!definidas[e] && !error())
+            programa += "L" + std::to_string(e) + "\n";
+        if (!definidasValor[e] && !error())
+            programa += "K" + std::to_string(e) + "=" + literal() + "\n";
+    }
+
+    return programa;
+}
+
+
+// Ensambla un caso con el ensamblador de referencia
+resultado_diferencial ejecutarReferencia (const string &config, const string &programa, vector<int> *lineas = nullptr)
+{
+    resultado_diferencial resultado;
+    try
+    {
+        programa_referencia ref = ensamblarReferencia (config, programa);
+        resultado.salida = ref.salida;
+        resultado.correcto = true;
+        if (lineas != nullptr)
+            *lineas = ref.lineas;
+    }
+    catch (const exception &e)
+    {
+        resultado.error = e.what();
+    }
+    return resultado;
+}
+
+
+// Ensambla un caso con uno de los motores, con la salida de texto de la configuración
+resultado_diferencial ejecutarMotor (motor_diferencial motor, const string &config, const string &programa, int nHilos)
+{
+    resultado_diferencial resultado;
+    try
+    {
+        configuracion_isa isa (config);
+        modo_salida modo (isa);
+
+        if (motor == MOTOR_PROGRAMA)
+            resultado.salida = formatearPrograma (modo, ensamblarPrograma (isa, programa, nHilos));
+        else if (motor == MOTOR_OBJETO)
+            resultado.salida = formatearPrograma (modo, enlazarObjetos (isa, {ensamblarObjeto (isa, programa)}));
+        else
+        {
+            ostringstream salida;
+            contexto_ensamblado ctx (isa);
+            {
+                escritor_salida escritor (salida, modo);
+                conTipoPalabra (isa, [&] (auto palabra)
+                {
+                    ensamblar<decltype(palabra)> (programa, motor == MOTOR_HILOS ? nHilos : 1, motor == MOTOR_STREAMING, escritor, ctx);
+                });
+                escritor.terminar();
+            }
+            resultado.salida = salida.str();
+        }
+        resultado.correcto = true;
+    }
+    catch (const exception &e)
+    {
+        resultado.error = e.what();
+    }
+    return resultado;
+}
+
+
+// Palabras de una salida de texto, sin la cabecera de logisim ni la sintaxis de VHDL
+vector<string> palabrasSalida (const string &salida)
+{
+    vector<string> palabras;
+    string palabra;
+    stringstream ss (salida.compare(0, 9, "v2.0 raw\n") == 0 ? salida.substr(9) : salida);
+
+    while (ss >> palabra)
+    {
+        if (palabra.size() >= 4 && palabra[0] == 'X' && palabra[1] == '"')   // X"valor",
+            palabra = palabra.substr(2, palabra.size() - 4);
+        palabras.push_back (palabra);
+    }
+    return palabras;
+}
+
+
+// Compara el resultado de un motor con el de la referencia palabra a palabra
+// Devuelve una descripción de la primera diferencia, o un texto vacío si son iguales. Si los dos fallan, son iguales
+
+string compararResultados (const resultado_diferencial &ref, const resultado_diferencial &obtenido, const vector<int> &lineas)
+{
+    if (!ref.correcto && !obtenido.correcto)
+        return "";
+    if (!ref.correcto)
+        return "la referencia falla (" + ref.error + ") y el motor no";
+    if (!obtenido.correcto)
+        return "el motor falla (" + obtenido.error + ") y la referencia no";
+    if (ref.salida == obtenido.salida)
+        return "";
+
+    vector<string> esperadas = palabrasSalida (ref.salida);
+    vector<string> obtenidas = palabrasSalida (obtenido.salida);
+
+    for (size_t i = 0; i < min (esperadas.size(), obtenidas.size()); i++)
+        if (esperadas[i] != obtenidas[i])
+            return "palabra " + std::to_string(i) + (i < lineas.size() ? " (linea " + std::to_string(lineas[i]) + ")" : "") +
+                   ": se esperaba " + esperadas[i] + " y se ha obtenido " + obtenidas[i];
+
+    if (esperadas.size() != obtenidas.size())
+        return "se esperaban " + std::to_string(esperadas.size()) + " palabras y se han obtenido " + std::to_string(obtenidas.size());
+
+    size_t byte = mismatch (ref.salida.begin(), ref.salida.end(), obtenido.salida.begin(), obtenido.salida.end()).first - ref.salida.begin();
+    return "las palabras son iguales, pero el formato difiere en el byte " + std::to_string(byte);
+}
+
+
+// Quita líneas de texto, a partir de la línea primera y de las que cumplen quitable, mientras falla (texto) siga
+// siendo cierto. Prueba a quitar trozos de la mitad de las candidatas, después de la cuarta parte y así hasta líneas
+// sueltas, como ddmin; tras quitar un trozo sigue por el siguiente. Se repite hasta que no se pueda quitar ninguna,
+// porque quitar una línea puede hacer que sobre otra (la etiqueta que usaba)
+
+template <typename filtro_t, typename funcion_t>
+string reducirLineas (const string &texto, size_t primera, filtro_t quitable, funcion_t falla)
+{
+    vector<string> lineas;
+    stringstream ss (texto);
+    string linea;
+    while (getline (ss, linea))
+        lineas.push_back (linea);
+
+    vector<bool> activas (lineas.size(), true);                                 // Líneas que siguen en el texto
+
+    auto unir = [&] ()
+    {
+        string resultado;
+        for (size_t i = 0; i < lineas.size(); i++)
+            if (activas[i])
+                resultado += lineas[i] + "\n";
+        return resultado;
+    };
+
+    for (bool reducido = true; reducido; )
+    {
+        reducido = false;
+
+        vector<size_t> candidatas;                                              // Líneas activas que se pueden quitar
+        for (size_t i = primera; i < lineas.size(); i++)
+            if (activas[i] && quitable (lineas[i]))
+                candidatas.push_back (i);
+
+        for (size_t tamanyo = max<size_t> (1, candidatas.size() / 2); !candidatas.empty(); tamanyo /= 2)
+        {
+            for (size_t inicio = 0; inicio < candidatas.size(); )
+            {
+                size_t fin = min (candidatas.size(), inicio + tamanyo);
+                for (size_t c = inicio; c < fin; c++)
+                    activas[candidatas[c]] = false;
+
+                if (falla (unir ()))                                            // Sobra el trozo
+                {
+                    candidatas.erase (candidatas.begin() + inicio, candidatas.begin() + fin);
+                    reducido = true;
+                }
+                else
+                {
+                    for (size_t c = inicio; c < fin; c++)
+                        activas[candidatas[c]] = true;
+                    inicio = fin;
+                }
+            }
+
+            if (tamanyo == 1)
+                break;
+        }
+    }
+
+    return unir ();
+}
+
+
+// Indica si una línea del programa es una instrucción: tiene más de un token antes del comentario
+bool esInstruccion (const string &linea)
+{
+    stringstream ss (linea.substr(0, linea.find(';')));
+    string token;
+    int nTokens = 0;
+    while (ss >> token)
+        nTokens++;
+    return nTokens > 1;
+}
+
+
+// Modo diferencial: genera configuraciones y programas aleatorios con los parámetros dados como clave=valor,
+// los ensambla con el ensamblador de referencia y con cada motor, y compara sus salidas palabra a palabra.
+// Cada diferencia se reduce quitando líneas del programa y de la configuración y se guarda en ficheros
+
+int ejecutarDiferencial (const vector<char *> &argumentos, int nHilos)
+{
+    parametros_diferencial par;
+
+    for (const char *argumento : argumentos)
+    {
+        string arg = argumento;
+        size_t igual = arg.find('=');
+        string clave = arg.substr(0, igual);
+        string valor = igual == string::npos ? "" : arg.substr(igual + 1);
+
+        try
+        {
+            if (clave == "casos") par.casos = stoll(valor);
+            else if (clave == "lineas") par.lineas = stoi(valor);
+            else if (clave == "instrucciones") par.instrucciones = stoi(valor);
+            else if (clave == "grandes") par.grandes = stod(valor);
+            else if (clave == "errores") par.errores = stod(valor);
+            else if (clave == "semilla") par.semilla = stoul(valor);
+            else if (clave == "guardar") par.guardar = stoi(valor);
+            else if (clave == "salida" && !valor.empty()) par.salida = valor;
+            else
+            {
+                cerr << "Parametro diferencial desconocido: " << arg << endl;
+                return 1;
+            }
+        }
+        catch (const std::exception &)
+        {
+            cerr << "Valor incorrecto en el parametro diferencial " << arg << endl;
+            return 1;
+        }
+    }
+
+    if (par.casos < 1 || par.lineas < 1 || par.instrucciones < 1)
+    {
+        cerr << "Parametros diferenciales fuera de rango: casos, lineas e instrucciones >= 1" << endl;
+        return 1;
+    }
+
+    nHilos = max (nHilos, 4);                                                   // Los motores en paralelo siempre usan varios hilos
+    long long fallidos = 0, comparaciones = 0, erroneos = 0, omitidas = 0;
+    int guardados = 0;
+    vector<long long> diferencias (N_MOTORES);
+
+    for (long long k = 0; k < par.casos; k++)
+    {
+        unsigned semilla = par.semilla + k;
+        mt19937_64 aleatorio (semilla);
+        vector<instruccion_aleatoria> formas;
+
+        string config = generarConfiguracionAleatoria (par, aleatorio, formas);
+        bool grande = aleatorio() % 10000 < par.grandes * 100;
+        bool redefine;
+        string programa = generarProgramaAleatorio (par, aleatorio, formas, grande ? par.lineas * 200LL : par.lineas, redefine);
+
+        vector<int> lineas;
+        resultado_diferencial ref = ejecutarReferencia (config, programa, &lineas);
+        bool reducido = false;                                                  // Cada caso se reduce una vez, con el primer motor que difiere
+        erroneos += !ref.correcto;
+
+        for (int m = 0; m < N_MOTORES; m++)
+        {
+            motor_diferencial motor = (motor_diferencial) m;
+            if (motor == MOTOR_STREAMING && redefine)                           // Usa el valor de la etiqueta en cada momento
+            {
+                omitidas++;
+                continue;
+            }
+
+            string diferencia = compararResultados (ref, ejecutarMotor (motor, config, programa, nHilos), lineas);
+            comparaciones++;
+            if (diferencia.empty())
+                continue;
+
+            fallidos++;
+            diferencias[m]++;
+            cout << "Caso " << k << " (semilla=" << semilla << "), motor " << NOMBRES_MOTORES[m] << ": " << diferencia << endl;
+
+            if (reducido || guardados >= par.guardar)
+                continue;
+            reducido = true;
+            guardados++;
+
+            auto falla = [&] (const string &c, const string &p)
+            {
+                return !compararResultados (ejecutarReferencia (c, p), ejecutarMotor (motor, c, p, nHilos), {}).empty();
+            };
+
+            auto todas = [] (const string &) { return true; };                 // Primero se quitan instrucciones, sin dejar etiquetas sin definir
+            string programaReducido = reducirLineas (programa, 0, esInstruccion, [&] (const string &p) { return falla (config, p); });
+            programaReducido = reducirLineas (programaReducido, 0, todas, [&] (const string &p) { return falla (config, p); });
+            string configReducida = reducirLineas (config, 1, todas, [&] (const string &c) { return falla (c, programaReducido); });
+
+            vector<int> lineasReducidas;
+            string rutaConfig = par.salida + "_" + std::to_string(guardados) + "_config.txt";
+            string rutaPrograma = par.salida + "_" + std::to_string(guardados) + "_programa.txt";
+            ofstream f_config (rutaConfig), f_programa (rutaPrograma);
+            f_config << configReducida;
+            f_programa << programaReducido;
+
+            if (!f_config.good() || !f_programa.good())
+                cout << "    No se ha podido escribir el fichero " << (f_config.good() ? rutaPrograma : rutaConfig) << endl;
+            else
+                cout << "    Reducido a " << count (programaReducido.begin(), programaReducido.end(), '\n') << " lineas de programa y "
+                     << count (configReducida.begin(), configReducida.end(), '\n') << " de configuracion: " << rutaConfig << " " << rutaPrograma << endl
+                     << "    " << compararResultados (ejecutarReferencia (configReducida, programaReducido, &lineasReducidas),
+                                                      ejecutarMotor (motor, configReducida, programaReducido, nHilos), lineasReducidas) << endl;
+        }
+    }
+
+    cout << "Diferencial: " << par.casos << " casos (" << erroneos << " con errores), " << comparaciones << " comparaciones ("
+         << omitidas << " omitidas en streaming por etiquetas redefinidas), "
+         << fallidos << " diferencias" << endl;
+    for (int m = 0; m < N_MOTORES; m++)
+        if (diferencias[m] > 0)
+            cout << "    " << NOMBRES_MOTORES[m] << ": " << diferencias[m] << endl;
+
+    return fallidos == 0 ? 0 : 1;
+}
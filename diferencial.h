@@ -0,0 +1,18 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ * diferencial: modo --diferencial de cumpilador, en diferencial.cpp
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef DIFERENCIAL_H
+#define DIFERENCIAL_H
+
+#include <vector>
+
+
+// Modo diferencial: genera configuraciones y programas aleatorios con los parámetros dados como clave=valor,
+// los ensambla con el ensamblador de referencia y con cada motor, y compara sus salidas palabra a palabra.
+// Devuelve 1 si hay alguna diferencia
+int ejecutarDiferencial (const std::vector<char *> &argumentos, int nHilos);
+
+#endif
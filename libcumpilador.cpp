@@ -0,0 +1,2509 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ * libcumpilador: lectura de la configuración, primera pasada y funciones de la biblioteca que no son plantillas
+ * La interfaz y las plantillas de codificación y formateo están en libcumpilador.h
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include "libcumpilador.h"
+
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace cumpilador
+{
+
+
+
+// Funciones auxiliares
+
+// Lee una línea de un fichero de texto, quitando el \r final de los ficheros de windows
+
+istream &leerLinea (istream &fichero, string &linea)
+{
+    getline (fichero, linea);
+
+    if (!linea.empty() && linea.back() == '\r')
+        linea.pop_back();
+
+    return fichero;
+}
+
+
+// Devuelve una máscara con los nBits bits de menor peso a 1
+
+uint64_t mascaraBits (int nBits)
+{
+    return nBits >= 64 ? ~(uint64_t)0 : ((uint64_t)1 << nBits) - 1;
+}
+
+
+// Hash FNV-1a de 64 bits de un texto, continuando desde hash
+
+uint64_t hashTexto (string_view texto, uint64_t hash)
+{
+    for (char c : texto)
+    {
+        hash ^= (uint8_t) c;
+        hash *= 0x100000001B3ull;
+    }
+    return hash;
+}
+
+
+// Convierte un string a decimal
+// El string puede ser un decimal, hexadecimal comenzado con 0x o un caracter entre ''
+// Como en la lectura original con stringstream y stoi, se ignoran los caracteres que sigan al número
+// y los hexadecimales mayores que INT_MAX se saturan a INT_MAX
+
+int to_decimal(string_view numero, int linea)
+{
+    if (numero.size() >= 2 && numero[0] == '0' && numero[1] == 'x')        // Hexadecimal
+    {
+        unsigned long long hexadecimal = 0;
+        auto [fin, error] = from_chars (numero.data() + 2, numero.data() + numero.size(), hexadecimal, 16);
+
+        if (error == errc::result_out_of_range || hexadecimal > INT_MAX)
+            return INT_MAX;
+        return hexadecimal;
+    }
+    else if  (!numero.empty() && numero[0] == '\'' && numero.back() == '\'')  // Caracter
+    {
+        return numero.size() > 1 ? numero[1] : 0;
+    }
+    else                                                                    // Decimal
+    {
+        int decimal;
+        const char *inicio = numero.data();
+        const char *final = numero.data() + numero.size();
+
+        if (inicio != final && *inicio == '+')                              // from_chars no admite el signo +
+            inicio++;
+
+        auto [fin, error] = from_chars (inicio, final, decimal);
+
+        if (error != errc() || (inicio != numero.data() && *inicio == '-'))
+            throw exception_wrong_number(string(numero), linea);
+
+        return decimal;
+    }
+}
+
+
+// Lanza un error con todas las etiquetas usadas en el código que no se han definido,
+// cada una con la primera línea en la que aparece, ordenadas por línea
+
+void lanzarEtiquetasDesconocidas (const almacen_instrucciones &codigo, const tabla_etiquetas &etiquetas)
+{
+    vector<int> primeraLinea (etiquetas.size(), INT_MAX);                      // Primera línea que usa cada etiqueta sin definir
+
+    for (size_t i = 0; i < codigo.size(); i++)
+    {
+        int nCampos = codigo.plan(i).campos.size();
+
+        for (int c = 0; c < nCampos; c++)
+        {
+            int etiqueta = codigo.simbolo(i, c);
+            if (etiqueta >= 0 && !etiquetas.definida(etiqueta))
+                primeraLinea[etiqueta] = min (primeraLinea[etiqueta], (int) codigo.lineas[i]);
+        }
+    }
+
+    vector<pair<int, string>> desconocidas;
+    for (size_t id = 0; id < primeraLinea.size(); id++)
+    {
+        if (primeraLinea[id] != INT_MAX)
+            desconocidas.push_back({primeraLinea[id], string(etiquetas.nombre(id))});
+    }
+
+    sort (desconocidas.begin(), desconocidas.end());
+    throw exception_wrong_label (desconocidas);
+}
+
+
+// Bytes que ocupa cada palabra en la salida binaria e Intel HEX
+
+int bytesPalabra (const modo_salida &modo)
+{
+    return (modo.tamanyoInstruccion + 7) / 8;
+}
+
+
+// Escribe en destino un registro Intel HEX con n bytes de datos
+// Devuelve el número de bytes escritos
+
+size_t registroIntelHex (uint16_t direccion, uint8_t tipo, const uint8_t *datos, int n, char *destino)
+{
+    char *p = destino;
+    uint8_t suma = n + (direccion >> 8) + (direccion & 0xFF) + tipo;   // Suma de todos los bytes del registro
+
+    *p++ = ':';
+    formatearHex<uint32_t> (n, 2, p);
+    formatearHex<uint32_t> (direccion, 4, p + 2);
+    formatearHex<uint32_t> (tipo, 2, p + 6);
+    p += 8;
+
+    for (int b = 0; b < n; b++, p += 2)
+    {
+        formatearHex<uint32_t> (datos[b], 2, p);
+        suma += datos[b];
+    }
+
+    formatearHex<uint32_t> ((uint8_t) -suma, 2, p);                   // Complemento a dos de la suma
+    p += 2;
+    *p++ = '\n';
+
+    return p - destino;
+}
+
+
+// El registro de dirección lineal extendida solo tiene los 16 bits altos de una dirección de 32 bits
+
+string direccionIntelHexExcedida (uint64_t direccion)
+{
+    char texto[17];
+    char *fin = to_chars (texto, texto + sizeof(texto), direccion, 16).ptr;
+    transform (texto, fin, texto, ::toupper);
+    return "La direccion 0x" + string(texto, fin) + " no cabe en los 32 bits de Intel HEX";
+}
+
+
+// Tokeniza un string separado por espacios en un vector de strings
+void stringToVector (string s, vector<string> &vect)
+{
+    stringstream ss (s);
+    string token;
+    while (getline (ss, token, ' '))
+    {
+        vect.push_back (token);
+    }
+}	
+
+
+
+// Máscara del valor de un campo de nBits: un valor negativo se extiende como mucho al tamaño de instrucción o a 32 bits
+// La usan compilarPlan y enlazarObjetos, para que un campo enlazado quede igual que ensamblado de una vez
+
+palabra128 mascaraCampo (int nBits, int tamanyoInstruccion)
+{
+    return mascaraPalabra<palabra128>(nBits) & mascaraPalabra<palabra128>(max(tamanyoInstruccion, 32));
+}
+
+
+// Compila la estructura de una instrucción de configuración en su plan de codificación
+// Las constantes de configuración de la estructura deben estar ya sustituidas por su valor
+// La cabecera de isa debe estar ya leída: el tamaño de instrucción limita los bits del valor que pasan a cada campo
+
+plan_instruccion compilarPlan (const string &nombre, const vector<string> &estructura, const configuracion_isa &isa)
+{
+    plan_instruccion plan;
+    plan.nombre = nombre;
+    plan.id = -1;
+    plan.base = 0;
+    plan.nBits = 0;
+    plan.nParametros = 1;                                                               // El nombre de la instrucción
+
+    for (int str = 0; str < estructura.size(); str++)
+    {
+        const string &elemento = estructura[str];
+        string bitsFijos = "";                                                          // Bits fijos del elemento (opcode o relleno)
+        int nBits;                                                                      // Número de bits que ocupa el elemento
+
+        if (str == 0)                                                                   // Es el opcode
+            bitsFijos = elemento;
+
+        else if (elemento == "")                                                        // Espacio repetido en la configuración
+            continue;
+
+        else if (elemento[0] == CH_CONSTANTE_CONFIG)                                    // Es una constante (relleno)
+            bitsFijos = elemento.substr(1);
+
+        else                                                                            // Es un operando
+        {
+            campo_instruccion campo;
+
+            if (elemento[0] == CH_ETIQUETA_CONFIG)                                      // Es una etiqueta o un valor
+            {
+                campo.tipo = isa.saltoRelativo && elemento[1] == CH_ETIQUETA_CONFIG ? CAMPO_RELATIVO : CAMPO_ETIQUETA;
+                campo.nBits = count (elemento.begin(), elemento.end(), CH_VARIABLE_CONFIG);
+            }
+            else                                                                        // Es un parámetro normal
+            {
+                size_t inicioNumero = elemento.find(CH_VARIABLE_CONFIG);                // Posición del primer caracter del número
+                size_t finNumero = elemento.find_last_of(CH_VARIABLE_CONFIG);           // Posición del último caracter del número
+
+                if (inicioNumero == string::npos)
+                {
+                    exception_wrong_config_syntax exc ("El parametro " + elemento + " de la instruccion " + nombre + " no tiene bits variables");
+                    throw exc;
+                }
+
+                campo.tipo = CAMPO_PARAMETRO;
+                campo.nBits = finNumero - inicioNumero + 1;
+                campo.prefijo = elemento.substr(0, inicioNumero);
+                campo.sufijo = elemento.substr(finNumero + 1);
+            }
+
+            campo.mascara = mascaraCampo (campo.nBits, isa.tamanyoInstruccion);
+            campo.desplazamiento = plan.nBits;                                          // Provisionalmente, bits anteriores al campo
+            plan.campos.push_back(campo);
+            plan.nParametros++;
+
+            nBits = campo.nBits;
+        }
+
+        if (str == 0 || elemento[0] == CH_CONSTANTE_CONFIG)
+        {
+            if (bitsFijos.find_first_not_of("01") != string::npos)
+            {
+                exception_wrong_config_syntax exc ("La codificacion " + bitsFijos + " de la instruccion " + nombre + " no es binaria");
+                throw exc;
+            }
+
+            nBits = bitsFijos.size();
+        }
+
+        if (plan.nBits + nBits > MAX_BITS_CODIFICACION)
+        {
+            exception_wrong_config_syntax exc ("La instruccion " + nombre + " ocupa mas de " + std::to_string(MAX_BITS_CODIFICACION) + " bits");
+            throw exc;
+        }
+
+        plan.base = plan.base << nBits;                                                 // Hace hueco al elemento
+        for (int b = 0; b < bitsFijos.size(); b++)                                      // Coloca los bits fijos
+            if (bitsFijos[b] == '1')
+                plan.base |= palabra128(1) << (bitsFijos.size() - 1 - b);
+
+        plan.nBits += nBits;
+    }
+
+    for (campo_instruccion &campo : plan.campos)                                        // Coloca cada campo contando desde el bit de menor peso
+        campo.desplazamiento = plan.nBits - campo.desplazamiento - campo.nBits;
+
+    return plan;
+}
+
+
+// Tiempo en milisegundos desde inicio
+double milisegundosDesde (chrono::steady_clock::time_point inicio)
+{
+    return chrono::duration<double, milli> (chrono::steady_clock::now() - inicio).count();
+}
+
+
+// Proyecta en memoria el fichero ruta. Un fichero vacío se abre sin proyectarlo
+
+fichero_mapeado::fichero_mapeado (const char *ruta)
+{
+    datos = nullptr;
+    tamanyo = 0;
+    abierto = false;
+    fichero = nullptr;
+    proyeccion = nullptr;
+
+#ifdef _WIN32
+    fichero = CreateFileA (ruta, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (fichero == INVALID_HANDLE_VALUE)
+        return;
+
+    LARGE_INTEGER tam;
+    GetFileSizeEx ((HANDLE) fichero, &tam);
+    tamanyo = tam.QuadPart;
+    abierto = true;
+
+    if (tamanyo > 0)
+    {
+        proyeccion = CreateFileMappingA ((HANDLE) fichero, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (proyeccion != NULL)
+            datos = (const char *) MapViewOfFile ((HANDLE) proyeccion, FILE_MAP_READ, 0, 0, 0);
+        abierto = datos != nullptr;
+    }
+#else
+    int fd = open (ruta, O_RDONLY);
+    if (fd < 0)
+        return;
+
+    struct stat info;
+    if (fstat (fd, &info) == 0)
+    {
+        tamanyo = info.st_size;
+        abierto = true;
+
+        if (tamanyo > 0)
+        {
+            void *p = mmap (nullptr, tamanyo, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED)
+            {
+                datos = (const char *) p;
+                madvise (p, tamanyo, MADV_SEQUENTIAL);
+            }
+            abierto = datos != nullptr;
+        }
+    }
+
+    close (fd);
+#endif
+}
+
+fichero_mapeado::~fichero_mapeado ()
+{
+#ifdef _WIN32
+    if (datos != nullptr) UnmapViewOfFile (datos);
+    if (proyeccion != NULL) CloseHandle ((HANDLE) proyeccion);
+    if (fichero != nullptr && fichero != INVALID_HANDLE_VALUE) CloseHandle ((HANDLE) fichero);
+#else
+    if (datos != nullptr) munmap ((void *) datos, tamanyo);
+#endif
+}
+
+
+// Lee la cadena entre comillas de una directiva, que empieza en token y puede tener espacios y ';'
+// Admite las secuencias \n, \t, \r, \0, \\ y \". Tras la comilla final solo puede haber un comentario
+
+string leerCadena (const lexer &lex, string_view token, string_view directiva, int i_linea)
+{
+    const char *p = token.data();
+    if (*p != '"')
+        throw exception_wrong_directive (string(directiva), i_linea, "se esperaba una cadena entre comillas");
+
+    string cadena;
+    for (p++; p < lex.finLinea && *p != '"'; p++)
+    {
+        if (*p != '\\')
+        {
+            cadena += *p;
+            continue;
+        }
+
+        if (++p == lex.finLinea)
+            break;
+
+        switch (*p)
+        {
+            case 'n':  cadena += '\n'; break;
+            case 't':  cadena += '\t'; break;
+            case 'r':  cadena += '\r'; break;
+            case '0':  cadena += '\0'; break;
+            case '\\': cadena += '\\'; break;
+            case '"':  cadena += '"';  break;
+            default:
+                throw exception_wrong_directive (string(directiva), i_linea, string("secuencia de escape desconocida \\") + *p);
+        }
+    }
+
+    if (p >= lex.finLinea)
+        throw exception_wrong_directive (string(directiva), i_linea, "falta la comilla final");
+
+    for (p++; p < lex.finLinea && *p != ';'; p++)
+        if (!lexer::esSeparador(*p))
+            throw exception_wrong_directive (string(directiva), i_linea, "sobra texto tras la cadena");
+
+    return cadena;
+}
+
+
+// Lee una directiva
+// .org N salta a la dirección N, que no puede ser anterior al PC; .align N salta al siguiente múltiplo de N;
+// .space N reserva N palabras sin contenido; .fill N [valor] ocupa N palabras con valor, 0 si no se indica;
+// .word ocupa una palabra por valor; .ascii una por caracter; .incbin proyecta el fichero y ocupa una palabra
+// por cada TAMANYO_INSTRUCCION / 8 bytes, con la última completada con ceros
+
+bool leerDirectiva (const lexer &lex, int tamanyoInstruccion, int i_linea, int &i_PC, relleno_memoria &relleno)
+{
+    const vector<string_view> &tokens = lex.tokens;
+    string_view directiva = tokens[0];
+    bool cadena = directiva == ".ascii" || directiva == ".incbin";
+
+    if (directiva != ".org" && directiva != ".align" && directiva != ".fill" && directiva != ".space" && directiva != ".word" && !cadena)
+        return false;
+
+    if (tokens.size() < 2)
+        throw exception_wrong_directive (string(directiva), i_linea, directiva == ".word" ? "se esperaba al menos un valor" :
+                                                                     cadena ? "se esperaba una cadena entre comillas" : "se esperaba un numero");
+
+    size_t maxTokens = directiva == ".fill" ? 3 : 2;
+    if (!cadena && directiva != ".word" && tokens.size() > maxTokens)
+        throw exception_wrong_directive (string(directiva), i_linea, directiva == ".fill" ? "se esperaba .fill N [valor]" : "se esperaba un unico numero");
+
+    relleno = relleno_memoria ();
+    relleno.direccion = i_PC;
+    relleno.hueco = directiva == ".org" || directiva == ".align" || directiva == ".space";
+
+    if (directiva == ".word")
+    {
+        for (size_t t = 1; t < tokens.size(); t++)
+            relleno.valores.push_back (to_decimal (tokens[t], i_linea));
+    }
+    else if (directiva == ".ascii")
+    {
+        for (unsigned char c : leerCadena (lex, tokens[1], directiva, i_linea))
+            relleno.valores.push_back (c);
+    }
+    else if (directiva == ".incbin")
+    {
+        if (tamanyoInstruccion % 8 != 0)
+            throw exception_wrong_directive (string(directiva), i_linea, "el tamanyo de instruccion debe ser multiplo de 8");
+
+        string ruta = tokens[1][0] == '"' ? leerCadena (lex, tokens[1], directiva, i_linea) : string(tokens[1]);
+        if (tokens[1][0] != '"' && tokens.size() > 2)
+            throw exception_wrong_directive (string(directiva), i_linea, "las rutas con espacios van entre comillas");
+
+        auto fichero = make_shared<const fichero_mapeado> (ruta.c_str());
+        if (!fichero->is_open())
+            throw exception_wrong_directive (string(directiva), i_linea, "no se ha encontrado el archivo " + ruta);
+
+        size_t bytes = tamanyoInstruccion / 8;
+        size_t palabras = (fichero->contenido().size() + bytes - 1) / bytes;
+        if (palabras > (size_t) INT_MAX)
+            throw exception_wrong_directive (string(directiva), i_linea, "el archivo " + ruta + " es demasiado grande");
+
+        relleno.n = palabras;
+        relleno.binario = move (fichero);
+    }
+    else
+    {
+        int numero = to_decimal (tokens[1], i_linea);
+
+        if (directiva == ".org")
+        {
+            if (numero < i_PC)
+                throw exception_wrong_directive (string(directiva), i_linea, "la direccion " + to_string(numero) + " es anterior al PC actual " + to_string(i_PC));
+            relleno.n = numero - i_PC;
+        }
+        else if (directiva == ".align")
+        {
+            if (numero < 1)
+                throw exception_wrong_directive (string(directiva), i_linea, "la alineacion debe ser al menos 1");
+            relleno.n = (numero - i_PC % numero) % numero;
+        }
+        else
+        {
+            if (numero < 0)
+                throw exception_wrong_directive (string(directiva), i_linea, "el numero de palabras no puede ser negativo");
+            relleno.n = numero;
+            relleno.valor = tokens.size() == 3 ? to_decimal (tokens[2], i_linea) : 0;
+        }
+    }
+
+    if (!relleno.valores.empty())
+        relleno.n = relleno.valores.size();
+
+    if (relleno.n > INT_MAX - i_PC)
+        throw exception_wrong_directive (string(directiva), i_linea, "el PC supera " + to_string(INT_MAX));
+
+    i_PC += relleno.n;
+    return true;
+}
+
+
+// Lee una directiva .global
+
+bool leerGlobal (const lexer &lex, int i_linea, vector<pair<string_view, int>> *exportadas)
+{
+    if (lex.tokens.empty() || lex.tokens[0] != ".global")
+        return false;
+
+    if (lex.tokens.size() < 2)
+        throw exception_wrong_directive (".global", i_linea, "se esperaba al menos una etiqueta");
+
+    if (exportadas != nullptr)
+        for (size_t t = 1; t < lex.tokens.size(); t++)
+            exportadas->push_back ({lex.tokens[t], i_linea});
+
+    return true;
+}
+
+
+// Indica si el texto puede tener directivas que fijan el PC
+// Basta con buscar los nombres: un falso positivo, en un comentario por ejemplo, solo hace que se lea en un hilo
+
+bool contieneDirectivas (string_view texto)
+{
+    return texto.find(".org") != string_view::npos || texto.find(".align") != string_view::npos;
+}
+
+
+// Etiqueta definida en un trozo del programa
+struct definicion_etiqueta
+{
+    string_view nombre;                              // Nombre de la etiqueta
+    int valor;                                       // Valor tras el '=', o PC dentro del trozo
+    bool esPosicion;                                 // La etiqueta marca una posición del código (no tiene '=')
+};
+
+// Resultado de la primera pasada sobre un trozo del programa
+// Las líneas y PCs son relativos al inicio del trozo hasta que se reubican
+struct trozo_programa
+{
+    string_view texto;                               // Texto del trozo, termina en fin de línea
+    unique_ptr<tabla_simbolos> simbolos;             // Etiquetas usadas por las instrucciones del trozo
+    unique_ptr<almacen_instrucciones> instrucciones; // Instrucciones del trozo
+    vector<definicion_etiqueta> etiquetas;           // Etiquetas del trozo, en orden de aparición
+    vector<pair<string_view, int>> exportadas;       // Etiquetas de .global y su línea
+    int nLineas;                                     // Número de líneas del trozo
+    int nPalabras;                                   // Palabras que ocupa el trozo, instrucciones y directivas
+    exception_ptr error;                             // Primer error encontrado en el trozo
+};
+
+
+// Lee un trozo del programa, añadiendo sus instrucciones a codigo y apuntando sus etiquetas
+// lineaBase y pcBase son la línea y el PC anteriores al trozo, solo se usan para los errores y las instrucciones
+
+void leerTrozo (trozo_programa &trozo, almacen_instrucciones &codigo, int lineaBase, int pcBase)
+{
+    lexer lex (trozo.texto);                                    // Analizador léxico sobre el trozo
+    int i_PC = pcBase;                                          // Lleva la cuenta del número de línea para almacenar etiquetas de salto
+    int i_numLinea = lineaBase;                                 // Lleva la cuenta del número de línea para mostrar errores
+    relleno_memoria relleno;                                    // Palabras de la última directiva
+
+    while (lex.siguienteLinea())                                // Lee la siguiente línea, ya sin comentarios
+    {
+        i_numLinea++;                                           // Incrementa el número de línea
+
+        if (leerGlobal (lex, i_numLinea, &trozo.exportadas))    // Exporta etiquetas, solo cuenta en los objetos
+            continue;
+
+        if (!lex.tokens.empty() && leerDirectiva (lex, codigo.obtenerIsa().tamanyoInstruccion, i_numLinea, i_PC, relleno))   // Es una directiva
+        {
+            codigo.anyadirRelleno (relleno);
+        }
+        else if (lex.tokens.size() > 1)                         // Es una instrucción 
+        {
+            if (i_PC == INT_MAX)                                                // La instrucción acabaría tras el último PC
+                throw exception_pc_overflow (string(lex.tokens[0]), i_numLinea);
+            codigo.anyadir (lex.tokens, i_numLinea, i_PC);                     // Añade la instrucción al código
+            i_PC++;                                                             // Incrementa el contador de instrucción (Para etiquetas de salto)
+        }   
+        else if (lex.tokens.size() == 1)                        // Es una etiqueta de salto
+        {
+            string_view etiqueta = lex.tokens[0];
+            size_t igual = etiqueta.find('=');
+
+            if (igual != string_view::npos)                                    // Almacena el valor de la etiqueta
+                trozo.etiquetas.push_back({etiqueta.substr(0, igual), to_decimal(etiqueta.substr(igual + 1), i_numLinea), false});
+            else
+                trozo.etiquetas.push_back({etiqueta, i_PC - pcBase, true});    // Almacena la posición de la etiqueta
+        }
+    }
+
+    trozo.nLineas = i_numLinea - lineaBase;
+    trozo.nPalabras = i_PC - pcBase;
+}
+
+
+// Primera pasada: tokeniza el programa, crea sus instrucciones y calcula las etiquetas
+// Con varios hilos el texto se parte en trozos por fin de línea que se leen a la vez;
+// después una suma de prefijos del número de palabras y líneas de cada trozo da su PC y línea inicial
+
+void primeraPasada (string_view texto, int nHilos, almacen_instrucciones &codigo, contexto_ensamblado &ctx)
+{
+    const size_t MIN_BYTES_TROZO = 1 << 16;                                     // Por debajo no compensa repartir el texto
+
+    int nTrozos = max<size_t> (1, min<size_t> (nHilos, texto.size() / MIN_BYTES_TROZO));
+    if (contieneDirectivas (texto))                                             // El PC tras .org y .align depende de todo lo anterior
+        nTrozos = 1;
+    vector<trozo_programa> trozos (nTrozos);
+
+    size_t inicio = 0;
+    for (int t = 0; t < nTrozos; t++)                                           // Parte el texto por finales de línea
+    {
+        size_t fin = texto.size();
+        if (t < nTrozos - 1)
+        {
+            fin = texto.find('\n', max(inicio, texto.size() * (t + 1) / nTrozos));
+            fin = fin == string_view::npos ? texto.size() : fin + 1;
+        }
+
+        trozos[t].texto = texto.substr(inicio, fin - inicio);
+        inicio = fin;
+    }
+
+    if (nTrozos == 1)                                                           // Lee directamente sobre el almacén final
+    {
+        leerTrozo (trozos[0], codigo, 0, 0);
+
+        auto inicio = chrono::steady_clock::now();
+        for (const definicion_etiqueta &etiqueta : trozos[0].etiquetas)
+            ctx.etiquetas.definir (ctx.etiquetas.internar(etiqueta.nombre), etiqueta.valor);
+
+        ctx.estadisticas.definiciones += trozos[0].etiquetas.size();
+        ctx.estadisticas.msEtiquetas += milisegundosDesde (inicio);
+        return;
+    }
+
+    vector<thread> hilos;
+    for (trozo_programa &trozo : trozos)
+    {
+        trozo.simbolos.reset (new tabla_simbolos ());
+        trozo.instrucciones.reset (new almacen_instrucciones (ctx.isa, texto.data(), *trozo.simbolos));
+
+        hilos.emplace_back ([&trozo] ()
+        {
+            try
+            {
+                leerTrozo (trozo, *trozo.instrucciones, 0, 0);
+            }
+            catch (...)
+            {
+                trozo.error = current_exception();
+            }
+        });
+    }
+
+    for (thread &hilo : hilos)
+        hilo.join();
+
+    int lineaBase = 0;
+    int pcBase = 0;
+
+    for (trozo_programa &trozo : trozos)                                        // Reubica los trozos en orden
+    {
+        if (trozo.error || trozo.nPalabras > INT_MAX - pcBase)                 // Repite el trozo con su línea y su PC reales para dar el error
+        {                                                                       // correcto, que también lo hay si el PC supera INT_MAX
+            trozo_programa repeticion;
+            tabla_simbolos simbolos;
+            almacen_instrucciones descartado (ctx.isa, texto.data(), simbolos);
+            repeticion.texto = trozo.texto;
+            leerTrozo (repeticion, descartado, lineaBase, pcBase);
+            rethrow_exception (trozo.error);
+        }
+
+        codigo.anyadir (*trozo.instrucciones, lineaBase, pcBase);
+        trozo.instrucciones.reset ();                                           // Libera el almacén del trozo
+        trozo.simbolos.reset ();
+
+        auto inicio = chrono::steady_clock::now();
+        for (const definicion_etiqueta &etiqueta : trozo.etiquetas)
+            ctx.etiquetas.definir (ctx.etiquetas.internar(etiqueta.nombre), etiqueta.esPosicion ? etiqueta.valor + pcBase : etiqueta.valor);
+
+        ctx.estadisticas.definiciones += trozo.etiquetas.size();
+        ctx.estadisticas.msEtiquetas += milisegundosDesde (inicio);
+
+        lineaBase += trozo.nLineas;
+        pcBase += trozo.nPalabras;
+    }
+}
+
+
+// Lee la configuración: la cabecera con el formato de salida y después las constantes y las instrucciones
+// Deja los planes de codificación en isa.planes
+
+void leerConfiguracion (istream &f_config, configuracion_isa &isa)
+{
+    string linea;                                                               // Variable de lectura
+
+    leerLinea (f_config, linea);                                                // Lee la primera línea del fichero de configuración
+
+    if (linea == "HEX") isa.hexOut = true;                                        // Salida en hexadecimal
+    else if (linea == "BIN") isa.hexOut = false;                                  // Salida en binario
+    else                                                                        // Sintaxis incorrecta
+    {
+        exception_wrong_config_syntax exc ("La primera linea debe ser HEX o BIN");
+        throw exc;
+    }
+
+    leerLinea (f_config, linea);                                                // Lee la segunda línea del fichero de configuración
+
+    if (linea == "LOGISIM_OUT")                                                 // Activa la salida para logisim
+    {
+        isa.logisimOut = true;
+        leerLinea (f_config, linea);                                            // Lee la siguiente línea del fichero de configuración
+    }
+    else
+        isa.logisimOut = false;
+
+    if (linea == "VHDL_OUT")                                                    // Activa la salida para VHDL
+    {
+        isa.vhdlOut = true;
+        leerLinea (f_config, linea);                                            // Lee la siguiente línea del fichero de configuración
+    }
+    else 
+        isa.vhdlOut = false;
+
+    if (linea == "SALTO_RELATIVO")                                              // Activa los saltos relativos a PC
+    {
+        isa.saltoRelativo = true;
+        leerLinea (f_config, linea);                                            // Lee la siguiente línea del fichero de configuración
+    }
+    else
+        isa.saltoRelativo = false;
+
+    if (linea.compare(0, 20, "TAMANYO_INSTRUCCION=") == 0)                      // Cambia el tamaño de instrucción
+    {
+        size_t fin;
+        try
+        {
+            isa.tamanyoInstruccion = stoi(linea.substr(20), &fin);
+        }
+        catch (const std::exception &)
+        {
+            fin = 0;
+        }
+
+        if (fin == 0 || fin != linea.size() - 20 || isa.tamanyoInstruccion < 1 || isa.tamanyoInstruccion > MAX_BITS_CODIFICACION)
+        {
+            exception_wrong_config_syntax exc ("El tamanyo de instruccion debe ser un numero entre 1 y " + std::to_string(MAX_BITS_CODIFICACION));
+            throw exc;
+        }
+        leerLinea (f_config, linea);                                            // Lee la siguiente línea del fichero de configuración
+    }
+
+    while (f_config)
+    {
+        if (linea != "")
+        {
+            if (linea[0] == CH_CONSTANTE_CONFIG)                                                        // Es una constante de configuración
+            {
+                int id = isa.constantes.internar(linea.substr(0, linea.find('=')));                     // Añade el valor tras el '=' a la tabla de constantes
+                isa.valores.resize(isa.constantes.size());
+                isa.valores[id] = linea.substr(linea.find('=') + 1);
+            }
+            else
+            {
+                int pos1 = linea.find("<");                                                                 // Posición del inicio de los bits de instrucción
+                int pos2 = linea.find(">");                                                                 // Posición del final de los bits de instrucción
+                string nombre = linea.substr(0, pos1);                                                      // Nombre de la instrucción
+                string bits = linea.substr(pos1 + 1, pos2 - (pos1 + 1));                                    // Bits de operación
+
+                vector<string> estructura;                                                                  // Vector de tokens de la instrucción
+                bits = bits + linea.substr(pos2 + 1);                                                       // Añade los bits de la instrucción
+
+                stringToVector(bits, estructura);                                                           // Tokeniza la estructura de la instrucción
+
+                for (string &str : estructura)                                                              // Transforma las etiquetas de configuración en su valor 
+                {
+                    if (str[0] == CH_CONSTANTE_CONFIG                                                       // Es una etiqueta interna de configuración
+                        && 
+                        count(str.begin(), str.end(), '0') 
+                        + 
+                        count(str.begin(), str.end(), '1') 
+                        + 
+                        1
+                        !=  
+                        str.size())                                 
+                    {
+                        int id = isa.constantes.buscar(str);
+                        if (id < 0)                                                                         // No existe la etiqueta
+                        {
+                            exception_wrong_config_syntax exc ("La constante " + str + " no existe");
+                            throw exc;
+                        }
+
+                        str = isa.valores[id];                                                                // Cambia el nombre de la etiqueta por su valor
+                    }
+                }
+
+                plan_instruccion plan = compilarPlan(nombre, estructura, isa);                              // Compila la estructura de la instrucción
+
+                plan.id = isa.instrucciones.internar(nombre);                                                // Una redefinición conserva el id
+                if (plan.id > MAX_ID_INSTRUCCION)
+                {
+                    exception_wrong_config_syntax exc ("Demasiadas instrucciones en la configuracion");
+                    throw exc;
+                }
+
+                isa.planes.resize(isa.instrucciones.size());
+                isa.planes[plan.id] = plan;                                                                 // Añade el plan a la tabla de instrucciones
+            }
+        }
+
+        leerLinea (f_config, linea);                                                          // Lee la siguiente línea del fichero de configuración
+    }
+}
+
+
+
+// Carga en isa, que debe estar vacía, la configuración del texto de un fichero de configuración
+
+void cargarConfiguracion (string_view texto, configuracion_isa &isa)
+{
+    istringstream f_config {string (texto)};
+    leerConfiguracion (f_config, isa);
+
+#ifdef CUMPILADOR_ISA
+    isa.fija = texto == isa_fija::CONFIGURACION && (int) isa.planes.size() == isa_fija::N_INSTRUCCIONES;
+#endif
+}
+
+configuracion_isa::configuracion_isa (string_view texto)
+{
+    cargarConfiguracion (texto, *this);
+}
+
+
+// Juego de instrucciones compilado
+
+const char MAGIA_ISA[8] = {'C', 'U', 'M', 'P', 'I', 'S', 'A', '\0'};   // Inicio de una imagen de juego de instrucciones
+const uint32_t VERSION_ISA = 1;                                      // Se cambia si cambia el formato o el hash de la tabla
+
+// Cabecera de la imagen; las posiciones son en bytes desde su inicio y están alineadas a 8
+struct cabecera_isa
+{
+    char magia[8];
+    uint32_t version;
+    uint32_t bytes;                                  // Tamaño de la imagen
+    uint64_t clave;                                  // Hash del texto de la configuración
+    uint8_t hexOut, logisimOut, vhdlOut, saltoRelativo;
+    int32_t tamanyoInstruccion;
+    uint32_t nHuecos, nPlanes, nCampos, bytesTextos; // Elementos de cada tabla
+    uint32_t huecos, planes, campos, textos;         // Posición de cada tabla
+};
+
+// Plan de una instrucción en la imagen, en la posición de su id
+struct plan_isa
+{
+    uint64_t baseAlta, baseBaja;
+    int32_t nBits;
+    int32_t nParametros;
+    uint32_t primerCampo, nCampos;                   // Campos del plan en la tabla de campos
+    uint32_t nombre, longitudNombre;                 // Nombre en la tabla de textos
+};
+
+// Campo de una instrucción en la imagen
+struct campo_isa
+{
+    uint64_t mascaraAlta, mascaraBaja;
+    int32_t tipo;
+    int32_t desplazamiento;
+    int32_t nBits;
+    uint32_t prefijo, longitudPrefijo;               // Textos en la tabla de textos
+    uint32_t sufijo, longitudSufijo;
+    uint32_t reservado;
+};
+
+
+// Escribe la imagen: la cabecera y las tablas de huecos, planes, campos y textos, cada una alineada a 8
+
+void escribirIsaCompilada (ostream &salida, const configuracion_isa &isa, string_view textoConfig)
+{
+    string textos;
+    auto anyadirTexto = [&textos](const string &texto, uint32_t &posicion, uint32_t &longitud)
+    {
+        posicion = textos.size();
+        longitud = texto.size();
+        textos += texto;
+    };
+
+    vector<plan_isa> planes (isa.planes.size());
+    vector<campo_isa> campos;
+    for (size_t i = 0; i < isa.planes.size(); i++)
+    {
+        const plan_instruccion &plan = isa.planes[i];
+        planes[i] = {plan.base.alta, plan.base.baja, plan.nBits, plan.nParametros, (uint32_t) campos.size(), (uint32_t) plan.campos.size(), 0, 0};
+        anyadirTexto (plan.nombre, planes[i].nombre, planes[i].longitudNombre);
+
+        for (const campo_instruccion &c : plan.campos)
+        {
+            campo_isa campo = {c.mascara.alta, c.mascara.baja, c.tipo, c.desplazamiento, c.nBits, 0, 0, 0, 0, 0};
+            anyadirTexto (c.prefijo, campo.prefijo, campo.longitudPrefijo);
+            anyadirTexto (c.sufijo, campo.sufijo, campo.longitudSufijo);
+            campos.push_back (campo);
+        }
+    }
+
+    const vector<tabla_simbolos::hueco> &huecos = isa.instrucciones.tabla();
+    auto alinear = [](size_t n) { return (uint32_t) ((n + 7) & ~(size_t) 7); };
+
+    cabecera_isa cabecera = {};
+    memcpy (cabecera.magia, MAGIA_ISA, sizeof(MAGIA_ISA));
+    cabecera.version = VERSION_ISA;
+    cabecera.clave = hashTexto (textoConfig);
+    cabecera.hexOut = isa.hexOut;
+    cabecera.logisimOut = isa.logisimOut;
+    cabecera.vhdlOut = isa.vhdlOut;
+    cabecera.saltoRelativo = isa.saltoRelativo;
+    cabecera.tamanyoInstruccion = isa.tamanyoInstruccion;
+    cabecera.nHuecos = huecos.size();
+    cabecera.nPlanes = planes.size();
+    cabecera.nCampos = campos.size();
+    cabecera.bytesTextos = textos.size();
+    cabecera.huecos = alinear (sizeof(cabecera));
+    cabecera.planes = alinear (cabecera.huecos + huecos.size() * sizeof(huecos[0]));
+    cabecera.campos = alinear (cabecera.planes + planes.size() * sizeof(plan_isa));
+    cabecera.textos = alinear (cabecera.campos + campos.size() * sizeof(campo_isa));
+    cabecera.bytes = alinear (cabecera.textos + textos.size());
+
+    vector<char> imagen (cabecera.bytes, 0);
+    memcpy (imagen.data(), &cabecera, sizeof(cabecera));
+    memcpy (imagen.data() + cabecera.huecos, huecos.data(), huecos.size() * sizeof(huecos[0]));
+    memcpy (imagen.data() + cabecera.planes, planes.data(), planes.size() * sizeof(plan_isa));
+    memcpy (imagen.data() + cabecera.campos, campos.data(), campos.size() * sizeof(campo_isa));
+    memcpy (imagen.data() + cabecera.textos, textos.data(), textos.size());
+    salida.write (imagen.data(), imagen.size());
+}
+
+
+// Carga la imagen, comprobando antes de tocar isa que es de este texto y que las tablas están dentro y cuadran
+// Las tablas se copian en bloque; solo se recorren los campos para comprobarlos
+
+bool cargarIsaCompilada (string_view imagen, string_view textoConfig, configuracion_isa &isa)
+{
+    cabecera_isa cabecera;
+    if (imagen.size() < sizeof(cabecera) || !isa.planes.empty())
+        return false;
+
+    memcpy (&cabecera, imagen.data(), sizeof(cabecera));
+    if (memcmp (cabecera.magia, MAGIA_ISA, sizeof(MAGIA_ISA)) != 0 || cabecera.version != VERSION_ISA
+        || cabecera.bytes != imagen.size() || cabecera.clave != hashTexto (textoConfig))
+        return false;
+
+    auto dentro = [&imagen](uint64_t posicion, uint64_t bytes) { return posicion <= imagen.size() && bytes <= imagen.size() - posicion; };
+    if (!dentro (cabecera.huecos, (uint64_t) cabecera.nHuecos * sizeof(tabla_simbolos::hueco))
+        || !dentro (cabecera.planes, (uint64_t) cabecera.nPlanes * sizeof(plan_isa))
+        || !dentro (cabecera.campos, (uint64_t) cabecera.nCampos * sizeof(campo_isa))
+        || !dentro (cabecera.textos, cabecera.bytesTextos) || cabecera.nPlanes > MAX_ID_INSTRUCCION + 1
+        || cabecera.tamanyoInstruccion <= 0 || cabecera.tamanyoInstruccion > MAX_BITS_CODIFICACION)
+        return false;
+
+    vector<plan_isa> planes (cabecera.nPlanes);                                // Copias alineadas, por si la imagen no lo está
+    vector<campo_isa> campos (cabecera.nCampos);
+    vector<tabla_simbolos::hueco> huecos (cabecera.nHuecos);
+    memcpy (planes.data(), imagen.data() + cabecera.planes, planes.size() * sizeof(plan_isa));
+    memcpy (campos.data(), imagen.data() + cabecera.campos, campos.size() * sizeof(campo_isa));
+    memcpy (huecos.data(), imagen.data() + cabecera.huecos, huecos.size() * sizeof(huecos[0]));
+    string_view textos = imagen.substr (cabecera.textos, cabecera.bytesTextos);
+
+    auto textoValido = [&textos](uint32_t posicion, uint32_t longitud) { return posicion <= textos.size() && longitud <= textos.size() - posicion; };
+    vector<string_view> nombres (planes.size());
+    for (size_t i = 0; i < planes.size(); i++)
+    {
+        const plan_isa &plan = planes[i];
+        if (!textoValido (plan.nombre, plan.longitudNombre) || plan.nBits < 0 || plan.nBits > MAX_BITS_CODIFICACION
+            || plan.primerCampo > campos.size() || plan.nCampos > campos.size() - plan.primerCampo
+            || plan.nParametros != (int32_t) plan.nCampos + 1)
+            return false;
+
+        for (uint32_t c = plan.primerCampo; c < plan.primerCampo + plan.nCampos; c++)
+        {
+            const campo_isa &campo = campos[c];
+            if (campo.tipo < CAMPO_PARAMETRO || campo.tipo > CAMPO_RELATIVO || campo.nBits < 0 || campo.desplazamiento < 0
+                || campo.desplazamiento + campo.nBits > plan.nBits
+                || !textoValido (campo.prefijo, campo.longitudPrefijo) || !textoValido (campo.sufijo, campo.longitudSufijo))
+                return false;
+        }
+        nombres[i] = textos.substr (plan.nombre, plan.longitudNombre);
+    }
+
+    if (!isa.instrucciones.cargar (huecos.data(), huecos.size(), nombres))
+        return false;
+
+    isa.hexOut = cabecera.hexOut;
+    isa.logisimOut = cabecera.logisimOut;
+    isa.vhdlOut = cabecera.vhdlOut;
+    isa.saltoRelativo = cabecera.saltoRelativo;
+    isa.tamanyoInstruccion = cabecera.tamanyoInstruccion;
+
+    isa.planes.resize (planes.size());
+    for (size_t i = 0; i < planes.size(); i++)
+    {
+        plan_instruccion &plan = isa.planes[i];
+        plan.nombre = string (nombres[i]);
+        plan.id = i;
+        plan.base = palabra128 (planes[i].baseAlta, planes[i].baseBaja);
+        plan.nBits = planes[i].nBits;
+        plan.nParametros = planes[i].nParametros;
+        plan.campos.resize (planes[i].nCampos);
+
+        for (uint32_t c = 0; c < planes[i].nCampos; c++)
+        {
+            const campo_isa &origen = campos[planes[i].primerCampo + c];
+            campo_instruccion &campo = plan.campos[c];
+            campo.tipo = (tipo_campo) origen.tipo;
+            campo.desplazamiento = origen.desplazamiento;
+            campo.nBits = origen.nBits;
+            campo.mascara = palabra128 (origen.mascaraAlta, origen.mascaraBaja);
+            campo.prefijo = string (textos.substr (origen.prefijo, origen.longitudPrefijo));
+            campo.sufijo = string (textos.substr (origen.sufijo, origen.longitudSufijo));
+        }
+    }
+
+#ifdef CUMPILADOR_ISA
+    isa.fija = textoConfig == isa_fija::CONFIGURACION && (int) isa.planes.size() == isa_fija::N_INSTRUCCIONES;
+#endif
+    return true;
+}
+
+
+// Ensambla el texto de un programa con la configuración isa, sin ficheros ni estado global
+// Los errores se lanzan como excepciones, igual que al ensamblar un fichero
+
+programa_ensamblado ensamblarPrograma (const configuracion_isa &isa, string_view texto, int nHilos)
+{
+    contexto_ensamblado ctx (isa);
+    almacen_instrucciones codigo (isa, texto.data(), ctx.etiquetas);
+    primeraPasada (texto, nHilos, codigo, ctx);
+
+    programa_ensamblado programa;
+    programa.palabras.resize (codigo.size());
+    programa.nBits.resize (codigo.size());
+    programa.lineas.resize (codigo.size());
+
+    const size_t TAMANYO_BLOQUE = 4096;                                         // Instrucciones que codifica cada hilo de una vez
+    size_t nBloques = (codigo.size() + TAMANYO_BLOQUE - 1) / TAMANYO_BLOQUE;
+    vector<exception_ptr> errores (nBloques);                                   // Error al codificar cada bloque
+    atomic<size_t> siguiente {0};                                               // Siguiente bloque libre
+
+    auto codificarBloques = [&] ()
+    {
+        for (size_t b = siguiente++; b < nBloques; b = siguiente++)
+        {
+            try
+            {
+                size_t inicio = b * TAMANYO_BLOQUE;
+                size_t n = min (TAMANYO_BLOQUE, codigo.size() - inicio);
+                codificarBloque (codigo, ctx.etiquetas, inicio, n, programa.palabras.data() + inicio, programa.nBits.data() + inicio);
+
+                for (size_t i = inicio; i < inicio + n; i++)
+                    programa.lineas[i] = codigo.lineas[i];
+            }
+            catch (...)
+            {
+                errores[b] = current_exception();
+            }
+        }
+    };
+
+    vector<thread> hilos;
+    for (size_t h = 1; h < min<size_t> (max (nHilos, 1), nBloques); h++)
+        hilos.emplace_back (codificarBloques);
+    codificarBloques ();
+
+    for (thread &hilo : hilos)
+        hilo.join();
+
+    for (exception_ptr &error : errores)                                        // El primer error del programa, como en un hilo
+        if (error)
+            rethrow_exception (error);
+
+    if (!codigo.rellenos.empty())                                               // Con directivas las direcciones ya no son el índice
+    {
+        programa.direcciones.resize (codigo.size());
+        for (size_t i = 0; i < codigo.size(); i++)
+            programa.direcciones[i] = codigo.pcs[i];
+        programa.rellenos = codigo.rellenos;
+    }
+
+    for (size_t id = 0; id < ctx.etiquetas.size(); id++)
+        if (ctx.etiquetas.definida(id))
+            programa.simbolos[string(ctx.etiquetas.nombre(id))] = ctx.etiquetas.direccion(id);
+
+    return programa;
+}
+
+
+// Escribe en salida las palabras de un programa ensamblado en el modo de salida dado
+
+void escribirPrograma (ostream &salida, const modo_salida &modo, const programa_ensamblado &programa)
+{
+    escritor_salida escritor (salida, modo);
+
+    size_t hechas = 0;
+    for (const relleno_memoria &relleno : programa.rellenos)                    // Intercala las palabras de las directivas
+    {
+        escritor.escribir (programa.palabras.data() + hechas, programa.nBits.data() + hechas, relleno.antesDe - hechas);
+        escritor.rellenar (relleno);
+        hechas = relleno.antesDe;
+    }
+
+    escritor.escribir (programa.palabras.data() + hechas, programa.nBits.data() + hechas, programa.palabras.size() - hechas);
+    escritor.terminar ();
+}
+
+
+// Formatea las palabras de un programa ensamblado en el modo de salida dado
+// Devuelve el contenido que tendría el fichero de salida
+
+string formatearPrograma (const modo_salida &modo, const programa_ensamblado &programa)
+{
+    ostringstream salida;
+    escribirPrograma (salida, modo, programa);
+    return salida.str();
+}
+
+
+// Objetos reubicables
+
+const char MAGIA_OBJETO[8] = {'C', 'U', 'M', 'P', 'O', 'B', 'J', 'T'};  // Inicio de un fichero objeto
+const uint32_t VERSION_OBJETO = 1;                                     // Se cambia si cambia el formato de los objetos
+
+
+// Huella de una configuración: el tamaño de instrucción y la codificación de cada instrucción
+
+uint64_t huellaConfiguracion (const configuracion_isa &isa)
+{
+    string texto = to_string (isa.tamanyoInstruccion);
+    for (const plan_instruccion &plan : isa.planes)
+    {
+        texto += "\n" + plan.nombre + " " + to_string (plan.nBits) + " " + to_string (plan.base.alta) + " " + to_string (plan.base.baja);
+        for (const campo_instruccion &campo : plan.campos)
+            texto += " " + to_string (campo.tipo) + ":" + to_string (campo.desplazamiento) + ":" + to_string (campo.nBits) + ":" + campo.prefijo + ":" + campo.sufijo;
+    }
+    return hashTexto (texto);
+}
+
+
+// Añade al objeto las palabras de una directiva: los huecos se apuntan aparte y los datos son palabras
+
+void anyadirDirectiva (objeto_ensamblado &objeto, const relleno_memoria &relleno, int tamanyoInstruccion, bool littleEndian)
+{
+    if (relleno.n <= 0)
+        return;
+
+    if (relleno.hueco)
+    {
+        objeto.antesDeHueco.push_back (objeto.palabras.size());
+        objeto.palabrasHueco.push_back (relleno.n);
+        return;
+    }
+
+    string_view bytes = relleno.binario ? relleno.binario->contenido() : string_view ();
+    const int nBytes = tamanyoInstruccion / 8;
+    palabra128 mascara = mascaraPalabra<palabra128>(tamanyoInstruccion);
+
+    for (size_t k = 0; k < (size_t) relleno.n; k++)
+    {
+        palabra128 palabra;
+        if (relleno.binario)                                                    // Como en escritor_salida::escribirDatos
+        {
+            for (int b = 0; b < nBytes && k * nBytes + b < bytes.size(); b++)
+                palabra |= palabra128 ((uint8_t) bytes[k * nBytes + b]) << (8 * (littleEndian ? b : nBytes - 1 - b));
+        }
+        else
+            palabra = extenderSigno<palabra128>(relleno.valores.empty() ? relleno.valor : relleno.valores[k]) & mascara;
+
+        objeto.palabras.push_back (palabra);
+        objeto.nBits.push_back (tamanyoInstruccion);
+        objeto.lineas.push_back (0);
+    }
+}
+
+
+// Ensambla un módulo a un objeto reubicable
+// Se lee en un solo hilo, porque hace falta saber qué etiquetas son posiciones
+
+objeto_ensamblado ensamblarObjeto (const configuracion_isa &isa, string_view texto, bool littleEndian)
+{
+    contexto_ensamblado ctx (isa);
+    almacen_instrucciones codigo (isa, texto.data(), ctx.etiquetas);
+    trozo_programa trozo;
+    trozo.texto = texto;
+    leerTrozo (trozo, codigo, 0, 0);
+
+    for (const definicion_etiqueta &etiqueta : trozo.etiquetas)
+        ctx.etiquetas.definir (ctx.etiquetas.internar(etiqueta.nombre), etiqueta.valor);
+
+    for (const pair<string_view, int> &exportada : trozo.exportadas)
+        if (!ctx.etiquetas.definida (ctx.etiquetas.internar(exportada.first)))
+            throw exception_wrong_directive (".global", exportada.second, "la etiqueta " + string(exportada.first) + " no esta definida");
+
+    objeto_ensamblado objeto;
+    objeto.huella = huellaConfiguracion (isa);
+    objeto.atributos.resize (ctx.etiquetas.size(), 0);
+    objeto.valores.resize (ctx.etiquetas.size(), 0);
+
+    for (size_t id = 0; id < ctx.etiquetas.size(); id++)
+    {
+        objeto.simbolos.emplace_back (ctx.etiquetas.nombre(id));
+        if (ctx.etiquetas.definida(id))
+            objeto.valores[id] = ctx.etiquetas.direccion(id);
+    }
+
+    for (const definicion_etiqueta &etiqueta : trozo.etiquetas)                // La última definición es la que vale
+        objeto.atributos[ctx.etiquetas.buscar(etiqueta.nombre)] = SIMBOLO_DEFINIDO | (etiqueta.esPosicion ? SIMBOLO_POSICION : 0);
+
+    for (const pair<string_view, int> &exportada : trozo.exportadas)
+        objeto.atributos[ctx.etiquetas.buscar(exportada.first)] |= SIMBOLO_GLOBAL;
+
+    vector<int> pendientes;
+    size_t r = 0;
+
+    for (size_t i = 0; i <= codigo.size(); i++)
+    {
+        for (; r < codigo.rellenos.size() && codigo.rellenos[r].antesDe == i; r++)
+            anyadirDirectiva (objeto, codigo.rellenos[r], isa.tamanyoInstruccion, littleEndian);
+
+        if (i == codigo.size())
+            break;
+
+        instruccion inst (codigo, i);
+        pendientes.clear();
+        palabra128 palabra = inst.codificar<palabra128>(ctx.etiquetas, &pendientes);   // Las externas quedan a 0
+
+        const plan_instruccion &plan = codigo.plan(i);
+        for (int c = 0; c < plan.campos.size(); c++)
+        {
+            const campo_instruccion &campo = plan.campos[c];
+            int etiqueta = codigo.simbolo(i, c);
+            bool relativo = campo.tipo == CAMPO_RELATIVO;
+
+            if (etiqueta < 0)                                                   // Es un número
+                continue;
+            if (ctx.etiquetas.definida(etiqueta) && relativo == ((objeto.atributos[etiqueta] & SIMBOLO_POSICION) != 0))
+                continue;                                                       // Un salto relativo a una posición, o un valor absoluto, no cambian
+
+            palabra = palabra & ~(campo.mascara << campo.desplazamiento);
+            objeto.reubicaciones.push_back ({(uint32_t) objeto.palabras.size(), etiqueta, (uint8_t) campo.desplazamiento, (uint8_t) campo.nBits, relativo});
+        }
+
+        objeto.palabras.push_back (palabra);
+        objeto.nBits.push_back (inst.bits());
+        objeto.lineas.push_back (inst.linea());
+    }
+
+    return objeto;
+}
+
+
+// Escribe un objeto: la cabecera, la huella y cada vector con su número de elementos
+
+void escribirObjeto (ostream &salida, const objeto_ensamblado &objeto)
+{
+    vector<char> nombres;                                                       // Nombres de los símbolos, separados por '\0'
+    for (const string &nombre : objeto.simbolos)
+    {
+        nombres.insert (nombres.end(), nombre.begin(), nombre.end());
+        nombres.push_back ('\0');
+    }
+
+    salida.write (MAGIA_OBJETO, sizeof(MAGIA_OBJETO));
+    salida.write ((const char *) &VERSION_OBJETO, sizeof(VERSION_OBJETO));
+    salida.write ((const char *) &objeto.huella, sizeof(objeto.huella));
+    escribirVector (salida, objeto.palabras);
+    escribirVector (salida, objeto.nBits);
+    escribirVector (salida, objeto.lineas);
+    escribirVector (salida, objeto.antesDeHueco);
+    escribirVector (salida, objeto.palabrasHueco);
+    escribirVector (salida, nombres);
+    escribirVector (salida, objeto.valores);
+    escribirVector (salida, objeto.atributos);
+    escribirVector (salida, objeto.reubicaciones);
+}
+
+
+// Lee un objeto, comprobando que todo cuadra para que enlazarObjetos no salga de los vectores
+
+objeto_ensamblado leerObjeto (string_view contenido, const string &nombre)
+{
+    objeto_ensamblado objeto;
+    objeto.nombre = nombre;
+    const char *p = contenido.data(), *fin = contenido.data() + contenido.size();
+    exception_link incorrecto ("El fichero " + nombre + " no es un objeto de cumpilador o esta incompleto");
+
+    uint32_t version;
+    if (contenido.size() < sizeof(MAGIA_OBJETO) + sizeof(version) + sizeof(objeto.huella) || memcmp (p, MAGIA_OBJETO, sizeof(MAGIA_OBJETO)) != 0)
+        throw incorrecto;
+
+    p += sizeof(MAGIA_OBJETO);
+    memcpy (&version, p, sizeof(version));
+    p += sizeof(version);
+    memcpy (&objeto.huella, p, sizeof(objeto.huella));
+    p += sizeof(objeto.huella);
+    if (version != VERSION_OBJETO)
+        throw exception_link ("El objeto " + nombre + " es de otra version de cumpilador");
+
+    vector<char> nombres;
+    if (!leerVector (p, fin, objeto.palabras) || !leerVector (p, fin, objeto.nBits) || !leerVector (p, fin, objeto.lineas)
+        || !leerVector (p, fin, objeto.antesDeHueco) || !leerVector (p, fin, objeto.palabrasHueco) || !leerVector (p, fin, nombres)
+        || !leerVector (p, fin, objeto.valores) || !leerVector (p, fin, objeto.atributos) || !leerVector (p, fin, objeto.reubicaciones))
+        throw incorrecto;
+
+    for (size_t inicio = 0; inicio < nombres.size(); )
+    {
+        size_t finNombre = find (nombres.begin() + inicio, nombres.end(), '\0') - nombres.begin();
+        objeto.simbolos.emplace_back (&nombres[inicio], finNombre - inicio);
+        inicio = finNombre + 1;
+    }
+
+    size_t n = objeto.palabras.size();
+    if (objeto.nBits.size() != n || objeto.lineas.size() != n || objeto.antesDeHueco.size() != objeto.palabrasHueco.size()
+        || objeto.valores.size() != objeto.simbolos.size() || objeto.atributos.size() != objeto.simbolos.size()
+        || !is_sorted (objeto.antesDeHueco.begin(), objeto.antesDeHueco.end()) || (!objeto.antesDeHueco.empty() && objeto.antesDeHueco.back() > n))
+        throw incorrecto;
+
+    for (uint8_t nBits : objeto.nBits)                                          // formatearPalabras no admite más anchura
+        if (nBits == 0 || nBits > MAX_BITS_CODIFICACION)
+            throw incorrecto;
+
+    for (int32_t palabras : objeto.palabrasHueco)                               // anyadirDirectiva no apunta huecos vacíos
+        if (palabras <= 0)
+            throw incorrecto;
+
+    for (const reubicacion &r : objeto.reubicaciones)
+        if (r.palabra >= n || r.simbolo < 0 || (size_t) r.simbolo >= objeto.simbolos.size() || r.desplazamiento + r.nBits > MAX_BITS_CODIFICACION)
+            throw incorrecto;
+
+    return objeto;
+}
+
+
+// Enlaza los objetos: los coloca uno tras otro, reúne sus símbolos globales y corrige sus reubicaciones
+
+programa_ensamblado enlazarObjetos (const configuracion_isa &isa, const vector<objeto_ensamblado> &objetos)
+{
+    uint64_t huella = huellaConfiguracion (isa);
+    programa_ensamblado programa;
+    vector<int> pcs;                                                            // PC de cada palabra del programa
+    vector<int> bases (objetos.size());                                         // PC inicial de cada objeto
+    vector<size_t> primeras (objetos.size());                                   // Primera palabra de cada objeto en el programa
+    map<string, size_t> definidoEn;                                             // Objeto que define cada símbolo global
+    long long pc = 0;
+
+    for (size_t o = 0; o < objetos.size(); o++)                                 // Coloca los objetos
+    {
+        const objeto_ensamblado &objeto = objetos[o];
+        if (objeto.huella != huella)
+            throw exception_link ("El objeto " + objeto.nombre + " se ensamblo con otra configuracion");
+
+        bases[o] = pc;
+        primeras[o] = programa.palabras.size();
+        size_t h = 0;
+
+        for (size_t w = 0; w <= objeto.palabras.size(); w++)
+        {
+            for (; h < objeto.antesDeHueco.size() && objeto.antesDeHueco[h] == w; h++)
+            {
+                relleno_memoria hueco;
+                hueco.antesDe = programa.palabras.size();
+                hueco.direccion = pc;
+                hueco.n = objeto.palabrasHueco[h];
+                programa.rellenos.push_back (hueco);
+                pc += hueco.n;
+            }
+
+            if (pc > INT_MAX)
+                throw exception_link ("El programa enlazado supera " + to_string(INT_MAX) + " palabras en el objeto " + objeto.nombre);
+            if (w == objeto.palabras.size())
+                break;
+
+            programa.palabras.push_back (objeto.palabras[w]);
+            programa.nBits.push_back (objeto.nBits[w]);
+            programa.lineas.push_back (objeto.lineas[w]);
+            pcs.push_back (pc++);
+        }
+
+        for (size_t s = 0; s < objeto.simbolos.size(); s++)                     // Reúne los símbolos globales
+        {
+            if (!(objeto.atributos[s] & SIMBOLO_GLOBAL))
+                continue;
+
+            auto definido = definidoEn.find (objeto.simbolos[s]);
+            if (definido != definidoEn.end())
+                throw exception_link ("El simbolo global \"" + objeto.simbolos[s] + "\" se define en " + objetos[definido->second].nombre + " y en " + objeto.nombre);
+
+            definidoEn[objeto.simbolos[s]] = o;
+            programa.simbolos[objeto.simbolos[s]] = objeto.valores[s] + (objeto.atributos[s] & SIMBOLO_POSICION ? bases[o] : 0);
+        }
+    }
+
+    for (size_t o = 0; o < objetos.size(); o++)                                 // Corrige las reubicaciones
+    {
+        const objeto_ensamblado &objeto = objetos[o];
+
+        for (const reubicacion &r : objeto.reubicaciones)
+        {
+            int valor;
+            uint8_t atributos = objeto.atributos[r.simbolo];
+
+            if (atributos & SIMBOLO_DEFINIDO)
+                valor = objeto.valores[r.simbolo] + (atributos & SIMBOLO_POSICION ? bases[o] : 0);
+            else
+            {
+                auto global = programa.simbolos.find (objeto.simbolos[r.simbolo]);
+                if (global == programa.simbolos.end())
+                    throw exception_link ("El simbolo \"" + objeto.simbolos[r.simbolo] + "\" que usa " + objeto.nombre + " no es global en ningun objeto");
+                valor = global->second;
+            }
+
+            size_t i = primeras[o] + r.palabra;
+            if (r.relativo)
+                valor -= pcs[i] + 1;                                            // Como instruccion::valorEtiqueta
+
+            campo_instruccion campo;
+            campo.desplazamiento = r.desplazamiento;
+            campo.mascara = mascaraCampo (r.nBits, isa.tamanyoInstruccion);
+            programa.palabras[i] = (programa.palabras[i] & ~(mascaraPalabra<palabra128>(r.nBits) << campo.desplazamiento)) | instruccion::colocarCampo<palabra128>(campo, valor);
+        }
+    }
+
+    if (!programa.rellenos.empty())                                             // Con huecos las direcciones ya no son el índice
+        programa.direcciones = move (pcs);
+
+    return programa;
+}
+
+
+// Generación de un juego de instrucciones fijo
+
+// Hash de un mnemónico con una semilla, igual que el que se escribe en la cabecera generada
+
+uint32_t hashMnemonico (string_view nombre, uint32_t semilla)
+{
+    uint32_t h = 2166136261u ^ semilla * 0x9e3779b9u;
+    for (char c : nombre) h = (h ^ (uint8_t) c) * 16777619u;
+    return h ^ (h >> 15);
+}
+
+
+// Busca un hash perfecto de los mnemónicos por desplazamiento: cada mnemónico cae en un cubo según su hash con semilla 0,
+// y cada cubo tiene la semilla con la que sus mnemónicos van a ranuras libres de una tabla de tamanyoTabla
+// Devuelve las semillas de los cubos, o un vector vacío si no las encuentra
+
+vector<uint32_t> buscarHashPerfecto (const vector<string_view> &nombres, uint32_t tamanyoTabla, uint32_t nCubos)
+{
+    const uint32_t MAX_SEMILLA = 1 << 16;
+
+    vector<vector<string_view>> cubos (nCubos);
+    for (string_view nombre : nombres)
+        cubos[hashMnemonico (nombre, 0) % nCubos].push_back (nombre);
+
+    vector<uint32_t> orden (nCubos);                                            // Los cubos más llenos primero
+    for (uint32_t b = 0; b < nCubos; b++) orden[b] = b;
+    stable_sort (orden.begin(), orden.end(), [&] (uint32_t a, uint32_t b) { return cubos[a].size() > cubos[b].size(); });
+
+    vector<uint32_t> semillas (nCubos, 0);
+    vector<bool> ocupada (tamanyoTabla, false);
+    vector<uint32_t> ranuras;
+
+    for (uint32_t b : orden)
+    {
+        if (cubos[b].empty())
+            break;
+
+        uint32_t semilla = 1;
+        for (; semilla < MAX_SEMILLA; semilla++)
+        {
+            ranuras.clear();
+            bool libre = true;
+            for (string_view nombre : cubos[b])
+            {
+                uint32_t ranura = hashMnemonico (nombre, semilla) & (tamanyoTabla - 1);
+                if (ocupada[ranura] || find (ranuras.begin(), ranuras.end(), ranura) != ranuras.end())
+                {
+                    libre = false;
+                    break;
+                }
+                ranuras.push_back (ranura);
+            }
+            if (libre)
+                break;
+        }
+
+        if (semilla == MAX_SEMILLA)
+            return {};
+
+        semillas[b] = semilla;
+        for (uint32_t ranura : ranuras)
+            ocupada[ranura] = true;
+    }
+
+    return semillas;
+}
+
+
+// Escribe una palabra como constante palabra128 de C++
+
+string constantePalabra (const palabra128 &palabra)
+{
+    char texto[64];
+    snprintf (texto, sizeof texto, "palabra128 (0x%llxull, 0x%llxull)", (unsigned long long) palabra.alta, (unsigned long long) palabra.baja);
+    return texto;
+}
+
+
+// Escribe un texto como literal de C++ entre comillas
+
+string literalCadena (string_view texto)
+{
+    string literal = "\"";
+    for (char c : texto)
+    {
+        if (c == '"' || c == '\\') literal += '\\';
+        literal += c;
+    }
+    return literal + "\"";
+}
+
+
+// Genera la cabecera del juego de instrucciones fijo de una configuración
+
+string generarCabeceraIsa (const configuracion_isa &isa, string_view textoConfig)
+{
+    int nInstrucciones = isa.planes.size();
+    size_t maxCampos = 1;
+    vector<string_view> nombres;
+    for (const plan_instruccion &plan : isa.planes)
+    {
+        nombres.push_back (plan.nombre);
+        maxCampos = max (maxCampos, plan.campos.size());
+    }
+
+    uint32_t tamanyoTabla = 1;                                                  // Potencia de 2 con sitio para todos
+    while (tamanyoTabla < nombres.size())
+        tamanyoTabla <<= 1;
+    uint32_t nCubos = max<uint32_t> (1, nombres.size() / 2);
+
+    vector<uint32_t> semillas = buscarHashPerfecto (nombres, tamanyoTabla, nCubos);
+    while (semillas.empty())                                                    // Con más ranuras siempre se acaba encontrando
+    {
+        tamanyoTabla <<= 1;
+        semillas = buscarHashPerfecto (nombres, tamanyoTabla, nCubos);
+    }
+
+    string delimitador = "cfg";                                                 // Que no aparezca en la configuración
+    while (textoConfig.find (")" + delimitador + "\"") != string_view::npos)
+        delimitador += "_";
+
+    ostringstream h;
+    h << "// Juego de instrucciones fijo, generado por cumpilador --generar-isa\n"
+         "// Se incluye desde libcumpilador.h, dentro del espacio de nombres cumpilador, al compilar con\n"
+         "// -DCUMPILADOR_ISA='\"fichero\"'. Las configuraciones iguales a CONFIGURACION se ensamblan con estas tablas.\n"
+         "\n"
+         "namespace isa_fija\n"
+         "{\n"
+         "\n"
+         "constexpr const char *CONFIGURACION = R\"" << delimitador << "(" << textoConfig << ")" << delimitador << "\";\n"
+         "\n"
+         "constexpr bool HEX_OUT = " << (isa.hexOut ? "true" : "false") << ";\n"
+         "constexpr bool LOGISIM_OUT = " << (isa.logisimOut ? "true" : "false") << ";\n"
+         "constexpr bool VHDL_OUT = " << (isa.vhdlOut ? "true" : "false") << ";\n"
+         "constexpr bool SALTO_RELATIVO = " << (isa.saltoRelativo ? "true" : "false") << ";\n"
+         "constexpr int TAMANYO_INSTRUCCION = " << isa.tamanyoInstruccion << ";\n"
+         "constexpr int N_INSTRUCCIONES = " << nInstrucciones << ";\n"
+         "constexpr int MAX_CAMPOS = " << maxCampos << ";                                  // Campos de la instrucción más larga\n"
+         "\n"
+         "\n"
+         "// Tablas de las instrucciones, indexadas por el id de su plan\n"
+         "\n"
+         "constexpr const char *NOMBRES[] = {";
+    for (int id = 0; id < nInstrucciones; id++)
+        h << (id ? ", " : "") << literalCadena (isa.planes[id].nombre);
+    h << "};\n"
+         "constexpr int N_BITS[] = {";
+    for (int id = 0; id < nInstrucciones; id++)
+        h << (id ? ", " : "") << isa.planes[id].nBits;
+    h << "};\n"
+         "constexpr int N_PARAMETROS[] = {";
+    for (int id = 0; id < nInstrucciones; id++)
+        h << (id ? ", " : "") << isa.planes[id].nParametros;
+    h << "};\n"
+         "constexpr uint64_t OPCODES[][2] = {";                                   // Base de cada instrucción, {alta, baja}
+    for (int id = 0; id < nInstrucciones; id++)
+        h << (id ? ", " : "") << "{0x" << hex << isa.planes[id].base.alta << "ull, 0x" << isa.planes[id].base.baja << "ull}" << dec;
+    h << "};\n"
+         "\n"
+         "\n"
+         "// Hash perfecto de los mnemónicos: el hash con semilla 0 elige un cubo y la semilla del cubo una ranura\n"
+         "\n"
+         "constexpr uint32_t TAMANYO_HASH = " << tamanyoTabla << ";\n"
+         "constexpr uint32_t N_CUBOS = " << nCubos << ";\n"
+         "constexpr uint32_t SEMILLAS[] = {";
+    for (uint32_t b = 0; b < nCubos; b++)
+        h << (b ? ", " : "") << semillas[b];
+    h << "};\n"
+         "\n"
+         "constexpr uint32_t hashMnemonico (string_view nombre, uint32_t semilla)\n"
+         "{\n"
+         "    uint32_t h = 2166136261u ^ semilla * 0x9e3779b9u;\n"
+         "    for (char c : nombre) h = (h ^ (uint8_t) c) * 16777619u;\n"
+         "    return h ^ (h >> 15);\n"
+         "}\n"
+         "\n"
+         "constexpr uint32_t ranuraMnemonico (string_view nombre)\n"
+         "{\n"
+         "    return hashMnemonico (nombre, SEMILLAS[hashMnemonico (nombre, 0) % N_CUBOS]) & (TAMANYO_HASH - 1);\n"
+         "}\n"
+         "\n"
+         "// Devuelve el id del plan del mnemónico, o -1 si no está en la configuración\n"
+         "inline int buscarMnemonico (string_view nombre)\n"
+         "{\n"
+         "    switch (ranuraMnemonico (nombre))\n"
+         "    {\n";
+    for (int id = 0; id < nInstrucciones; id++)
+    {
+        uint32_t ranura = hashMnemonico (nombres[id], semillas[hashMnemonico (nombres[id], 0) % nCubos]) & (tamanyoTabla - 1);
+        h << "        case " << ranura << ": return nombre == " << literalCadena (nombres[id]) << " ? " << id << " : -1;\n";
+    }
+    h << "        default: return -1;\n"
+         "    }\n"
+         "}\n"
+         "\n"
+         "\n"
+         "// Codifica la instrucción id con los valores de sus campos, en su orden, con desplazamientos y máscaras constantes\n"
+         "template <typename palabra_t>\n"
+         "inline palabra_t codificar (int id, const int *valores)\n"
+         "{\n"
+         "    switch (id)\n"
+         "    {\n";
+    for (int id = 0; id < nInstrucciones; id++)
+    {
+        const plan_instruccion &plan = isa.planes[id];
+        h << "        case " << id << ":                                                       // " << plan.nombre << "\n"
+             "            return convertirPalabra<palabra_t>(" << constantePalabra (plan.base) << ")";
+        for (size_t c = 0; c < plan.campos.size(); c++)
+            h << "\n                 | (palabra_t) ((extenderSigno<palabra_t>(valores[" << c << "]) & convertirPalabra<palabra_t>("
+              << constantePalabra (plan.campos[c].mascara) << ")) << " << plan.campos[c].desplazamiento << ")";
+        h << ";\n";
+    }
+    h << "        default: return palabra_t ();\n"
+         "    }\n"
+         "}\n"
+         "\n"
+         "}\n";
+
+    return h.str();
+}
+
+
+// Desensamblado
+
+// Número de bits a 1 de una palabra
+
+int bitsActivos (const palabra128 &palabra)
+{
+    int n = 0;
+    for (uint64_t x = palabra.baja; x != 0; x &= x - 1) n++;
+    for (uint64_t x = palabra.alta; x != 0; x &= x - 1) n++;
+    return n;
+}
+
+
+// Posición del bit a 1 de más peso de una palabra, que no debe ser 0
+
+int bitMasAlto (const palabra128 &palabra)
+{
+    int bit = MAX_BITS_CODIFICACION - 1;
+    while (((uint64_t) (palabra >> bit) & 1) == 0)
+        bit--;
+    return bit;
+}
+
+
+// Valor de un campo en la codificación de una instrucción, con extensión de signo si es relativo
+
+int64_t valorCampo (const palabra128 &palabra, const campo_instruccion &campo)
+{
+    int nBits = min (campo.nBits, 64);
+    uint64_t valor = (uint64_t) (palabra >> campo.desplazamiento) & mascaraBits (nBits);
+
+    if (campo.tipo == CAMPO_RELATIVO && nBits < 64 && ((valor >> (nBits - 1)) & 1))
+        valor |= ~mascaraBits (nBits);
+
+    return (int64_t) valor;
+}
+
+
+// Construye el trie con los bits fijos de cada instrucción, colocados como quedan en una palabra de la imagen
+
+decodificador::decodificador (const configuracion_isa &_isa) : isa (_isa)
+{
+    const int tamanyo = isa.tamanyoInstruccion;
+    const palabra128 mascaraImagen = mascaraPalabra<palabra128>(tamanyo);
+    vector<patron_instruccion> patrones;
+
+    for (const plan_instruccion &plan : isa.planes)
+    {
+        palabra128 variables;
+        for (const campo_instruccion &campo : plan.campos)
+            variables |= campo.mascara << campo.desplazamiento;
+
+        patron_instruccion patron;
+        patron.fijos = mascaraPalabra<palabra128>(plan.nBits) & ~variables;
+        patron.base = plan.base & patron.fijos;
+        patron.nFijos = bitsActivos (patron.fijos);
+        patron.id = plan.id;
+        completos.push_back (patron);
+
+        if (plan.nBits > tamanyo)                                                   // Solo quedan los bits de mayor peso
+        {
+            patron.fijos = patron.fijos >> (plan.nBits - tamanyo);
+            patron.base = patron.base >> (plan.nBits - tamanyo);
+        }
+        else                                                                        // A su izquierda hay ceros
+            patron.fijos |= mascaraImagen & ~mascaraPalabra<palabra128>(plan.nBits);
+
+        patron.fijos = patron.fijos & mascaraImagen;
+        patron.base = patron.base & patron.fijos;
+        patron.nFijos = bitsActivos (patron.fijos);
+        patron.id = plan.id;
+        patrones.push_back (patron);
+    }
+
+    construir (patrones, 1);
+
+    stable_sort (completos.begin(), completos.end(), [](const patron_instruccion &a, const patron_instruccion &b)
+    {
+        return a.nFijos > b.nFijos;
+    });
+}
+
+
+// Busca primero en el trie y, si la instrucción no es de nBits bits, entre todas las de nBits bits
+
+int decodificador::decodificar (const palabra128 &palabra, int nBits) const
+{
+    int id = decodificar (ventanaInstruccion (palabra, nBits, isa.tamanyoInstruccion));
+    if (id >= 0 && isa.planes[id].nBits == nBits)
+        return id;
+
+    for (const patron_instruccion &patron : completos)
+        if (isa.planes[patron.id].nBits == nBits && (palabra & patron.fijos) == patron.base)
+            return patron.id;
+
+    return -1;
+}
+
+
+// Añade el nodo que distingue las instrucciones de patrones y, recursivamente, sus hijos. Devuelve su posición
+// El grupo de cada nodo empieza en el bit de más peso que todas tienen fijo y no todas con el mismo valor (el
+// opcode, en la raíz) y sigue hacia abajo mientras todas los tengan fijos. Como cada hijo recibe solo las
+// instrucciones con su valor en ese bit, siempre tiene menos que el padre
+
+int decodificador::construir (vector<patron_instruccion> &patrones, int profundidad)
+{
+    int indice = nodos.size();
+    nodos.push_back ({0, 0, 0, candidatos.size(), 0});
+    profundidadMaxima = max (profundidadMaxima, profundidad);
+
+    palabra128 comunes = ~palabra128 ();                                            // Fijos en todas
+    palabra128 unos, ceros;                                                         // Fijos a 1 o a 0 en alguna
+    for (const patron_instruccion &patron : patrones)
+    {
+        comunes = comunes & patron.fijos;
+        unos |= patron.base;
+        ceros |= patron.fijos & ~patron.base;
+    }
+    palabra128 decisivos = comunes & unos & ceros;
+
+    if (patrones.size() <= 1 || decisivos == palabra128 ())                         // Hoja: se comprueban una a una
+    {
+        stable_sort (patrones.begin(), patrones.end(), [] (const patron_instruccion &a, const patron_instruccion &b) { return a.nFijos > b.nFijos; });
+        candidatos.insert (candidatos.end(), patrones.begin(), patrones.end());
+        nodos[indice].nCandidatos = patrones.size();
+        return indice;
+    }
+
+    int alto = bitMasAlto (decisivos);
+    int bajo = alto;
+    while (bajo > 0 && alto - bajo + 1 < MAX_BITS_NODO && ((uint64_t) (comunes >> (bajo - 1)) & 1))
+        bajo--;
+    int nBits = alto - bajo + 1;
+
+    size_t primero = hijos.size();
+    hijos.resize (primero + ((size_t) 1 << nBits));
+    nodos[indice] = {bajo, nBits, mascaraBits (nBits), primero, 0};
+
+    vector<vector<patron_instruccion>> grupos ((size_t) 1 << nBits);
+    for (const patron_instruccion &patron : patrones)
+        grupos[(uint64_t) (patron.base >> bajo) & mascaraBits (nBits)].push_back (patron);
+
+    for (size_t valor = 0; valor < grupos.size(); valor++)
+    {
+        int hijo = construir (grupos[valor], profundidad + 1);
+        hijos[primero + valor] = hijo;
+    }
+
+    return indice;
+}
+
+
+// Devuelve la codificación de plan->nBits bits de la instrucción id a partir de su palabra de nBitsPalabra bits
+// Los bits que la palabra no tiene, en instrucciones más largas que ella, quedan a 0
+
+palabra128 decodificador::codificacion (int id, const palabra128 &palabra, int nBitsPalabra) const
+{
+    int nBits = isa.planes[id].nBits;
+
+    if (nBits > nBitsPalabra)
+        return palabra << (nBits - nBitsPalabra);
+    return palabra & mascaraPalabra<palabra128>(nBits);
+}
+
+
+// Lee un número de hasta 128 bits en base 2 o 16. Devuelve false si tiene otros caracteres o no cabe
+
+bool leerNumeroImagen (string_view digitos, int base, palabra128 &palabra)
+{
+    const int bitsDigito = base == 16 ? 4 : 1;
+
+    if (digitos.empty() || digitos.size() * bitsDigito > MAX_BITS_CODIFICACION)
+        return false;
+
+    palabra = 0;
+    for (char c : digitos)
+    {
+        int valor = c >= '0' && c <= '9' ? c - '0' : c >= 'A' && c <= 'F' ? c - 'A' + 10 : c >= 'a' && c <= 'f' ? c - 'a' + 10 : base;
+        if (valor >= base)
+            return false;
+        palabra = (palabra << bitsDigito) | palabra128 (valor);
+    }
+
+    return true;
+}
+
+
+// Lee los bytes de los registros de datos de un Intel HEX, con las direcciones extendidas de segmento y lineales
+// Los huecos entre registros quedan a 0
+
+string leerIntelHex (string_view contenido)
+{
+    string bytes;
+    uint64_t base = 0;                                                              // Dirección de los registros 02 y 04
+    int linea = 0;
+
+    for (size_t inicio = 0; inicio < contenido.size(); )
+    {
+        size_t fin = contenido.find ('\n', inicio);
+        if (fin == string_view::npos)
+            fin = contenido.size();
+        string_view registro = contenido.substr (inicio, fin - inicio);
+        inicio = fin + 1;
+        linea++;
+
+        if (!registro.empty() && registro.back() == '\r')
+            registro.remove_suffix (1);
+        if (registro.empty())
+            continue;
+
+        uint8_t datos[5 + 255];
+        size_t n = (registro.size() - 1) / 2;
+        bool correcto = registro[0] == ':' && registro.size() % 2 == 1 && n >= 5 && n <= sizeof(datos);
+        uint8_t suma = 0;
+
+        for (size_t b = 0; correcto && b < n; b++)
+        {
+            auto [final, error] = from_chars (registro.data() + 1 + 2 * b, registro.data() + 3 + 2 * b, datos[b], 16);
+            correcto = error == errc() && final == registro.data() + 3 + 2 * b;
+            suma += datos[b];
+        }
+
+        if (!correcto || datos[0] != n - 5 || suma != 0)
+            throw exception_wrong_image ("Registro Intel HEX incorrecto en la linea " + std::to_string(linea));
+
+        uint64_t direccion = base + ((datos[1] << 8) | datos[2]);
+        switch (datos[3])
+        {
+            case 0:                                                                 // Datos
+                if (bytes.size() < direccion + datos[0])
+                    bytes.resize (direccion + datos[0], 0);
+                memcpy (&bytes[direccion], datos + 4, datos[0]);
+                break;
+            case 1:                                                                 // Fin del fichero
+                return bytes;
+            case 2:                                                                 // Dirección extendida de segmento
+                base = (uint64_t) ((datos[4] << 8) | datos[5]) << 4;
+                break;
+            case 4:                                                                 // Dirección lineal extendida
+                base = (uint64_t) ((datos[4] << 8) | datos[5]) << 16;
+                break;
+        }
+    }
+
+    return bytes;
+}
+
+
+// Lee las palabras de una imagen en el modo dado, al revés que formatearPrograma
+// Cada palabra tiene TAMANYO_INSTRUCCION bits, salvo en BIN, donde tiene los de su instrucción, y en nBits quedan
+// los de cada una. Los errores se lanzan como exception_wrong_image
+
+vector<palabra128> leerImagen (const modo_salida &modo, string_view contenido, vector<uint8_t> &nBits)
+{
+    vector<palabra128> palabras;
+    nBits.clear ();
+    const palabra128 mascaraImagen = mascaraPalabra<palabra128>(modo.tamanyoInstruccion);
+
+    if (modo.formato == SALIDA_BINARIA || modo.formato == SALIDA_INTEL_HEX)       // Palabras empaquetadas en bytes
+    {
+        string bytesIntelHex;
+        if (modo.formato == SALIDA_INTEL_HEX)
+        {
+            bytesIntelHex = leerIntelHex (contenido);
+            contenido = bytesIntelHex;
+        }
+
+        const size_t nBytes = bytesPalabra (modo);
+        if (contenido.size() % nBytes != 0)
+            throw exception_wrong_image ("La imagen tiene " + std::to_string(contenido.size()) + " bytes, que no son palabras completas de " +
+                                         std::to_string(nBytes) + " bytes");
+
+        palabras.resize (contenido.size() / nBytes);
+        for (size_t i = 0; i < palabras.size(); i++)
+        {
+            const uint8_t *bytes = (const uint8_t *) contenido.data() + i * nBytes;
+            palabra128 palabra;
+
+            for (size_t b = 0; b < nBytes; b++)
+                palabra = (palabra << 8) | palabra128 (bytes[modo.littleEndian ? nBytes - 1 - b : b]);
+
+            palabras[i] = palabra & mascaraImagen;
+        }
+
+        nBits.assign (palabras.size(), modo.tamanyoInstruccion);
+        return palabras;
+    }
+
+    const bool hex = modo.formato == SALIDA_READMEMH || modo.hexOut;               // En texto, una palabra por token
+    size_t pos = 0;
+
+    while (pos < contenido.size())
+    {
+        size_t inicio = contenido.find_first_not_of (" \t\r\n,", pos);
+        if (inicio == string_view::npos)
+            break;
+        size_t fin = contenido.find_first_of (" \t\r\n,", inicio);
+        if (fin == string_view::npos)
+            fin = contenido.size();
+        string_view token = contenido.substr (inicio, fin - inicio);
+        pos = fin;
+
+        if (token.substr (0, 2) == "//")                                            // Comentario de readmemh
+        {
+            pos = contenido.find ('\n', inicio);
+            if (pos == string_view::npos)
+                break;
+            continue;
+        }
+        if (modo.logisimOut && palabras.empty() && (token == "v2.0" || token == "raw"))  // Cabecera de logisim
+            continue;
+
+        if (token[0] == '@' && modo.formato == SALIDA_READMEMH)                    // Cambio de dirección de readmemh
+        {
+            palabra128 direccion;
+            if (!leerNumeroImagen (token.substr (1), 16, direccion) || direccion.alta != 0 || direccion.baja > UINT32_MAX)
+                throw exception_wrong_image ("Direccion incorrecta \"" + string(token) + "\" en la imagen");
+            palabras.resize (direccion.baja);
+            nBits.resize (direccion.baja, modo.tamanyoInstruccion);
+            continue;
+        }
+
+        if (token.substr (0, 2) == "X\"")                                           // Palabra de VHDL_OUT
+            token.remove_prefix (2);
+        if (!token.empty() && token.back() == '"')
+            token.remove_suffix (1);
+
+        palabra128 palabra;
+        if (!leerNumeroImagen (token, hex ? 16 : 2, palabra))
+            throw exception_wrong_image ("Palabra incorrecta \"" + string(contenido.substr (inicio, fin - inicio)) + "\" en la imagen");
+
+        palabras.push_back (hex ? palabra & mascaraImagen : palabra);
+        nBits.push_back (hex ? modo.tamanyoInstruccion : token.size());
+    }
+
+    return palabras;
+}
+
+
+// Desensambla palabras de nBits bits, como las de leerImagen, a un programa con la sintaxis de la configuración
+// Los saltos relativos ## que caen dentro del programa se escriben con etiquetas etiqueta_PC, y las palabras que
+// no son ninguna instrucción, como comentarios. Si a una instrucción le faltan bits de sus campos, porque la imagen
+// la recorta a TAMANYO_INSTRUCCION, se lanza exception_wrong_image
+
+string desensamblarPrograma (const configuracion_isa &isa, const vector<palabra128> &palabras, const vector<uint8_t> &nBits,
+                             bool anchoExacto)
+{
+    decodificador deco (isa);
+    size_t n = palabras.size();
+    vector<int> ids (n);
+    vector<bool> conEtiqueta (n + 1, false);                                        // Una etiqueta al final vale n
+
+    for (size_t i = 0; i < n; i++)                                                  // Decodifica y busca los destinos de los saltos
+    {
+        ids[i] = anchoExacto ? deco.decodificar (palabras[i], nBits[i])
+                             : deco.decodificar (ventanaInstruccion (palabras[i], nBits[i], isa.tamanyoInstruccion));
+        if (ids[i] < 0)
+            continue;
+
+        const plan_instruccion &plan = isa.planes[ids[i]];
+        if (plan.nBits > nBits[i])                                                  // Los bits de menor peso no están en la imagen
+        {
+            palabra128 perdidos = mascaraPalabra<palabra128>(plan.nBits - nBits[i]);
+            for (const campo_instruccion &campo : plan.campos)
+                if (((campo.mascara << campo.desplazamiento) & perdidos) != palabra128 (0))
+                    throw exception_wrong_image ("La palabra " + std::to_string(i) + " es la instruccion " + plan.nombre + " de " +
+                                                 std::to_string(plan.nBits) + " bits, pero la imagen solo tiene " +
+                                                 std::to_string(nBits[i]) + " y faltan bits de sus operandos");
+        }
+
+        palabra128 codificacion = deco.codificacion (ids[i], palabras[i], nBits[i]);
+        for (const campo_instruccion &campo : plan.campos)
+            if (campo.tipo == CAMPO_RELATIVO)
+            {
+                int64_t destino = (int64_t) i + 1 + valorCampo (codificacion, campo);
+                if (destino >= 0 && destino <= (int64_t) n)
+                    conEtiqueta[destino] = true;
+            }
+    }
+
+    string salida;
+    salida.reserve (n * 24);
+
+    for (size_t i = 0; i <= n; i++)
+    {
+        if (conEtiqueta[i])
+            salida += "etiqueta_" + std::to_string(i) + "\n";
+        if (i == n)
+            break;
+
+        if (ids[i] < 0)
+        {
+            salida += "; Palabra desconocida 0x" + palabraToHex (palabras[i], nBits[i], isa.tamanyoInstruccion) + "\n";
+            continue;
+        }
+
+        const plan_instruccion &plan = isa.planes[ids[i]];
+        palabra128 codificacion = deco.codificacion (ids[i], palabras[i], nBits[i]);
+        salida += plan.nombre;
+
+        for (const campo_instruccion &campo : plan.campos)
+        {
+            int64_t valor = valorCampo (codificacion, campo);
+            salida += ' ';
+
+            if (campo.tipo == CAMPO_PARAMETRO)                                      // Con el prefijo y el sufijo de la configuración
+                salida += campo.prefijo + std::to_string(valor) + campo.sufijo;
+            else if (campo.tipo == CAMPO_RELATIVO && (int64_t) i + 1 + valor >= 0 && (int64_t) i + 1 + valor <= (int64_t) n)
+                salida += "etiqueta_" + std::to_string(i + 1 + valor);
+            else                                                                    // Un valor se lee como int al ensamblar
+                salida += "#" + std::to_string(campo.tipo == CAMPO_RELATIVO ? valor : (int64_t) (int32_t) valor);
+        }
+
+        salida += '\n';
+    }
+
+    return salida;
+}
+
+
+
+// Diagnóstico
+
+// Indica si valor se codifica en el campo sin perder bits: sin signo hasta 2^n - 1 y, salvo en los parámetros,
+// con signo desde -2^(n-1). Los desplazamientos de los saltos relativos son solo con signo
+
+bool cabeEnCampo (const campo_instruccion &campo, int64_t valor)
+{
+    int nBits = bitsActivos (campo.mascara);                                        // El campo puede estar limitado por el tamaño de instrucción
+    if (nBits >= 32)                                                                // Cabe cualquier int
+        return true;
+
+    int64_t minimo = campo.tipo == CAMPO_PARAMETRO ? 0 : -((int64_t) 1 << (nBits - 1));
+    int64_t maximo = campo.tipo == CAMPO_RELATIVO ? ((int64_t) 1 << (nBits - 1)) - 1 : ((int64_t) 1 << nBits) - 1;
+    return valor >= minimo && valor <= maximo;
+}
+
+
+// Revisa el programa en una sola pasada sin detenerse en el primer error, y devuelve todos los errores y avisos
+// ordenados por línea y columna y sin repetir. Las referencias a etiquetas se apuntan al leerlas y se comprueban
+// al final, con el último valor de cada etiqueta, como al ensamblar
+
+vector<diagnostico> diagnosticarPrograma (const configuracion_isa &isa, string_view texto)
+{
+    struct referencia_etiqueta
+    {
+        string_view nombre;                                                         // Etiqueta usada
+        int linea, columna;                                                         // Posición del operando
+        int pc;                                                                     // PC de la instrucción
+        const campo_instruccion *campo;                                             // Campo en el que se codifica
+    };
+
+    struct definicion_diagnostico
+    {
+        int64_t valor;                                                              // Último valor de la etiqueta
+        int linea;                                                                  // Línea de la última definición
+    };
+
+    vector<diagnostico> diagnosticos;
+    vector<referencia_etiqueta> referencias;
+    unordered_map<string_view, definicion_diagnostico> definiciones;
+    lexer lex (texto);
+    int i_PC = 0;
+    int i_numLinea = 0;
+
+    auto columna = [&] (string_view token) { return (int) (token.data() - lex.inicioLinea) + 1; };
+
+    auto anotar = [&] (string_view token, bool esError, const string &mensaje)
+    {
+        diagnosticos.push_back ({i_numLinea, columna (token), esError, mensaje});
+    };
+
+    // Mensaje de una excepción del ensamblador sin la línea, que ya va delante del diagnóstico
+    auto sinLinea = [&] (string mensaje)
+    {
+        string linea = " en la linea " + std::to_string(i_numLinea);
+        size_t pos = mensaje.find (linea);
+        return pos == string::npos ? mensaje : mensaje.erase (pos, linea.size());
+    };
+
+    // Final del aviso de un valor que no cabe en su campo, con el valor que queda al recortarlo
+    auto recorte = [] (const campo_instruccion &campo, int64_t valor)
+    {
+        int nBits = bitsActivos (campo.mascara);
+        int64_t codificado = (uint64_t) valor & mascaraBits (nBits);
+        if (campo.tipo == CAMPO_RELATIVO && ((codificado >> (nBits - 1)) & 1))          // El salto se lee con signo
+            codificado -= (int64_t) 1 << nBits;
+
+        return " no cabe en los " + std::to_string(nBits) + " bits del campo y se codifica como " + std::to_string(codificado);
+    };
+
+    // Lee un número como to_decimal, anotando si es incorrecto (y entonces devuelve false) o si se satura
+    auto leerNumero = [&] (string_view numero, string_view token, int64_t &valor)
+    {
+        try
+        {
+            valor = to_decimal (numero, i_numLinea);
+        }
+        catch (const exception_wrong_number &)
+        {
+            anotar (token, true, "Numero incorrecto \"" + string(numero) + "\"");
+            return false;
+        }
+
+        if (valor == INT_MAX && numero.substr (0, 2) == "0x")
+        {
+            unsigned long long exacto = 0;
+            auto [fin, error] = from_chars (numero.data() + 2, numero.data() + numero.size(), exacto, 16);
+            if (error == errc::result_out_of_range || exacto > INT_MAX)
+                anotar (token, false, "El hexadecimal " + string(numero) + " es mayor que INT_MAX y se satura a INT_MAX");
+        }
+
+        return true;
+    };
+
+    while (lex.siguienteLinea())
+    {
+        i_numLinea++;
+
+        relleno_memoria relleno;
+        try
+        {
+            if (leerGlobal (lex, i_numLinea))                                       // Solo cuenta en los objetos
+                continue;
+            if (!lex.tokens.empty() && leerDirectiva (lex, isa.tamanyoInstruccion, i_numLinea, i_PC, relleno))    // Es una directiva
+                continue;
+        }
+        catch (const exception_wrong_directive &e)                                  // La directiva no mueve el PC
+        {
+            anotar (lex.tokens[0], true, sinLinea (e.msg));
+            continue;
+        }
+        catch (const exception_wrong_number &)                                      // Lo anota en el operando incorrecto
+        {
+            int64_t valor;
+            for (size_t t = 1; t < lex.tokens.size() && leerNumero (lex.tokens[t], lex.tokens[t], valor); t++);
+            continue;
+        }
+
+        if (lex.tokens.size() > 1)                                                  // Es una instrucción
+        {
+            string_view nombre = lex.tokens[0];
+            if (i_PC == INT_MAX)                                                    // No cabe, y tampoco las siguientes
+            {
+                anotar (nombre, true, sinLinea (exception_pc_overflow (string(nombre), i_numLinea).msg));
+                continue;
+            }
+            int pc = i_PC++;                                                        // Aunque tenga errores, ocupa su PC
+
+            int id = isa.instrucciones.buscar (nombre);
+            if (id < 0)
+            {
+                anotar (nombre, true, "Instruccion desconocida: \"" + string(nombre) + "\"");
+                continue;
+            }
+
+            const plan_instruccion &plan = isa.planes[id];
+            if (lex.tokens.size() != plan.nParametros)
+            {
+                anotar (nombre, true, "Numero de parametros incorrecto en la instruccion \"" + string(nombre) + "\"");
+                continue;
+            }
+
+            for (size_t t = 1; t < lex.tokens.size(); t++)
+            {
+                const campo_instruccion &campo = plan.campos[t - 1];
+                string_view token = lex.tokens[t];
+                int64_t valor;
+
+                if (campo.tipo != CAMPO_PARAMETRO)                                  // Etiqueta o valor
+                {
+                    if (token[0] != CH_ETIQUETA_CONFIG)
+                        referencias.push_back ({token, i_numLinea, columna (token), pc, &campo});
+                    else if (leerNumero (token.substr (1), token, valor) && !cabeEnCampo (campo, valor))
+                        anotar (token, false, "El valor " + std::to_string(valor) + recorte (campo, valor));
+                    continue;
+                }
+
+                size_t inicioNumero = min (campo.prefijo.size(), token.size());     // Igual que al codificar
+                size_t finNumero = token.find_first_not_of ("1234567890", inicioNumero);
+                if (finNumero == string_view::npos)
+                    finNumero = token.size();
+
+                if (token.compare (0, inicioNumero, campo.prefijo) != 0 || token.compare (finNumero, string::npos, campo.sufijo) != 0)
+                {
+                    bool completo = campo.sufijo != "" || finNumero != token.size();
+                    anotar (token, true, "Error en la sintaxis de la instruccion \"" + string(nombre) + "\": Se ha encontrado \"" +
+                                         string(completo ? token : token.substr (0, inicioNumero)) + "\", se esperaba \"" +
+                                         (completo ? campo.prefijo + "*" + campo.sufijo : campo.prefijo) + "\"");
+                    continue;
+                }
+
+                if (leerNumero (token.substr (inicioNumero), token, valor) && !cabeEnCampo (campo, valor))
+                    anotar (token, false, "El valor " + std::to_string(valor) + recorte (campo, valor));
+            }
+        }
+        else if (lex.tokens.size() == 1)                                            // Es una etiqueta
+        {
+            string_view etiqueta = lex.tokens[0];
+            size_t igual = etiqueta.find ('=');
+            int64_t valor = i_PC;
+
+            if (igual != string_view::npos && !leerNumero (etiqueta.substr (igual + 1), etiqueta, valor))
+                valor = 0;                                                          // Se define igualmente, para no dar sus usos por desconocidos
+
+            string_view nombreEtiqueta = etiqueta.substr (0, igual);
+            auto [definicion, nueva] = definiciones.try_emplace (nombreEtiqueta, definicion_diagnostico {valor, i_numLinea});
+            if (!nueva)
+            {
+                anotar (etiqueta, false, "La etiqueta \"" + string(nombreEtiqueta) + "\" ya se definio en la linea " +
+                                         std::to_string(definicion->second.linea) + "; se usa este valor");
+                definicion->second = {valor, i_numLinea};
+            }
+        }
+    }
+
+    for (const referencia_etiqueta &ref : referencias)                              // Etiquetas, con su valor final
+    {
+        auto definicion = definiciones.find (ref.nombre);
+        if (definicion == definiciones.end())
+        {
+            diagnosticos.push_back ({ref.linea, ref.columna, true, "Etiqueta desconocida \"" + string(ref.nombre) + "\""});
+            continue;
+        }
+
+        int64_t valor = ref.campo->tipo == CAMPO_RELATIVO ? definicion->second.valor - (ref.pc + 1) : definicion->second.valor;
+        if (!cabeEnCampo (*ref.campo, valor))
+            diagnosticos.push_back ({ref.linea, ref.columna, false, "La etiqueta \"" + string(ref.nombre) + "\" (" +
+                                     (ref.campo->tipo == CAMPO_RELATIVO ? "desplazamiento " : "valor ") + std::to_string(valor) + ")" +
+                                     recorte (*ref.campo, valor)});
+    }
+
+    sort (diagnosticos.begin(), diagnosticos.end());
+    diagnosticos.erase (unique (diagnosticos.begin(), diagnosticos.end()), diagnosticos.end());
+    return diagnosticos;
+}
+
+
+// Simulador funcional
+
+// Semántica de cada mnemónico que reconoce el simulador
+const unordered_map<string, operacion_simulador> gl_operaciones_simulador = {
+    {"NOP", OP_NOP}, {"ADD", OP_ADD}, {"SUB", OP_SUB}, {"AND", OP_AND}, {"OR", OP_OR},
+    {"LW", OP_LW}, {"SW", OP_SW}, {"BEQ", OP_BEQ},
+    {"ADDFP", OP_ADDFP}, {"SUBFP", OP_SUBFP}, {"LWFP", OP_LWFP}, {"SWFP", OP_SWFP}
+};
+
+const int MAX_BITS_REGISTRO = 16;                    // Máximo de bits de un campo de registro en el simulador
+
+
+// Decodifica cada palabra del programa una sola vez con el trie de la configuración y la convierte en la
+// operación de su mnemónico con los valores de sus campos
+
+simulador::simulador (const configuracion_isa &isa, const programa_ensamblado &programa, size_t palabrasMemoria)
+{
+    decodificador deco (isa);
+
+    size_t n = programa.palabras.size();
+    codigo.resize (n + 2);
+    planes.assign (n, -1);
+    int bitsRegistro = 0;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        const palabra128 &palabra = programa.palabras[i];
+        instruccion_predecodificada &inst = codigo[i];
+        inst = {OP_DESCONOCIDA, 0, 0, 0, 0};
+
+        planes[i] = deco.decodificar (ventanaInstruccion (palabra, programa.nBits[i], isa.tamanyoInstruccion));
+        if (planes[i] < 0)
+            continue;
+        const plan_instruccion *plan = &isa.planes[planes[i]];
+
+        auto operacion = gl_operaciones_simulador.find (plan->nombre);
+        if (operacion == gl_operaciones_simulador.end())
+            continue;
+
+        vector<const campo_instruccion *> registrosCampo;     // Campos de registro y de valor, en su orden
+        const campo_instruccion *campoValor = nullptr;
+        for (const campo_instruccion &campo : plan->campos)
+        {
+            if (campo.tipo == CAMPO_PARAMETRO)
+                registrosCampo.push_back (&campo);
+            else if (campoValor == nullptr)
+                campoValor = &campo;
+        }
+
+        bool registroTipo = operacion->second == OP_ADD || operacion->second == OP_SUB || operacion->second == OP_AND ||
+                            operacion->second == OP_OR || operacion->second == OP_ADDFP || operacion->second == OP_SUBFP;
+        size_t nRegistros = operacion->second == OP_NOP ? 0 : registroTipo ? 3 : 2;
+
+        if (registrosCampo.size() < nRegistros || (nRegistros == 2 && campoValor == nullptr))  // No tiene los operandos que se esperan
+            continue;
+
+        uint16_t indices[3] = {0, 0, 0};
+        for (size_t r = 0; r < nRegistros; r++)
+        {
+            if (registrosCampo[r]->nBits > MAX_BITS_REGISTRO)
+                throw exception_wrong_config_syntax ("El simulador solo admite registros de hasta " + std::to_string(MAX_BITS_REGISTRO) +
+                                                     " bits: instruccion " + plan->nombre);
+            bitsRegistro = max (bitsRegistro, registrosCampo[r]->nBits);
+            indices[r] = valorCampo (palabra, *registrosCampo[r]);
+        }
+
+        uint32_t inmediato = 0;
+        if (campoValor != nullptr)
+        {
+            int64_t valor = valorCampo (palabra, *campoValor);
+            inmediato = (uint32_t) valor;
+
+            if (operacion->second == OP_BEQ && programa.direcciones.empty())    // El destino se resuelve aquí
+            {
+                int64_t destino = campoValor->tipo == CAMPO_RELATIVO ? (int64_t) i + 1 + valor : valor;
+                inmediato = destino >= 0 && destino <= (int64_t) n ? destino : n + 1;     // Fuera del programa: centinela
+            }
+            else if (operacion->second == OP_BEQ)                               // Con directivas, de dirección a índice
+            {
+                const vector<int> &direcciones = programa.direcciones;
+                int64_t destino = campoValor->tipo == CAMPO_RELATIVO ? (int64_t) direcciones[i] + 1 + valor : valor;
+                auto it = lower_bound (direcciones.begin(), direcciones.end(), destino);
+
+                if (it != direcciones.end() && *it == destino)
+                    inmediato = it - direcciones.begin();
+                else                                                            // Tras la última instrucción termina; en un hueco o en datos, centinela
+                    inmediato = destino == (int64_t) direcciones.back() + 1 ? n : n + 1;
+            }
+        }
+
+        inst = {operacion->second, indices[0], indices[1], indices[2], inmediato};
+    }
+
+    codigo[n] = {OP_FIN, 0, 0, 0, 0};
+    codigo[n + 1] = {OP_PC_INVALIDO, 0, 0, 0, 0};
+
+    registros.assign ((size_t) 1 << bitsRegistro, 0);
+    registrosFP.assign ((size_t) 1 << bitsRegistro, 0.0f);
+
+    size_t tamanyoMemoria = 1;                                                   // Potencia de 2, para recortar con una máscara
+    while (tamanyoMemoria < palabrasMemoria && tamanyoMemoria < ((size_t) 1 << 32))
+        tamanyoMemoria <<= 1;
+    memoria.assign (tamanyoMemoria, 0);
+}
+
+
+// Ejecuta desde pc hasta que se detenga o haga maxPasos pasos más (0 sin límite)
+// Con conPerfil cuenta en perfil las ejecuciones de cada instrucción
+
+motivo_parada simulador::ejecutar (uint64_t maxPasos, bool conPerfil)
+{
+    if (conPerfil)
+    {
+        perfil.resize (codigo.size());
+        return ejecutarBucle<true> (maxPasos);
+    }
+
+    return ejecutarBucle<false> (maxPasos);
+}
+
+
+// Bucle de ejecución con despacho directo: cada manejador salta al de la siguiente instrucción
+// Con GCC y Clang se usa goto computado sobre una tabla de etiquetas, y si no un switch
+
+template <bool PERFIL>
+motivo_parada simulador::ejecutarBucle (uint64_t maxPasos)
+{
+    const instruccion_predecodificada *inicio = codigo.data();
+    const instruccion_predecodificada *p = inicio + min (pc, codigo.size() - 2);
+    uint32_t *r = registros.data();
+    float *f = registrosFP.data();
+    uint32_t *m = memoria.data();
+    uint32_t mascaraMemoria = (uint32_t) (memoria.size() - 1);
+    uint64_t *cuentas = perfil.data();
+    uint64_t limite = maxPasos == 0 ? UINT64_MAX : maxPasos;
+    uint64_t n = 0;                                                              // Pasos de esta llamada
+    motivo_parada motivo = PARADA_FIN;
+
+#if defined(__GNUC__)
+    static const void *const despacho[N_OPERACIONES] = {
+        &&op_nop, &&op_add, &&op_sub, &&op_and, &&op_or, &&op_lw, &&op_sw, &&op_beq,
+        &&op_addfp, &&op_subfp, &&op_lwfp, &&op_swfp, &&op_desconocida, &&op_fin, &&op_pc_invalido
+    };
+    #define CASO(operacion, etiqueta) etiqueta:
+    #define DESPACHAR goto *despacho[p->operacion]
+#else
+    #define CASO(operacion, etiqueta) case operacion:
+    #define DESPACHAR goto despacho
+#endif
+
+    // Pasa a la instrucción destino, contándola antes de ejecutarla
+    #define SIGUIENTE(destino) { p = (destino); if (n == limite) { motivo = PARADA_LIMITE; goto salir; } \
+                                 n++; if (PERFIL) cuentas[p - inicio]++; DESPACHAR; }
+
+    #define DIRECCION ((r[p->a] + p->inmediato) & mascaraMemoria)
+
+    SIGUIENTE (p);
+
+#if !defined(__GNUC__)
+despacho:
+    switch (p->operacion)
+    {
+#endif
+    CASO (OP_NOP, op_nop)     SIGUIENTE (p + 1);
+    CASO (OP_ADD, op_add)     r[p->c] = r[p->a] + r[p->b]; SIGUIENTE (p + 1);
+    CASO (OP_SUB, op_sub)     r[p->c] = r[p->a] - r[p->b]; SIGUIENTE (p + 1);
+    CASO (OP_AND, op_and)     r[p->c] = r[p->a] & r[p->b]; SIGUIENTE (p + 1);
+    CASO (OP_OR, op_or)       r[p->c] = r[p->a] | r[p->b]; SIGUIENTE (p + 1);
+    CASO (OP_LW, op_lw)       r[p->b] = m[DIRECCION]; SIGUIENTE (p + 1);
+    CASO (OP_SW, op_sw)       m[DIRECCION] = r[p->b]; SIGUIENTE (p + 1);
+    CASO (OP_BEQ, op_beq)
+        if (r[p->a] == r[p->b])
+        {
+            if (inicio + p->inmediato == p)                                      // Bucle de fin
+            {
+                motivo = PARADA_BUCLE;
+                goto salir;
+            }
+            SIGUIENTE (inicio + p->inmediato);
+        }
+        SIGUIENTE (p + 1);
+    CASO (OP_ADDFP, op_addfp) f[p->c] = f[p->a] + f[p->b]; SIGUIENTE (p + 1);
+    CASO (OP_SUBFP, op_subfp) f[p->c] = f[p->a] - f[p->b]; SIGUIENTE (p + 1);
+    CASO (OP_LWFP, op_lwfp)   memcpy (&f[p->b], &m[DIRECCION], sizeof(float)); SIGUIENTE (p + 1);
+    CASO (OP_SWFP, op_swfp)   memcpy (&m[DIRECCION], &f[p->b], sizeof(float)); SIGUIENTE (p + 1);
+    CASO (OP_DESCONOCIDA, op_desconocida) motivo = PARADA_DESCONOCIDA; goto noEjecutada;
+    CASO (OP_FIN, op_fin)                 motivo = PARADA_FIN; goto noEjecutada;
+    CASO (OP_PC_INVALIDO, op_pc_invalido) motivo = PARADA_PC_INVALIDO; goto noEjecutada;
+#if !defined(__GNUC__)
+    }
+#endif
+
+    #undef CASO
+    #undef DESPACHAR
+    #undef SIGUIENTE
+    #undef DIRECCION
+
+noEjecutada:                                                                     // Se contó al despacharla, pero no se ejecuta
+    n--;
+    if (PERFIL) cuentas[p - inicio]--;
+
+salir:
+    pc = p - inicio;
+    pasos += n;
+    return motivo;
+}
+
+}
@@ -0,0 +1,2716 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ * libcumpilador: el ensamblador de cumpilador como biblioteca, sin ficheros ni estado global
+ *
+ * Toda la configuración está en un configuracion_isa, que solo se modifica al cargarla, y todo lo que depende
+ * del programa en un contexto_ensamblado. Se pueden ensamblar a la vez varios programas con la misma
+ * configuración, o con configuraciones distintas, desde varios hilos.
+ *
+ * Uso:
+ *
+ *     cumpilador::configuracion_isa isa (textoConfiguracion);                   // Sintaxis en cumpilador.cpp
+ *     cumpilador::programa_ensamblado programa = cumpilador::ensamblarPrograma (isa, textoPrograma);
+ *     std::string salida = cumpilador::formatearPrograma (cumpilador::modo_salida (isa, cumpilador::SALIDA_INTEL_HEX), programa);
+ *
+ * Un programa ensamblado se puede ejecutar en el simulador funcional:
+ *
+ *     cumpilador::simulador sim (isa, programa);
+ *     cumpilador::motivo_parada motivo = sim.ejecutar (maxPasos, conPerfil);          // sim.registros, sim.memoria...
+ *
+ * Los errores de la configuración y del programa se lanzan como excepciones, con el mismo mensaje que muestra
+ * el ensamblador de línea de comandos.
+ *
+ * NOTA: Compilar con C++17 junto al programa que la use, por ejemplo:
+ *           g++ -O2 -std=c++17 -pthread mi_programa.cpp libcumpilador.cpp
+ *       o como biblioteca estática:
+ *           g++ -O2 -std=c++17 -pthread -c libcumpilador.cpp && ar rcs libcumpilador.a libcumpilador.o
+ *
+ * Para una configuración que no cambia se puede generar una cabecera con generarCabeceraIsa (cumpilador --generar-isa)
+ * y compilar con -DCUMPILADOR_ISA='"cabecera.h"'. Las configuraciones iguales a la generada buscan los mnemónicos
+ * con un hash perfecto y codifican con desplazamientos y máscaras constantes; las demás usan el camino general.
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef LIBCUMPILADOR_H
+#define LIBCUMPILADOR_H
+
+#include <iostream>
+#include <string>
+#include <map>
+#include <unordered_map>
+#include <vector>
+#include <sstream>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <climits>
+#include <string_view>
+#include <charconv>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <chrono>
+
+namespace cumpilador
+{
+
+using namespace std;
+
+
+
+// Formato del fichero de salida
+enum formato_salida
+{
+    SALIDA_TEXTO,                                    // Una palabra BIN o HEX por línea, o LOGISIM_OUT / VHDL_OUT, según la configuración
+    SALIDA_BINARIA,                                  // Imagen binaria con las palabras empaquetadas
+    SALIDA_INTEL_HEX,                                // Intel HEX, con un registro por instrucción
+    SALIDA_READMEMH                                  // Una palabra hexadecimal por línea, para $readmemh de Verilog
+};
+
+const char CH_VARIABLE_CONFIG = '*';                 // Caracter que indica un dato variable en configuración
+const char CH_CONSTANTE_CONFIG = '&';                // Caracter que indica un dato fijo en configuración
+const char CH_ETIQUETA_CONFIG = '#';                 // Caracter que indica una etiqueta en configuración
+
+const int MAX_BITS_CODIFICACION = 128;               // Máximo de bits que puede ocupar la codificación de una instrucción
+const size_t MAX_ID_INSTRUCCION = UINT16_MAX;        // Máximo id de instrucción que cabe en el almacén de instrucciones
+
+
+// Palabra de 128 bits formada por dos palabras de 64, para instrucciones de más de 64 bits
+// Solo implementa las operaciones que usan la codificación y el formateo
+
+struct palabra128
+{
+    uint64_t baja;                                   // Bits 0 a 63
+    uint64_t alta;                                   // Bits 64 a 127
+
+    palabra128 () : baja (0), alta (0) {}
+    palabra128 (uint64_t _baja) : baja (_baja), alta (0) {}
+    palabra128 (uint64_t _alta, uint64_t _baja) : baja (_baja), alta (_alta) {}
+
+    explicit operator uint64_t () const { return baja; }
+
+    palabra128 operator~ () const { return palabra128 (~alta, ~baja); }
+    palabra128 operator| (const palabra128 &o) const { return palabra128 (alta | o.alta, baja | o.baja); }
+    palabra128 operator& (const palabra128 &o) const { return palabra128 (alta & o.alta, baja & o.baja); }
+    palabra128 &operator|= (const palabra128 &o) { alta |= o.alta; baja |= o.baja; return *this; }
+    bool operator== (const palabra128 &o) const { return alta == o.alta && baja == o.baja; }
+    bool operator!= (const palabra128 &o) const { return !(*this == o); }
+
+    palabra128 operator<< (int n) const
+    {
+        if (n == 0) return *this;
+        if (n >= 128) return palabra128 ();
+        if (n >= 64) return palabra128 (baja << (n - 64), 0);
+        return palabra128 ((alta << n) | (baja >> (64 - n)), baja << n);
+    }
+
+    palabra128 operator>> (int n) const
+    {
+        if (n == 0) return *this;
+        if (n >= 128) return palabra128 ();
+        if (n >= 64) return palabra128 (0, alta >> (n - 64));
+        return palabra128 (alta >> n, (baja >> n) | (alta << (64 - n)));
+    }
+};
+
+// Tipo de un operando dentro del plan de codificación de una instrucción
+enum tipo_campo
+{
+    CAMPO_PARAMETRO,                                 // Parámetro normal (prefijo, número y sufijo)
+    CAMPO_ETIQUETA,                                  // Etiqueta o valor con # (dirección absoluta)
+    CAMPO_RELATIVO                                   // Etiqueta con ## y SALTO_RELATIVO (dirección relativa a PC)
+};
+
+// Operando de una instrucción, ya colocado en la palabra de salida
+struct campo_instruccion
+{
+    tipo_campo tipo;                                 // Tipo de operando
+    int desplazamiento;                              // Posición del bit menos significativo del campo en la palabra
+    int nBits;                                       // Número de bits del campo
+    palabra128 mascara;                              // Máscara de nBits bits a 1
+    string prefijo;                                  // Caracteres esperados antes del número (solo parámetros)
+    string sufijo;                                   // Caracteres esperados tras el número (solo parámetros)
+};
+
+// Codificación precompilada de una instrucción de la configuración
+struct plan_instruccion
+{
+    string nombre;                                   // Nombre de la instrucción
+    int id;                                          // Id del nombre en la tabla de instrucciones, y posición en la de planes
+    palabra128 base;                                 // Opcode y relleno & ya colocados en la palabra
+    int nBits;                                       // Número total de bits de la codificación
+    int nParametros;                                 // Número de tokens esperados en el programa (incluido el nombre)
+    vector<campo_instruccion> campos;                // Operandos de la instrucción, en orden de aparición
+};
+
+
+
+// Excepciones
+
+class exception_wrong_config_syntax : public exception
+{
+    public:
+
+    string msg;
+
+    exception_wrong_config_syntax(string _msg)
+    {
+        msg = _msg; 
+    }
+
+    const char * what() const throw() override
+    {
+        return msg.c_str();
+    }
+};
+
+class exception_unknown_instruction : public exception
+{
+    public:
+    
+    string msg;
+
+    exception_unknown_instruction (string instruction, int linea)
+    {
+        stringstream ss;
+        ss << "Instruccion desconocida: \"" << instruction << "\" en la linea " << linea;
+        msg = ss.str();
+    }
+
+    const char * what() const throw() override
+    {
+        
+        return msg.c_str();
+    }
+};
+
+class exception_wrong_instruction_syntax : public exception
+{
+    public:
+
+    string msg;
+
+    exception_wrong_instruction_syntax (string instruction, int linea, string encontrado, string esperado)
+    {
+        stringstream ss;
+        ss << "Error en la sintaxis de la instruccion \"" << instruction << "\" en la linea " << linea << ": Se ha encontrado \"" << 
+            encontrado << "\", se esperaba \"" << esperado << "\"";
+        msg = ss.str();
+    }
+
+    const char * what() const throw() override
+    {
+        return msg.c_str();
+    }
+};
+
+class exception_wrong_label : public exception
+{
+    public:
+
+    string msg;
+
+    exception_wrong_label (string etiqueta, int linea)
+    {
+        stringstream ss;
+        ss << "Etiqueta desconocida \"" << etiqueta << "\" en la linea " << linea;
+        msg = ss.str();
+    }
+
+    // Varias etiquetas desconocidas, como pares de línea y etiqueta
+    exception_wrong_label (const vector<pair<int, string>> &etiquetas)
+    {
+        stringstream ss;
+        for (size_t i = 0; i < etiquetas.size(); i++)
+        {
+            if (i > 0) ss << "\n";
+            ss << "Etiqueta desconocida \"" << etiquetas[i].second << "\" en la linea " << etiquetas[i].first;
+        }
+        msg = ss.str();
+    }
+
+    const char * what() const throw() override
+    {
+        return msg.c_str();
+    }
+};
+
+class exception_wrong_number_of_parameters : public exception
+{
+    public:
+
+    string msg;
+
+    exception_wrong_number_of_parameters (string instruction, int linea)
+    {
+        stringstream ss;
+        ss << "Numero de parametros incorrecto en la instruccion \"" << instruction << "\" en la linea " << linea;
+        msg = ss.str();
+    }
+
+    const char * what() const throw() override
+    {
+        return msg.c_str();
+    }
+};
+
+class exception_wrong_number : public exception
+{
+    public:
+
+    string msg;
+
+    exception_wrong_number (string numero, int linea)
+    {
+        stringstream ss;
+        ss << "Numero incorrecto \"" << numero << "\" en la linea " << linea;
+        msg = ss.str();
+    }
+
+    const char * what() const throw() override
+    {
+        return msg.c_str();
+    }
+};
+
+class exception_wrong_directive : public exception
+{
+    public:
+
+    string msg;
+
+    exception_wrong_directive (string directiva, int linea, string motivo)
+    {
+        stringstream ss;
+        ss << "Directiva \"" << directiva << "\" incorrecta en la linea " << linea << ": " << motivo;
+        msg = ss.str();
+    }
+
+    const char * what() const throw() override
+    {
+        return msg.c_str();
+    }
+};
+
+class exception_pc_overflow : public exception
+{
+    public:
+
+    string msg;
+
+    exception_pc_overflow (string instruction, int linea)
+    {
+        stringstream ss;
+        ss << "Instruccion \"" << instruction << "\" incorrecta en la linea " << linea << ": el PC supera " << INT_MAX;
+        msg = ss.str();
+    }
+
+    const char * what() const throw() override
+    {
+        return msg.c_str();
+    }
+};
+
+class exception_output_overflow : public exception
+{
+    public:
+
+    string msg;
+
+    exception_output_overflow (string _msg)
+    {
+        msg = _msg;
+    }
+
+    const char * what() const throw() override
+    {
+        return msg.c_str();
+    }
+};
+
+class exception_wrong_image : public exception
+{
+    public:
+
+    string msg;
+
+    exception_wrong_image (string _msg)
+    {
+        msg = _msg;
+    }
+
+    const char * what() const throw() override
+    {
+        return msg.c_str();
+    }
+};
+
+class exception_link : public exception
+{
+    public:
+
+    string msg;
+
+    exception_link (string _msg)
+    {
+        msg = _msg;
+    }
+
+    const char * what() const throw() override
+    {
+        return msg.c_str();
+    }
+};
+
+
+// Funciones auxiliares
+
+// Devuelve una máscara con los nBits bits de menor peso a 1
+uint64_t mascaraBits (int nBits);
+
+
+// Hash FNV-1a de 64 bits de un texto, continuando desde hash
+uint64_t hashTexto (string_view texto, uint64_t hash = 0xCBF29CE484222325ull);
+
+
+// Escribe un vector en un fichero binario, precedido de su número de elementos
+
+template <typename T>
+void escribirVector (ostream &f, const vector<T> &v)
+{
+    uint64_t n = v.size();
+    f.write ((const char *) &n, sizeof(n));
+    f.write ((const char *) v.data(), n * sizeof(T));
+}
+
+
+// Lee un vector escrito con escribirVector a partir de p, que avanza. Devuelve false si los datos no llegan
+
+template <typename T>
+bool leerVector (const char *&p, const char *fin, vector<T> &v)
+{
+    uint64_t n;
+    if (fin - p < (ptrdiff_t) sizeof(n))
+        return false;
+    memcpy (&n, p, sizeof(n));
+    p += sizeof(n);
+
+    if ((uint64_t) (fin - p) / sizeof(T) < n)
+        return false;
+    v.resize (n);
+    memcpy (v.data(), p, n * sizeof(T));
+    p += n * sizeof(T);
+    return true;
+}
+
+
+// Número de bits de un tipo de palabra
+
+template <typename palabra_t>
+constexpr int bitsPalabra ()
+{
+    return sizeof(palabra_t) * 8;
+}
+
+
+// Devuelve una palabra con los nBits bits de menor peso a 1
+
+template <typename palabra_t>
+palabra_t mascaraPalabra (int nBits)
+{
+    palabra_t unos = (palabra_t) ~(palabra_t) 0;
+    return nBits >= bitsPalabra<palabra_t>() ? unos : (palabra_t) ~(palabra_t) (unos << nBits);
+}
+
+
+// Convierte una palabra de 128 bits a un tipo de palabra más pequeño, quedándose con los bits de menor peso
+
+template <typename palabra_t>
+palabra_t convertirPalabra (const palabra128 &palabra)
+{
+    return (palabra_t) palabra.baja;
+}
+
+template <>
+inline palabra128 convertirPalabra<palabra128> (const palabra128 &palabra)
+{
+    return palabra;
+}
+
+
+// Extiende el signo de un entero a una palabra
+
+template <typename palabra_t>
+palabra_t extenderSigno (int valor)
+{
+    return (palabra_t) (uint64_t) (int64_t) valor;
+}
+
+template <>
+inline palabra128 extenderSigno<palabra128> (int valor)
+{
+    return palabra128 (valor < 0 ? ~(uint64_t) 0 : 0, (uint64_t) (int64_t) valor);
+}
+
+
+// Devuelve los tamanyo bits de mayor peso de una palabra de nBits bits
+// Si la palabra es más corta se rellena con ceros a la izquierda
+
+template <typename palabra_t>
+palabra_t ventanaInstruccion (palabra_t palabra, int nBits, int tamanyo)
+{
+    if (nBits > tamanyo)
+        palabra = palabra >> (nBits - tamanyo);
+
+    return palabra & mascaraPalabra<palabra_t>(tamanyo);
+}
+
+
+// Tablas de conversión de un byte a texto, para formatear palabras sin pasar por strings ni streams
+
+struct tablas_formato
+{
+    char hex[256][2];                                // Byte a sus dos dígitos hexadecimales
+    char bin[256][8];                                // Byte a sus ocho dígitos binarios
+
+    tablas_formato ()
+    {
+        const char *digitos = "0123456789ABCDEF";
+
+        for (int byte = 0; byte < 256; byte++)
+        {
+            hex[byte][0] = digitos[byte >> 4];
+            hex[byte][1] = digitos[byte & 0xF];
+
+            for (int i = 0; i < 8; i++)
+                bin[byte][i] = (byte >> (7 - i)) & 1 ? '1' : '0';
+        }
+    }
+};
+
+inline const tablas_formato gl_tablas_formato;              // Solo lectura, se comparte entre hilos
+
+
+// Escribe en destino los nDigitos dígitos hexadecimales de menor peso de la palabra
+
+template <typename palabra_t>
+void formatearHex (palabra_t palabra, int nDigitos, char *destino)
+{
+    char *p = destino + nDigitos;
+
+    for (; nDigitos >= 2; nDigitos -= 2)                             // De dos en dos dígitos, desde el final
+    {
+        p -= 2;
+        memcpy (p, gl_tablas_formato.hex[(uint64_t) palabra & 0xFF], 2);
+        if (nDigitos > 2)
+            palabra = palabra >> 8;
+    }
+
+    if (nDigitos == 1)
+        *--p = gl_tablas_formato.hex[(uint64_t) palabra & 0xF][1];
+}
+
+
+// Escribe en destino los nBits bits de menor peso de la palabra
+
+template <typename palabra_t>
+void formatearBin (palabra_t palabra, int nBits, char *destino)
+{
+    char *p = destino + nBits;
+
+    for (; nBits >= 8; nBits -= 8)                                    // De ocho en ocho bits, desde el final
+    {
+        p -= 8;
+        memcpy (p, gl_tablas_formato.bin[(uint64_t) palabra & 0xFF], 8);
+        if (nBits > 8)
+            palabra = palabra >> 8;
+    }
+
+    for (; nBits > 0; nBits--, palabra = palabra >> 1)
+        *--p = (uint64_t) palabra & 1 ? '1' : '0';
+}
+
+
+// Convierte una palabra de nBits bits a un string binario
+
+template <typename palabra_t>
+string palabraToBin (palabra_t palabra, int nBits)
+{
+    string salida (nBits, '0');
+    formatearBin (palabra, nBits, &salida[0]);
+    return salida;
+}
+
+
+// Convierte una palabra de nBits bits a un string hexadecimal de tamanyo bits
+
+template <typename palabra_t>
+string palabraToHex (palabra_t palabra, int nBits, int tamanyo)
+{
+    string salida ((tamanyo + 3) / 4, '0');
+    formatearHex (ventanaInstruccion(palabra, nBits, tamanyo), salida.size(), &salida[0]);
+    return salida;
+}
+
+
+// Convierte un string a decimal
+// El string puede ser un decimal, hexadecimal comenzado con 0x o un caracter entre ''
+int to_decimal (string_view numero, int linea);
+
+
+// Analizador léxico del código ensamblador
+// Recorre el texto línea a línea y deja los tokens de cada una como vistas sobre el propio texto, sin copiarlos
+// Acepta finales de línea \n y \r\n, tabuladores como separadores y una última línea sin \n
+
+class lexer
+{
+    private:
+
+        string_view texto;                                     // Texto completo a analizar
+        size_t pos;                                            // Posición del inicio de la siguiente línea
+
+    public:
+
+        vector<string_view> tokens;                            // Tokens de la última línea leída, sin comentarios
+        const char *inicioLinea = nullptr;                     // Primer caracter de la última línea leída, para las columnas
+        const char *finLinea = nullptr;                        // Final de la última línea leída, con su comentario
+
+        // Constructor
+        lexer (string_view _texto) : texto (_texto)
+        {
+            pos = 0;
+        }
+
+        // Lee la siguiente línea y la separa en tokens
+        // Devuelve false si no quedan líneas
+        bool siguienteLinea ()
+        {
+            if (pos >= texto.size())
+                return false;
+
+            const char *inicio = texto.data() + pos;
+            const char *final = (const char *) memchr (inicio, '\n', texto.size() - pos);
+            inicioLinea = inicio;
+
+            if (final == nullptr)                                                   // Última línea sin \n
+                final = texto.data() + texto.size();
+            finLinea = final;
+
+            pos = final - texto.data() + 1;
+
+            const char *comentario = (const char *) memchr (inicio, ';', final - inicio);
+            if (comentario != nullptr)                                              // Descarta el comentario
+                final = comentario;
+
+            tokens.clear();
+
+            const char *p = inicio;
+            while (p < final)
+            {
+                while (p < final && esSeparador(*p))                                // Salta los separadores
+                    p++;
+
+                const char *token = p;
+                while (p < final && !esSeparador(*p))
+                    p++;
+
+                if (p > token)
+                    tokens.emplace_back (token, p - token);
+            }
+
+            return true;
+        }
+
+        static bool esSeparador (char c)
+        {
+            return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+        }
+};
+
+
+
+// Fichero de solo lectura proyectado en memoria
+
+class fichero_mapeado
+{
+    private:
+
+        const char *datos;                                     // Contenido del fichero
+        size_t tamanyo;                                        // Tamaño del fichero en bytes
+        bool abierto;                                          // El fichero se ha podido abrir
+        void *fichero;                                         // En Windows, el HANDLE del fichero
+        void *proyeccion;                                      // En Windows, el HANDLE de la proyección
+
+    public:
+
+        // Constructor, proyecta el fichero ruta
+        fichero_mapeado (const char *ruta);
+
+        ~fichero_mapeado ();
+
+        fichero_mapeado (const fichero_mapeado &) = delete;
+        fichero_mapeado &operator= (const fichero_mapeado &) = delete;
+
+        bool is_open () const
+        {
+            return abierto;
+        }
+
+        string_view contenido () const
+        {
+            return string_view (datos, tamanyo);
+        }
+};
+
+
+
+// Directivas de colocación en memoria y de datos
+
+// Palabras que ocupa una directiva entre las instrucciones
+struct relleno_memoria
+{
+    size_t antesDe = 0;                              // Instrucción delante de la que va (el total de instrucciones si va al final)
+    int direccion = 0;                               // Primera palabra que ocupa
+    int n = 0;                                       // Palabras que ocupa
+    int valor = 0;                                   // Valor de cada palabra de .fill, extendido al tamaño de instrucción
+    bool hueco = true;                               // Hueco sin contenido de .org, .align o .space; si no, datos
+    vector<int> valores;                             // Palabras de .word y .ascii, en lugar de valor
+    shared_ptr<const fichero_mapeado> binario;       // Fichero de .incbin, en palabras de TAMANYO_INSTRUCCION / 8 bytes
+};
+
+
+// Si la línea es una directiva, avanza i_PC y deja en relleno las palabras que ocupa
+// Devuelve false si no es una directiva. Los errores se lanzan como exception_wrong_directive
+// Colocación: .org N, .align N, .space N y .fill N [valor]
+// Datos: .word valor..., .ascii "texto" y .incbin "fichero"; las cadenas se leen de la línea sin partir en tokens
+bool leerDirectiva (const lexer &lex, int tamanyoInstruccion, int i_linea, int &i_PC, relleno_memoria &relleno);
+
+
+// Si la línea es una directiva .global, que exporta las etiquetas que la siguen, las añade a exportadas con su línea
+// Devuelve false si no lo es. Al ensamblar un programa entero no tiene efecto; solo la usan los objetos reubicables
+bool leerGlobal (const lexer &lex, int i_linea, vector<pair<string_view, int>> *exportadas = nullptr);
+
+
+// Indica si el texto puede tener directivas que fijan el PC (.org y .align), que impiden leerlo por trozos en paralelo
+bool contieneDirectivas (string_view texto);
+
+
+
+// Clases
+
+// Arena de memoria
+// Reparte la memoria de bloques grandes avanzando un puntero, y solo la libera entera al destruirse
+
+class arena
+{
+    private:
+
+        static constexpr size_t TAMANYO_BLOQUE = 1 << 20;      // Tamaño mínimo de cada bloque pedido al sistema
+
+        vector<unique_ptr<char[]>> bloques;                    // Bloques reservados
+        char *actual;                                          // Siguiente byte libre del último bloque
+        size_t libre;                                          // Bytes libres en el último bloque
+        size_t nReservas;                                      // Bloques pedidos al sistema, incluidos los ya liberados
+        size_t bytesReservados;                                // Bytes pedidos al sistema, incluidos los ya liberados
+
+    public:
+
+        arena ()
+        {
+            actual = nullptr;
+            libre = 0;
+            nReservas = 0;
+            bytesReservados = 0;
+        }
+
+        arena (const arena &) = delete;
+        arena &operator= (const arena &) = delete;
+
+        // Reserva bytes alineados a alineacion (potencia de 2)
+        void *reservar (size_t bytes, size_t alineacion)
+        {
+            size_t relleno = (alineacion - (uintptr_t) actual % alineacion) % alineacion;
+
+            if (actual == nullptr || relleno + bytes > libre)                  // No cabe en el bloque actual
+            {
+                size_t tamanyo = max (TAMANYO_BLOQUE, bytes + alineacion);
+                bloques.emplace_back (new char[tamanyo]);
+                nReservas++;
+                bytesReservados += tamanyo;
+                actual = bloques.back().get();
+                libre = tamanyo;
+                relleno = (alineacion - (uintptr_t) actual % alineacion) % alineacion;
+            }
+
+            void *resultado = actual + relleno;
+            actual += relleno + bytes;
+            libre -= relleno + bytes;
+            return resultado;
+        }
+
+        // Libera toda la memoria repartida
+        void vaciar ()
+        {
+            bloques.clear();
+            actual = nullptr;
+            libre = 0;
+        }
+
+        // Devuelve el número de bloques pedidos al sistema
+        size_t reservas () const
+        {
+            return nReservas;
+        }
+
+        // Devuelve el número de bytes pedidos al sistema
+        size_t bytes () const
+        {
+            return bytesReservados;
+        }
+};
+
+
+// Tabla de símbolos
+// Guarda cada nombre una sola vez y le asigna un id denso (0, 1, 2...), para que el resto del
+// ensamblador trabaje con enteros. Es una tabla hash de direccionamiento abierto con sondeo lineal
+
+class tabla_simbolos
+{
+    public:
+
+        // Hueco de la tabla hash, de tamaño fijo para poder guardar la tabla tal cual en un fichero
+        struct hueco
+        {
+            uint32_t id;                                       // Id del símbolo + 1, 0 si el hueco está libre
+            uint32_t hash;                                     // Parte baja del hash del símbolo, para descartar rápido
+        };
+
+    private:
+
+        vector<hueco> huecos;                                  // Tabla hash, su tamaño es potencia de 2
+        vector<string_view> nombres;                           // Nombre de cada símbolo, por id
+        arena memoria;                                         // Copia de los nombres
+
+        static uint64_t calcularHash (string_view nombre)
+        {
+            uint64_t hash = 0x9E3779B97F4A7C15ull ^ nombre.size();
+            size_t i = 0;
+
+            for (; i + 8 <= nombre.size(); i += 8)             // De ocho en ocho bytes
+            {
+                uint64_t bloque;
+                memcpy (&bloque, nombre.data() + i, 8);
+                hash = (hash ^ bloque) * 0xFF51AFD7ED558CCDull;
+                hash ^= hash >> 32;
+            }
+
+            for (; i < nombre.size(); i++)
+                hash = (hash ^ (unsigned char) nombre[i]) * 0x100000001B3ull;
+
+            hash ^= hash >> 29;
+            hash *= 0xC4CEB9FE1A85EC53ull;
+            return hash ^ (hash >> 32);
+        }
+
+        // Devuelve el hueco del nombre, o el hueco libre donde iría
+        size_t buscarHueco (string_view nombre, uint64_t hash) const
+        {
+            size_t mascara = huecos.size() - 1;
+
+            for (size_t h = hash & mascara; ; h = (h + 1) & mascara)
+            {
+                const hueco &actual = huecos[h];
+
+                if (actual.id == 0 || (actual.hash == (uint32_t) hash && nombres[actual.id - 1] == nombre))
+                    return h;
+            }
+        }
+
+        void crecer ()
+        {
+            vector<hueco> anteriores (max<size_t> (16, huecos.size() * 2));
+            anteriores.swap (huecos);
+
+            for (const hueco &h : anteriores)                                 // Recoloca los símbolos
+            {
+                if (h.id != 0)
+                    huecos[buscarHueco (nombres[h.id - 1], calcularHash (nombres[h.id - 1]))] = h;
+            }
+        }
+
+    public:
+
+        tabla_simbolos ()
+        {
+            crecer ();
+        }
+
+        tabla_simbolos (const tabla_simbolos &) = delete;
+        tabla_simbolos &operator= (const tabla_simbolos &) = delete;
+
+        // Devuelve el id del símbolo, o -1 si no está en la tabla
+        int buscar (string_view nombre) const
+        {
+            const hueco &h = huecos[buscarHueco (nombre, calcularHash (nombre))];
+            return (int) h.id - 1;
+        }
+
+        // Devuelve el id del símbolo, añadiéndolo a la tabla si no estaba
+        int internar (string_view nombre)
+        {
+            uint64_t hash = calcularHash (nombre);
+            size_t h = buscarHueco (nombre, hash);
+
+            if (huecos[h].id != 0)
+                return huecos[h].id - 1;
+
+            char *copia = (char *) memoria.reservar (nombre.size() + 1, 1);    // El nombre pasa a ser de la tabla
+            memcpy (copia, nombre.data(), nombre.size());
+            nombres.emplace_back (copia, nombre.size());
+            huecos[h] = {(uint32_t) nombres.size(), (uint32_t) hash};
+
+            if (nombres.size() * 2 > huecos.size())                           // Mantiene la ocupación por debajo de la mitad
+                crecer ();
+
+            return nombres.size() - 1;
+        }
+
+        // Devuelve el nombre del símbolo id
+        string_view nombre (int id) const
+        {
+            return nombres[id];
+        }
+
+        // Número de símbolos
+        size_t size () const
+        {
+            return nombres.size();
+        }
+
+        // Huecos de la tabla hash, para guardarla con los nombres y volver a cargarla con cargar
+        const vector<hueco> &tabla () const
+        {
+            return huecos;
+        }
+
+        // Carga en la tabla, que debe estar vacía, los huecos y los nombres de otra sin recolocar los símbolos
+        // Devuelve false, sin cambiar la tabla, si no cuadran: tamaño potencia de 2 con menos de la mitad ocupada
+        // y cada nombre en un solo hueco con la parte baja de su hash
+        bool cargar (const hueco *huecosTabla, size_t nHuecos, const vector<string_view> &nombresTabla)
+        {
+            if (nHuecos < 16 || (nHuecos & (nHuecos - 1)) != 0 || nombresTabla.size() * 2 > nHuecos || !nombres.empty())
+                return false;
+
+            vector<uint8_t> visto (nombresTabla.size(), 0);
+            size_t bytes = 0;
+            for (size_t h = 0; h < nHuecos; h++)
+            {
+                uint32_t id = huecosTabla[h].id;
+                if (id == 0)
+                    continue;
+                if (id > nombresTabla.size() || visto[id - 1]
+                    || huecosTabla[h].hash != (uint32_t) calcularHash (nombresTabla[id - 1]))
+                    return false;
+
+                visto[id - 1] = 1;
+                bytes += nombresTabla[id - 1].size() + 1;
+            }
+            if (find (visto.begin(), visto.end(), 0) != visto.end())
+                return false;
+
+            huecos.assign (huecosTabla, huecosTabla + nHuecos);
+            char *copia = (char *) memoria.reservar (max<size_t> (bytes, 1), 1);         // Todos los nombres de una vez
+            for (string_view nombre : nombresTabla)
+            {
+                memcpy (copia, nombre.data(), nombre.size());
+                nombres.emplace_back (copia, nombre.size());
+                copia += nombre.size() + 1;
+            }
+            return true;
+        }
+};
+
+
+// Configuración de un juego de instrucciones, leída del fichero de configuración
+// Solo se modifica al cargarla; después se puede compartir entre varios ensamblados a la vez
+
+struct configuracion_isa
+{
+    bool hexOut = false;                             // Da la salida en hexadecimal en lugar de en binario
+    bool logisimOut = false;                         // Imprime la salida en un formato compatible con la rom de logisim
+    bool vhdlOut = false;                            // Imprime la salida en un formato compatible con las memorias VHDL
+    bool saltoRelativo = false;                      // Si se habilita, los saltos se calcularán relativos a PC
+    int tamanyoInstruccion = 32;                     // Tamaño de una instrucción en bits, se puede cambiar en la configuración
+    bool fija = false;                               // Es la configuración de CUMPILADOR_ISA, con sus tablas constexpr
+
+    tabla_simbolos instrucciones;                    // Nombres de las instrucciones, su id es el de su plan
+    vector <plan_instruccion> planes;                // Planes de las instrucciones, indexados por su id
+    tabla_simbolos constantes;                       // Nombres de las constantes en configuración
+    vector <string> valores;                         // Valor de cada constante de configuración, por id
+
+    // Configuración vacía
+    configuracion_isa () {}
+
+    // Carga la configuración del texto de un fichero de configuración
+    configuracion_isa (string_view texto);
+};
+
+
+// Juego de instrucciones fijo de la cabecera generada, en isa_fija
+
+#ifdef CUMPILADOR_ISA
+#include CUMPILADOR_ISA
+#endif
+
+
+// Modo de salida: el formato del fichero y, para la salida de texto, las opciones de la configuración
+// Todas las palabras se recortan o rellenan a tamanyoInstruccion bits, salvo en la salida BIN
+
+struct modo_salida
+{
+    formato_salida formato = SALIDA_TEXTO;           // Formato del fichero de salida
+    bool littleEndian = true;                        // Orden de los bytes de cada palabra en la salida binaria e Intel HEX
+    bool hexOut = false;                             // Salida de texto en hexadecimal en lugar de en binario
+    bool logisimOut = false;                         // Salida de texto para la rom de logisim
+    bool vhdlOut = false;                            // Salida de texto para las memorias VHDL
+    int tamanyoInstruccion = 32;                     // Bits de cada palabra
+    bool compactar = false;                          // LOGISIM_OUT con rachas N*valor y VHDL_OUT con índices y others
+
+    modo_salida () {}
+
+    // Modo con las opciones de texto y el tamaño de instrucción de la configuración
+    modo_salida (const configuracion_isa &isa, formato_salida _formato = SALIDA_TEXTO, bool _littleEndian = true, bool _compactar = false)
+        : formato (_formato), littleEndian (_littleEndian), hexOut (isa.hexOut), logisimOut (isa.logisimOut),
+          vhdlOut (isa.vhdlOut), tamanyoInstruccion (isa.tamanyoInstruccion), compactar (_compactar)
+    {
+    }
+
+    // Indica si la salida se compacta: solo el texto de LOGISIM_OUT y VHDL_OUT
+    bool compacta () const
+    {
+        return compactar && formato == SALIDA_TEXTO && (logisimOut || vhdlOut);
+    }
+};
+
+
+// Etiquetas de un programa: sus nombres, como tabla de símbolos, y el valor de las ya definidas
+// Cada ensamblado tiene la suya, así que se pueden ensamblar varios programas a la vez
+
+class tabla_etiquetas : public tabla_simbolos
+{
+    private:
+
+        vector <int> direcciones;                              // Dirección de cada etiqueta, por id
+        vector <char> definidas;                               // Si cada etiqueta se ha definido, por id
+
+    public:
+
+        // Define la etiqueta id con el valor dado
+        void definir (int id, int valor)
+        {
+            if (id >= direcciones.size())
+            {
+                direcciones.resize (size());
+                definidas.resize (size(), false);
+            }
+
+            direcciones[id] = valor;
+            definidas[id] = true;
+        }
+
+        // Indica si la etiqueta id se ha definido
+        bool definida (int id) const
+        {
+            return id < definidas.size() && definidas[id];
+        }
+
+        // Devuelve el valor de la etiqueta id, que debe estar definida
+        int direccion (int id) const
+        {
+            return direcciones[id];
+        }
+};
+
+
+
+
+// Columna de un almacén: array que crece por bloques sacados de una arena
+// Los elementos nunca se mueven al crecer, y el acceso por índice es un desplazamiento y una máscara
+
+template <typename T>
+class columna
+{
+    private:
+
+        static const int BITS_BLOQUE = 14;                     // Elementos por bloque: 2^BITS_BLOQUE
+        static const size_t ELEMENTOS_BLOQUE = (size_t) 1 << BITS_BLOQUE;
+
+        arena *memoria;                                        // Arena de la que salen los bloques
+        vector<T*> bloques;                                    // Bloques de la columna
+        size_t n;                                              // Número de elementos
+
+    public:
+
+        columna (arena &_memoria) : memoria (&_memoria)
+        {
+            n = 0;
+        }
+
+        void push_back (T valor)
+        {
+            if (n % ELEMENTOS_BLOQUE == 0)
+                bloques.push_back ((T *) memoria->reservar (ELEMENTOS_BLOQUE * sizeof(T), alignof(T)));
+
+            bloques.back()[n % ELEMENTOS_BLOQUE] = valor;
+            n++;
+        }
+
+        T &operator[] (size_t i)
+        {
+            return bloques[i >> BITS_BLOQUE][i & (ELEMENTOS_BLOQUE - 1)];
+        }
+
+        const T &operator[] (size_t i) const
+        {
+            return bloques[i >> BITS_BLOQUE][i & (ELEMENTOS_BLOQUE - 1)];
+        }
+
+        size_t size () const
+        {
+            return n;
+        }
+
+        // Deja la columna vacía, sus bloques se liberan al vaciar la arena
+        void vaciar ()
+        {
+            bloques.clear();
+            n = 0;
+        }
+};
+
+
+// Contadores de un almacén de instrucciones, para --stats
+struct contadores_almacen
+{
+    size_t busquedasMnemonico = 0;                   // Nombres de instrucción buscados en la configuración
+    size_t busquedasEtiqueta = 0;                    // Etiquetas de operandos internadas en la tabla de símbolos
+    size_t reservas = 0;                             // Bloques de memoria pedidos al sistema
+    size_t bytesReservados = 0;                      // Bytes de memoria pedidos al sistema
+};
+
+
+// Almacén contiguo de las instrucciones del programa, guardado como estructura de arrays
+// De cada instrucción se guarda el id de su plan, su línea, su PC y sus operandos. Los operandos que son etiquetas
+// se guardan ya como id de símbolo; el resto, como posición y longitud dentro del texto fuente,
+// que tiene que seguir proyectado mientras se use el almacén
+
+class almacen_instrucciones
+{
+    private:
+
+        static const int BITS_LONGITUD = 24;                   // Bits de la longitud en un operando empaquetado
+        static const uint64_t ES_SIMBOLO = (uint64_t) 1 << 63; // Marca de un operando que es un id de símbolo
+
+        arena memoria;                                         // Memoria de todas las columnas
+        const configuracion_isa *isa;                          // Configuración con la que se leen las instrucciones
+        const char *texto;                                     // Inicio del texto fuente
+        tabla_simbolos *simbolos;                              // Tabla en la que se internan las etiquetas de los operandos
+        contadores_almacen heredados;                          // Contadores de los almacenes ya añadidos a este, y búsquedas propias
+
+    public:
+
+        columna<uint16_t> mnemonicos;                          // Id del plan de cada instrucción
+        columna<int32_t> lineas;                               // Línea de cada instrucción
+        columna<int32_t> pcs;                                  // PC de cada instrucción
+        columna<uint32_t> primerOperando;                      // Índice en operandos del primer operando de cada instrucción
+        columna<uint64_t> operandos;                           // Operandos: posición en el texto << BITS_LONGITUD | longitud, o ES_SIMBOLO | id
+        vector<relleno_memoria> rellenos;                      // Palabras de las directivas, en orden
+
+        // Constructor, los operandos se guardan relativos a _texto y sus etiquetas se internan en _simbolos
+        almacen_instrucciones (const configuracion_isa &_isa, const char *_texto, tabla_simbolos &_simbolos)
+            : isa (&_isa), texto (_texto), simbolos (&_simbolos),
+            mnemonicos (memoria), lineas (memoria), pcs (memoria), primerOperando (memoria), operandos (memoria)
+        {
+        }
+
+        // Añade una instrucción a partir de sus tokens, comprobando su nombre y su número de parámetros
+        void anyadir (const vector<string_view> &tokens, int i_linea, int i_PC)
+        {
+#ifdef CUMPILADOR_ISA
+            int id = isa->fija ? isa_fija::buscarMnemonico(tokens[0]) : isa->instrucciones.buscar(tokens[0]);
+#else
+            int id = isa->instrucciones.buscar(tokens[0]);
+#endif
+            heredados.busquedasMnemonico++;
+            if (id < 0)
+            {
+                throw exception_unknown_instruction(string(tokens[0]), i_linea);
+            }
+
+            const plan_instruccion &plan = isa->planes[id];
+
+            if (tokens.size() != plan.nParametros)                             // Número de parámetros incorrecto
+            {
+                exception_wrong_number_of_parameters exc (string(tokens[0]), i_linea);
+                throw exc;
+            }
+
+            mnemonicos.push_back(id);
+            lineas.push_back(i_linea);
+            pcs.push_back(i_PC);
+            primerOperando.push_back(operandos.size());
+
+            for (size_t t = 1; t < tokens.size(); t++)
+            {
+                if (plan.campos[t - 1].tipo != CAMPO_PARAMETRO && tokens[t][0] != CH_ETIQUETA_CONFIG)    // Es una etiqueta
+                {
+                    operandos.push_back(ES_SIMBOLO | simbolos->internar(tokens[t]));
+                    heredados.busquedasEtiqueta++;
+                    continue;
+                }
+
+                if (tokens[t].size() >> BITS_LONGITUD)
+                {
+                    exception_wrong_instruction_syntax exc (string(tokens[0]), i_linea, "un operando demasiado largo", "un operando");
+                    throw exc;
+                }
+
+                operandos.push_back((uint64_t)(tokens[t].data() - texto) << BITS_LONGITUD | tokens[t].size());
+            }
+        }
+
+        // Añade el relleno de una directiva tras las instrucciones ya añadidas
+        void anyadirRelleno (relleno_memoria relleno)
+        {
+            relleno.antesDe = size();
+            rellenos.push_back(relleno);
+        }
+
+        // Añade las instrucciones de otro almacén sobre el mismo texto, desplazando sus líneas y PCs
+        // y pasando sus etiquetas a la tabla de símbolos de este
+        void anyadir (const almacen_instrucciones &otro, int lineaBase, int pcBase)
+        {
+            uint32_t operandoBase = operandos.size();
+
+            for (relleno_memoria relleno : otro.rellenos)
+            {
+                relleno.antesDe += size();
+                relleno.direccion += pcBase;
+                rellenos.push_back(relleno);
+            }
+            vector<int> reasignacion (otro.simbolos->size());                  // Id de cada símbolo del otro almacén en este
+
+            for (size_t id = 0; id < reasignacion.size(); id++)
+                reasignacion[id] = simbolos->internar(otro.simbolos->nombre(id));
+
+            contadores_almacen deOtro = otro.contadores();
+            heredados.busquedasMnemonico += deOtro.busquedasMnemonico;
+            heredados.busquedasEtiqueta += deOtro.busquedasEtiqueta + reasignacion.size();
+            heredados.reservas += deOtro.reservas;
+            heredados.bytesReservados += deOtro.bytesReservados;
+
+            for (size_t i = 0; i < otro.size(); i++)
+            {
+                mnemonicos.push_back(otro.mnemonicos[i]);
+                lineas.push_back(otro.lineas[i] + lineaBase);
+                pcs.push_back(otro.pcs[i] + pcBase);
+                primerOperando.push_back(otro.primerOperando[i] + operandoBase);
+            }
+
+            for (size_t o = 0; o < otro.operandos.size(); o++)
+            {
+                uint64_t empaquetado = otro.operandos[o];
+                if (empaquetado & ES_SIMBOLO)
+                    empaquetado = ES_SIMBOLO | reasignacion[empaquetado & ~ES_SIMBOLO];
+                operandos.push_back(empaquetado);
+            }
+        }
+
+        // Devuelve el operando k (desde 0) de la instrucción i
+        string_view operando (size_t i, int k) const
+        {
+            uint64_t empaquetado = operandos[primerOperando[i] + k];
+
+            if (empaquetado & ES_SIMBOLO)
+                return simbolos->nombre(empaquetado & ~ES_SIMBOLO);
+            return string_view (texto + (empaquetado >> BITS_LONGITUD), empaquetado & mascaraBits(BITS_LONGITUD));
+        }
+
+        // Devuelve el plan de codificación de la instrucción i
+        const plan_instruccion &plan (size_t i) const
+        {
+            return isa->planes[mnemonicos[i]];
+        }
+
+        // Devuelve la configuración con la que se han leído las instrucciones
+        const configuracion_isa &obtenerIsa () const
+        {
+            return *isa;
+        }
+
+        // Devuelve el id de símbolo del operando k de la instrucción i, o -1 si no es una etiqueta
+        int simbolo (size_t i, int k) const
+        {
+            uint64_t empaquetado = operandos[primerOperando[i] + k];
+            return empaquetado & ES_SIMBOLO ? (int) (empaquetado & ~ES_SIMBOLO) : -1;
+        }
+
+        // Número de instrucciones
+        size_t size () const
+        {
+            return mnemonicos.size();
+        }
+
+        // Devuelve las búsquedas y reservas de memoria de este almacén y de los añadidos a él
+        contadores_almacen contadores () const
+        {
+            contadores_almacen total = heredados;
+            total.reservas += memoria.reservas();
+            total.bytesReservados += memoria.bytes();
+            return total;
+        }
+
+        // Elimina todas las instrucciones y libera su memoria
+        void vaciar ()
+        {
+            mnemonicos.vaciar();
+            lineas.vaciar();
+            pcs.vaciar();
+            primerOperando.vaciar();
+            operandos.vaciar();
+            memoria.vaciar();
+            rellenos.clear();
+        }
+};
+
+
+// Lanza un error con todas las etiquetas usadas en el código que no se han definido,
+// cada una con la primera línea en la que aparece, ordenadas por línea
+void lanzarEtiquetasDesconocidas (const almacen_instrucciones &codigo, const tabla_etiquetas &etiquetas);
+
+
+// Instrucción del programa, vista sobre su entrada en el almacén de instrucciones
+
+class instruccion
+{
+    private:
+        
+        const almacen_instrucciones *almacen;                  // Almacén que contiene la instrucción
+        size_t indice;                                         // Posición de la instrucción en el almacén
+        const plan_instruccion *plan;                          // Plan de codificación de la instrucción
+        int i_linea;                                           // Número de línea de la instrucción
+        int i_PC;                                              // Número de PC de la instrucción
+    
+    public:
+        
+        // Constructor
+        instruccion (const almacen_instrucciones &_almacen, size_t _indice) : almacen (&_almacen), indice (_indice)
+        {   
+            plan = &almacen->plan(indice);
+            i_linea = almacen->lineas[indice];
+            i_PC = almacen->pcs[indice];
+        }
+        
+        // Devuelve la instrucción ensamblador, legible por humanos 
+        std::string to_string ()                               
+        {
+            string salida = plan->nombre + " ";
+            for (int c = 0; c < plan->campos.size(); c++)
+            {
+                salida += string(almacen->operando(indice, c)) + " ";   
+            }
+            return salida;
+        }                  
+
+        // Ensambla la instrucción con los valores de etiquetas y la devuelve como palabra de plan->nBits bits, que deben caber en palabra_t
+        // Si se da pendientes, los campos con etiquetas aún no definidas se dejan a 0 y su índice se añade a pendientes
+        template <typename palabra_t>
+        palabra_t codificar (const tabla_etiquetas &etiquetas, vector<int> *pendientes = nullptr)
+        {
+            palabra_t palabra = convertirPalabra<palabra_t>(plan->base);
+#ifdef CUMPILADOR_ISA
+            int valores[isa_fija::MAX_CAMPOS] = {};                                                       // Campos para isa_fija::codificar
+            bool fija = almacen->obtenerIsa().fija;
+#endif
+
+            leerCampos (etiquetas, pendientes, [&] (int c, int valor)
+            {
+#ifdef CUMPILADOR_ISA
+                if (fija)
+                {
+                    valores[c] = valor;
+                    return;
+                }
+#endif
+                palabra |= colocarCampo<palabra_t>(plan->campos[c], valor);                               // Añade los bits correspondientes a la instrucción
+            });
+
+#ifdef CUMPILADOR_ISA
+            if (fija)
+                return isa_fija::codificar<palabra_t>(plan->id, valores);
+#endif
+            return palabra;
+        }
+
+        // Lee los operandos de la instrucción y llama a usar (c, valor) con el valor de cada campo c, relativo a PC en los ##
+        // Si se da pendientes, los campos con etiquetas aún no definidas se saltan y su índice se añade a pendientes
+        template <typename funcion_t>
+        void leerCampos (const tabla_etiquetas &etiquetas, vector<int> *pendientes, funcion_t &&usar)
+        {
+            for (int c = 0; c < plan->campos.size(); c++)
+            {
+                const campo_instruccion &campo = plan->campos[c];
+                int valor;
+
+                if (campo.tipo != CAMPO_PARAMETRO)                                                        // Es una etiqueta o un valor
+                {
+                    int etiqueta = almacen->simbolo(indice, c);
+
+                    if (etiqueta >= 0)                                                                    // Es una etiqueta
+                    {
+                        if (!etiquetas.definida(etiqueta))                                                // La etiqueta no existe
+                        {
+                            if (pendientes != nullptr)                                                    // Se resolverá al definirse
+                            {
+                                pendientes->push_back(c);
+                                continue;
+                            }
+
+                            lanzarEtiquetasDesconocidas(*almacen, etiquetas);
+                        }
+
+                        valor = valorEtiqueta(campo, etiquetas.direccion(etiqueta));                      // Obtiene la dirección de la etiqueta
+                    }
+                    else valor = to_decimal(almacen->operando(indice, c).substr(1), i_linea);             // Obtiene la dirección del número
+                }
+                else                                                                                      // Es un parámetro normal
+                {
+                    string_view token = almacen->operando(indice, c);
+                    const string &esperado = campo.prefijo;                                               // Parte inicial esperada
+                    const string &esperadoFinal = campo.sufijo;                                           // Parte final esperada
+
+                    size_t inicioNumero = min(esperado.size(), token.size());                             // Posición del primer caracter del número
+                    size_t finNumero = inicioNumero;                                                      // Posición del primer caracter no numérico
+                    int decimal = 0;
+                    for (; finNumero < token.size() && token[finNumero] >= '0' && token[finNumero] <= '9'; finNumero++)
+                        decimal = decimal * 10 + (token[finNumero] - '0');                                // Solo vale con hasta 9 cifras
+
+                    if (token.compare(0, inicioNumero, esperado) != 0                                     // Nombre del parámetro incorrecto
+                        || token.compare(finNumero, string::npos, esperadoFinal) != 0)
+                        lanzarSintaxisIncorrecta (campo, token, inicioNumero, finNumero);
+
+                    size_t cifras = finNumero - inicioNumero;
+                    if (cifras >= 1 && cifras <= 9 && (token[inicioNumero] != '0' || finNumero == token.size() || token[finNumero] != 'x'))
+                        valor = decimal;                                                                  // Lo mismo que daría to_decimal
+                    else
+                        valor = to_decimal(token.substr(inicioNumero), i_linea);                          // Ignora los caracteres no numéricos finales
+                }
+
+                usar (c, valor);
+            }
+        }
+
+        // Lanza el error de un parámetro que no tiene el prefijo o el sufijo de su campo
+        [[noreturn]] void lanzarSintaxisIncorrecta (const campo_instruccion &campo, string_view token, size_t inicioNumero, size_t finNumero)
+        {
+            if (campo.sufijo != "" || finNumero != token.size())
+            {
+                exception_wrong_instruction_syntax exc (plan->nombre, i_linea, string(token), campo.prefijo + "*" + campo.sufijo);
+                throw exc;
+            }
+            exception_wrong_instruction_syntax exc (plan->nombre, i_linea, string(token.substr(0, inicioNumero)), campo.prefijo);
+            throw exc;
+        }
+
+        // Devuelve el valor de un campo de etiqueta de la instrucción cuando la etiqueta vale direccion
+        int valorEtiqueta (const campo_instruccion &campo, int direccion)
+        {
+            if (campo.tipo == CAMPO_RELATIVO)
+                return direccion - (i_PC + 1);                                                            // Dirección relativa a la instrucción
+            else
+                return direccion;
+        }
+
+        // Devuelve los bits del valor que caben en el campo, ya colocados en su posición de la palabra
+        template <typename palabra_t>
+        static palabra_t colocarCampo (const campo_instruccion &campo, int valor)
+        {
+            palabra_t bits = extenderSigno<palabra_t>(valor) & convertirPalabra<palabra_t>(campo.mascara);
+            return bits << campo.desplazamiento;
+        }
+
+        // Devuelve el plan de codificación de la instrucción
+        const plan_instruccion &obtenerPlan ()
+        {
+            return *plan;
+        }
+
+        // Devuelve el operando c (desde 0) tal y como aparece en el código
+        string_view operando (int c)
+        {
+            return almacen->operando(indice, c);
+        }
+
+        // Devuelve la línea de la instrucción
+        int linea ()
+        {
+            return i_linea;
+        }
+
+        // Devuelve el número de bits de la codificación de la instrucción
+        int bits ()
+        {
+            return plan->nBits;
+        }
+
+        // Ensambla la instrucción y la devuelve en binario, legible por la máquina
+        std::string to_bin (const tabla_etiquetas &etiquetas)
+        {   
+            return palabraToBin(codificar<palabra128>(etiquetas), plan->nBits);
+        }
+
+        // Ensambla la instrucción y la devuelve en hexadecimal, legible por la máquina
+        std::string to_hex (const tabla_etiquetas &etiquetas)
+        {
+            return palabraToHex (codificar<palabra128>(etiquetas), plan->nBits, almacen->obtenerIsa().tamanyoInstruccion);
+        }
+};
+
+
+
+// Codifica las n instrucciones del almacén desde inicio y deja su codificación y sus bits en palabras y nBits
+
+template <typename palabra_t>
+void codificarBloque (const almacen_instrucciones &codigo, const tabla_etiquetas &etiquetas, size_t inicio, size_t n,
+                      palabra_t *palabras, uint8_t *nBits)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        instruccion inst (codigo, inicio + i);
+        palabras[i] = inst.codificar<palabra_t>(etiquetas);
+        nBits[i] = inst.bits();
+    }
+}
+
+
+
+const size_t MAX_BYTES_PALABRA = 160;               // Máximo de bytes que ocupa una palabra formateada
+
+
+// Bytes que ocupa cada palabra en la salida binaria e Intel HEX
+int bytesPalabra (const modo_salida &modo);
+
+
+// Escribe en destino los nBytes bytes de menor peso de la palabra, del menos al más significativo si littleEndian
+
+template <typename palabra_t>
+void empaquetarPalabra (palabra_t palabra, int nBytes, bool littleEndian, uint8_t *destino)
+{
+    for (int b = 0; b < nBytes; b++, palabra = palabra >> 8)
+        destino[littleEndian ? b : nBytes - 1 - b] = (uint64_t) palabra & 0xFF;
+}
+
+
+// Escribe en destino un registro Intel HEX con n bytes de datos
+// Devuelve el número de bytes escritos
+size_t registroIntelHex (uint16_t direccion, uint8_t tipo, const uint8_t *datos, int n, char *destino);
+
+
+// Mensaje de error de una dirección de byte que no cabe en los 32 bits de Intel HEX
+string direccionIntelHexExcedida (uint64_t direccion);
+
+
+// Formatea n palabras en destino en el formato del modo, que no puede ser SALIDA_TEXTO
+// Todas las palabras ocupan modo.tamanyoInstruccion bits, como en la salida HEX
+// Devuelve el número de bytes escritos
+
+template <typename palabra_t>
+size_t formatearImagen (const modo_salida &modo, const palabra_t *palabras, const uint8_t *nBits, size_t n, size_t indice, char *destino)
+{
+    const int nBytes = bytesPalabra(modo);
+    char *p = destino;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        palabra_t palabra = ventanaInstruccion(palabras[i], nBits[i], modo.tamanyoInstruccion);
+
+        if (modo.formato == SALIDA_READMEMH)                           // Palabra en hexadecimal
+        {
+            const int nDigitosHex = (modo.tamanyoInstruccion + 3) / 4;
+            formatearHex (palabra, nDigitosHex, p);
+            p += nDigitosHex;
+            *p++ = '\n';
+            continue;
+        }
+
+        uint8_t bytes[MAX_BITS_CODIFICACION / 8];
+        empaquetarPalabra (palabra, nBytes, modo.littleEndian, bytes);
+
+        if (modo.formato == SALIDA_BINARIA)                            // Bytes tal cual
+        {
+            memcpy (p, bytes, nBytes);
+            p += nBytes;
+            continue;
+        }
+
+        uint64_t direccion = (indice + i) * nBytes;                    // Intel HEX: registros de datos que no cruzan un bloque de 64 KiB
+        if (direccion + nBytes - 1 > UINT32_MAX)
+            throw exception_output_overflow (direccionIntelHexExcedida (direccion + nBytes - 1));
+        for (int hechos = 0; hechos < nBytes; )
+        {
+            uint64_t actual = direccion + hechos;
+            int trozo = min ((uint64_t) (nBytes - hechos), 0x10000 - (actual & 0xFFFF));
+
+            if ((actual & 0xFFFF) == 0 && actual > 0)                  // Nuevo bloque: registro de dirección lineal extendida
+            {
+                uint8_t alta[2] = {(uint8_t) (actual >> 24), (uint8_t) (actual >> 16)};
+                p += registroIntelHex (0, 4, alta, 2, p);
+            }
+
+            p += registroIntelHex (actual & 0xFFFF, 0, bytes + hechos, trozo, p);
+            hechos += trozo;
+        }
+    }
+
+    return p - destino;
+}
+
+
+// Formatea n palabras en destino, que debe tener hueco para n * MAX_BYTES_PALABRA bytes
+// nBits[i] es el número de bits de la codificación de palabras[i]
+// indice es la posición de la primera palabra en el programa, para colocar los saltos de línea de LOGISIM_OUT y VHDL_OUT
+// Devuelve el número de bytes escritos
+
+template <typename palabra_t>
+size_t formatearPalabras (const modo_salida &modo, const palabra_t *palabras, const uint8_t *nBits, size_t n, size_t indice, char *destino)
+{
+    if (modo.formato != SALIDA_TEXTO)
+        return formatearImagen (modo, palabras, nBits, n, indice, destino);
+
+    const int nDigitosHex = (modo.tamanyoInstruccion + 3) / 4;
+    char *p = destino;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        if (modo.vhdlOut && !modo.logisimOut)                          // Código para memorias VHDL
+        {
+            *p++ = 'X';
+            *p++ = '"';
+        }
+
+        if (modo.hexOut)                                               // Traduce la instrucción a hexadecimal
+        {
+            formatearHex (ventanaInstruccion(palabras[i], nBits[i], modo.tamanyoInstruccion), nDigitosHex, p);
+            p += nDigitosHex;
+        }
+        else                                                           // Traduce la instrucción a binario
+        {
+            formatearBin (palabras[i], nBits[i], p);
+            p += nBits[i];
+        }
+
+        if (modo.logisimOut)                                           // Código para rom de logisim
+            *p++ = ' ';
+
+        else if (modo.vhdlOut)
+        {
+            memcpy (p, "\", ", 3);
+            p += 3;
+        }
+
+        else                                                           // Código estándar
+            *p++ = '\n';
+
+        if ((indice + i) % 8 == 7 && (modo.logisimOut || modo.vhdlOut))  // Si se ha alcanzado el número máximo de instrucciones por línea
+            *p++ = '\n';
+    }
+
+    return p - destino;
+}
+
+
+
+// Escritor de la salida ensamblada
+// Recibe las palabras como enteros, las formatea por bloques en un buffer propio
+// y solo escribe en el fichero cuando el buffer se llena o al volcarlo
+
+class escritor_salida
+{
+    private:
+
+        static const size_t TAMANYO_BUFFER = 1 << 20;          // Tamaño del buffer de salida en bytes
+        static constexpr size_t BLOQUE_RELLENO = 256;          // Palabras de una directiva que se preparan a la vez
+
+        ostream &f_salida;                                     // Fichero de salida
+        modo_salida modo;                                      // Formato de la salida
+        vector<char> buffer;                                   // Buffer de texto pendiente de escribir
+        size_t ocupado;                                        // Bytes ocupados del buffer
+        size_t volcados;                                       // Bytes ya escritos en el fichero
+        size_t indice;                                         // Palabras escritas hasta el momento, contando los huecos
+        chrono::steady_clock::duration tiempoVolcado;          // Tiempo pasado escribiendo en el fichero
+
+        char racha[MAX_BITS_CODIFICACION];                     // Al compactar, dígitos de la palabra que se repite
+        int longitudRacha;                                     // Número de dígitos de la racha
+        size_t inicioRacha;                                    // Dirección de la primera palabra de la racha
+        size_t nRacha;                                         // Palabras de la racha, 0 si no hay ninguna abierta
+        size_t elementos;                                      // Elementos compactados escritos, para los saltos de línea
+
+        // Deja en destino los dígitos HEX o BIN de una palabra, como en la salida de texto, y devuelve cuántos son
+        template <typename palabra_t>
+        int digitos (const palabra_t &palabra, int nBits, char *destino) const
+        {
+            if (modo.hexOut)
+            {
+                formatearHex (ventanaInstruccion(palabra, nBits, modo.tamanyoInstruccion), (modo.tamanyoInstruccion + 3) / 4, destino);
+                return (modo.tamanyoInstruccion + 3) / 4;
+            }
+
+            formatearBin (palabra, nBits, destino);
+            return nBits;
+        }
+
+        // Añade n palabras con los dígitos dados a la racha abierta, o la cierra y empieza otra
+        void anyadirRacha (const char *texto, int longitud, size_t n)
+        {
+            if (nRacha > 0 && longitud == longitudRacha && memcmp (texto, racha, longitud) == 0)
+            {
+                nRacha += n;
+                indice += n;
+                return;
+            }
+
+            cerrarRacha ();
+            memcpy (racha, texto, longitud);
+            longitudRacha = longitud;
+            inicioRacha = indice;
+            nRacha = n;
+            indice += n;
+        }
+
+        // Escribe la racha abierta: N*valor en LOGISIM_OUT, y en VHDL_OUT "i => X"valor"" o "i to j => X"valor"",
+        // salvo si es de ceros, que cubre others
+        void cerrarRacha ()
+        {
+            if (nRacha == 0)
+                return;
+
+            if (!modo.logisimOut && count (racha, racha + longitudRacha, '0') == longitudRacha)
+            {
+                nRacha = 0;
+                return;
+            }
+
+            string prefijo;                                                    // Repeticiones o direcciones delante del valor
+
+            if (modo.logisimOut)
+            {
+                if (nRacha > 1)
+                    prefijo = to_string (nRacha) + "*";
+            }
+            else
+            {
+                prefijo = to_string (inicioRacha);
+                if (nRacha > 1)
+                    prefijo += " to " + to_string (inicioRacha + nRacha - 1);
+                prefijo += " => X\"";
+            }
+
+            anyadir (prefijo.data(), prefijo.size());
+            anyadir (racha, longitudRacha);
+
+            bool saltoLinea = ++elementos % 8 == 0;                            // Como mucho ocho elementos por línea
+            if (modo.logisimOut)
+                anyadir (saltoLinea ? " \n" : " ", saltoLinea ? 2 : 1);
+            else
+                anyadir (saltoLinea ? "\", \n" : "\", ", saltoLinea ? 4 : 3);
+
+            nRacha = 0;
+        }
+
+        // Escribe las palabras de .word y .ascii, o las de .incbin con los bytes del fichero en el orden de la salida
+        // En la salida binaria el fichero se copia tal cual, sin pasar a palabras
+        void escribirDatos (const relleno_memoria &relleno)
+        {
+            string_view bytes = relleno.binario ? relleno.binario->contenido() : string_view ();
+            const int nBytes = modo.tamanyoInstruccion / 8;
+
+            if (relleno.binario && modo.formato == SALIDA_BINARIA)
+            {
+                static const char ceros[MAX_BITS_CODIFICACION / 8] = {};
+                anyadir (bytes.data(), bytes.size());
+                anyadir (ceros, (size_t) relleno.n * nBytes - bytes.size());             // Completa la última palabra
+                indice += relleno.n;
+                return;
+            }
+
+            palabra128 palabras[BLOQUE_RELLENO];
+            uint8_t nBits[BLOQUE_RELLENO];
+            fill (nBits, nBits + BLOQUE_RELLENO, (uint8_t) modo.tamanyoInstruccion);
+
+            for (size_t hechas = 0; hechas < (size_t) relleno.n; )
+            {
+                size_t bloque = min (BLOQUE_RELLENO, relleno.n - hechas);
+
+                for (size_t k = 0; k < bloque; k++)
+                {
+                    if (!relleno.binario)
+                    {
+                        palabras[k] = extenderSigno<palabra128>(relleno.valores[hechas + k]) & mascaraPalabra<palabra128>(modo.tamanyoInstruccion);
+                        continue;
+                    }
+
+                    palabras[k] = palabra128 ();                                 // Como la desempaqueta empaquetarPalabra
+                    size_t inicio = (hechas + k) * nBytes;
+                    for (int b = 0; b < nBytes && inicio + b < bytes.size(); b++)
+                        palabras[k] |= palabra128 ((uint8_t) bytes[inicio + b]) << (8 * (modo.littleEndian ? b : nBytes - 1 - b));
+                }
+
+                escribir (palabras, nBits, bloque);
+                hechas += bloque;
+            }
+        }
+
+    public:
+
+        // Constructor
+        escritor_salida (ostream &_f_salida, const modo_salida &_modo) : f_salida (_f_salida), modo (_modo), buffer (TAMANYO_BUFFER)
+        {
+            ocupado = 0;
+            volcados = 0;
+            indice = 0;
+            tiempoVolcado = chrono::steady_clock::duration::zero();
+            longitudRacha = 0;
+            inicioRacha = 0;
+            nRacha = 0;
+            elementos = 0;
+
+            if (modo.logisimOut && modo.formato == SALIDA_TEXTO)               // Cabecera de memoria de logisim
+                anyadir ("v2.0 raw\n", 9);
+        }
+
+        ~escritor_salida ()
+        {
+            volcar ();
+        }
+
+        // Añade texto ya formateado al buffer
+        void anyadir (const char *texto, size_t n)
+        {
+            if (ocupado + n > buffer.size())
+                volcar ();
+
+            if (n > buffer.size())
+            {
+                f_salida.write (texto, n);
+                volcados += n;
+            }
+            else
+            {
+                memcpy (&buffer[ocupado], texto, n);
+                ocupado += n;
+            }
+        }
+
+        // Añade nPalabras palabras formateadas por otro hilo con formatearPalabras
+        void anyadirFormateadas (const string &texto, size_t nPalabras)
+        {
+            anyadir (texto.data(), texto.size());
+            indice += nPalabras;
+        }
+
+        // Formatea n palabras y las añade al buffer
+        // nBits[i] es el número de bits de la codificación de palabras[i]
+        template <typename palabra_t>
+        void escribir (const palabra_t *palabras, const uint8_t *nBits, size_t n)
+        {
+            if (modo.compacta())                                               // Junta las palabras iguales seguidas
+            {
+                char texto[MAX_BITS_CODIFICACION];
+                for (size_t i = 0; i < n; i++)
+                    anyadirRacha (texto, digitos (palabras[i], nBits[i], texto), 1);
+                return;
+            }
+
+            while (n > 0)
+            {
+                size_t hueco = (buffer.size() - ocupado) / MAX_BYTES_PALABRA;       // Palabras que caben en el buffer
+                if (hueco == 0)
+                {
+                    volcar ();
+                    continue;
+                }
+
+                size_t bloque = min (hueco, n);
+                ocupado += formatearPalabras (modo, palabras, nBits, bloque, indice, &buffer[ocupado]);
+
+                palabras += bloque;
+                nBits += bloque;
+                indice += bloque;
+                n -= bloque;
+            }
+        }
+
+        // Añade las palabras de una directiva
+        // .word, .ascii e .incbin se escriben con escribirDatos
+        // Los huecos de .org y .align son ceros, salvo en Intel HEX, que salta a la siguiente dirección,
+        // y en readmemh, que la indica con @. Al compactar, son una racha más
+        void rellenar (const relleno_memoria &relleno)
+        {
+            if (relleno.n <= 0)
+                return;
+
+            if (relleno.binario || !relleno.valores.empty())
+            {
+                escribirDatos (relleno);
+                return;
+            }
+
+            palabra128 valor = relleno.hueco ? palabra128 () : extenderSigno<palabra128>(relleno.valor) & mascaraPalabra<palabra128>(modo.tamanyoInstruccion);
+
+            if (modo.compacta())
+            {
+                char texto[MAX_BITS_CODIFICACION];
+                anyadirRacha (texto, digitos (valor, modo.tamanyoInstruccion, texto), relleno.n);
+                return;
+            }
+
+            if (relleno.hueco && modo.formato == SALIDA_READMEMH)
+            {
+                indice += relleno.n;
+                char linea[24] = "@";
+                char *p = to_chars (linea + 1, linea + sizeof(linea) - 1, indice, 16).ptr;
+                *p++ = '\n';
+                anyadir (linea, p - linea);
+                return;
+            }
+
+            if (relleno.hueco && modo.formato == SALIDA_INTEL_HEX)
+            {
+                uint64_t anterior = (uint64_t) indice * bytesPalabra(modo);
+                indice += relleno.n;
+                uint64_t direccion = (uint64_t) indice * bytesPalabra(modo);
+                if (direccion > UINT32_MAX)
+                    throw exception_output_overflow (direccionIntelHexExcedida (direccion));
+                bool otroBloque = (direccion >> 16) != (anterior >> 16) || ((anterior & 0xFFFF) == 0 && anterior > 0);
+                if (otroBloque && (direccion & 0xFFFF) != 0)                   // En un límite de bloque ya lo escribe formatearImagen
+                {
+                    char registro[MAX_BYTES_PALABRA];
+                    uint8_t alta[2] = {(uint8_t) (direccion >> 24), (uint8_t) (direccion >> 16)};
+                    anyadir (registro, registroIntelHex (0, 4, alta, 2, registro));
+                }
+                return;
+            }
+
+            palabra128 palabras[BLOQUE_RELLENO];
+            uint8_t nBits[BLOQUE_RELLENO];
+            fill (palabras, palabras + BLOQUE_RELLENO, valor);
+            fill (nBits, nBits + BLOQUE_RELLENO, (uint8_t) modo.tamanyoInstruccion);
+
+            for (size_t hechas = 0; hechas < (size_t) relleno.n; hechas += BLOQUE_RELLENO)
+                escribir (palabras, nBits, min (BLOQUE_RELLENO, relleno.n - hechas));
+        }
+
+        // Cierra la salida tras la última palabra y la escribe en el fichero
+        void terminar ()
+        {
+            if (modo.compacta())
+            {
+                cerrarRacha ();
+
+                if (!modo.logisimOut)                                          // Las palabras a cero que no se han escrito
+                {
+                    string otros = "others => X\"" + string (modo.hexOut ? (modo.tamanyoInstruccion + 3) / 4 : modo.tamanyoInstruccion, '0') + "\"\n";
+                    anyadir (otros.data(), otros.size());
+                }
+            }
+
+            if (modo.formato == SALIDA_INTEL_HEX)                              // Registro de fin de fichero
+                anyadir (":00000001FF\n", 12);
+
+            volcar ();
+        }
+
+        // Escribe en el fichero el contenido del buffer
+        void volcar ()
+        {
+            auto inicio = chrono::steady_clock::now();
+            f_salida.write (&buffer[0], ocupado);
+            volcados += ocupado;
+            ocupado = 0;
+            tiempoVolcado += chrono::steady_clock::now() - inicio;
+        }
+
+        // Devuelve el formato de la salida
+        const modo_salida &obtenerModo () const
+        {
+            return modo;
+        }
+
+        // Devuelve los milisegundos pasados escribiendo en el fichero
+        double milisegundosVolcado () const
+        {
+            return chrono::duration<double, milli> (tiempoVolcado).count();
+        }
+
+        // Devuelve la posición en la salida del siguiente byte que se escriba
+        size_t posicion () const
+        {
+            return volcados + ocupado;
+        }
+
+        // Devuelve el número de palabras escritas
+        size_t palabras () const
+        {
+            return indice;
+        }
+
+        // Sustituye n bytes ya escritos a partir de posicion, tanto si siguen en el buffer como si ya están en el fichero
+        void sobrescribir (size_t posicion, const char *texto, size_t n)
+        {
+            if (posicion < volcados)                                           // Parte ya volcada al fichero
+            {
+                size_t enFichero = min (n, volcados - posicion);
+
+                f_salida.seekp (posicion);
+                f_salida.write (texto, enFichero);
+                f_salida.seekp (volcados);
+
+                posicion += enFichero;
+                texto += enFichero;
+                n -= enFichero;
+            }
+
+            if (n > 0)
+                memcpy (&buffer[posicion - volcados], texto, n);
+        }
+};
+
+
+// Estadísticas de un ensamblado, se muestran con --stats
+// Los tiempos son de reloj, en milisegundos. Con -j la codificación incluye el formateo, que hacen los mismos hilos.
+struct estadisticas_ensamblado
+{
+    double msConfig = 0;                             // Lectura de la configuración
+    double msLectura = 0;                            // Tokenizado del programa y creación de las instrucciones
+    double msEtiquetas = 0;                          // Definición de las etiquetas
+    double msCodificacion = 0;                       // Codificación de las instrucciones
+    double msSalida = 0;                             // Formateo y escritura de la salida
+    size_t instrucciones = 0;                        // Instrucciones ensambladas
+    size_t reutilizadas = 0;                         // Instrucciones tomadas de la caché con --incremental
+    size_t etiquetas = 0;                            // Etiquetas distintas del programa
+    size_t definiciones = 0;                         // Definiciones de etiquetas (búsquedas en la tabla de etiquetas)
+    contadores_almacen almacen;                      // Búsquedas y reservas de memoria del almacén de instrucciones
+    size_t bytesLeidos = 0;                          // Bytes de la configuración y del programa
+    size_t bytesEscritos = 0;                        // Bytes de la salida
+
+    // Suma las estadísticas de otro ensamblado, para los totales de --lote
+    void anyadir (const estadisticas_ensamblado &otro)
+    {
+        msConfig += otro.msConfig;
+        msLectura += otro.msLectura;
+        msEtiquetas += otro.msEtiquetas;
+        msCodificacion += otro.msCodificacion;
+        msSalida += otro.msSalida;
+        instrucciones += otro.instrucciones;
+        reutilizadas += otro.reutilizadas;
+        etiquetas += otro.etiquetas;
+        definiciones += otro.definiciones;
+        almacen.busquedasMnemonico += otro.almacen.busquedasMnemonico;
+        almacen.busquedasEtiqueta += otro.almacen.busquedasEtiqueta;
+        almacen.reservas += otro.almacen.reservas;
+        almacen.bytesReservados += otro.almacen.bytesReservados;
+        bytesLeidos += otro.bytesLeidos;
+        bytesEscritos += otro.bytesEscritos;
+    }
+};
+
+
+// Estado de un ensamblado: lo que depende del programa y no de la configuración
+// Cada programa se ensambla con su propio contexto, así que se pueden ensamblar varios a la vez
+struct contexto_ensamblado
+{
+    const configuracion_isa &isa;                    // Configuración con la que se ensambla
+    tabla_etiquetas etiquetas;                       // Etiquetas del programa
+    estadisticas_ensamblado estadisticas;            // Estadísticas del ensamblado, para --stats
+
+    contexto_ensamblado (const configuracion_isa &_isa) : isa (_isa) {}
+};
+
+
+// Tiempo en milisegundos desde inicio
+double milisegundosDesde (chrono::steady_clock::time_point inicio);
+
+
+// Primera pasada: tokeniza el programa, crea sus instrucciones en codigo y define las etiquetas en ctx
+// Con varios hilos el texto se parte en trozos que se leen a la vez
+void primeraPasada (string_view texto, int nHilos, almacen_instrucciones &codigo, contexto_ensamblado &ctx);
+
+
+// Segunda pasada: codifica las instrucciones y las pasa en orden al escritor, junto con las palabras de las directivas
+// Con varios hilos cada uno toma el siguiente bloque libre, lo codifica y lo formatea;
+// el hilo principal escribe los bloques en orden según van terminando
+// Los programas con directivas y la salida compactada se escriben en un solo hilo, con los bloques cortados en cada directiva
+// palabra_t debe tener al menos tantos bits como la instrucción más larga
+
+template <typename palabra_t>
+void segundaPasada (const almacen_instrucciones &codigo, int nHilos, escritor_salida &escritor, contexto_ensamblado &ctx)
+{
+    const size_t TAMANYO_BLOQUE = 4096;                                         // Instrucciones codificadas antes de pasarlas al escritor
+    size_t nBloques = (codigo.size() + TAMANYO_BLOQUE - 1) / TAMANYO_BLOQUE;
+
+    if (nHilos <= 1 || nBloques <= 1 || !codigo.rellenos.empty() || escritor.obtenerModo().compacta())
+    {
+        vector<palabra_t> palabras (TAMANYO_BLOQUE);                            // Bloque de instrucciones ya codificadas
+        vector<uint8_t> nBits (TAMANYO_BLOQUE);                                 // Número de bits de cada instrucción del bloque
+        size_t r = 0;                                                           // Siguiente directiva por escribir
+
+        for (size_t i = 0; ; )                                                  // Recorre el almacén de instrucciones por bloques
+        {
+            if (r < codigo.rellenos.size() && codigo.rellenos[r].antesDe <= i)  // Escribe las directivas anteriores a la instrucción i
+            {
+                auto inicio = chrono::steady_clock::now();
+                for (; r < codigo.rellenos.size() && codigo.rellenos[r].antesDe <= i; r++)
+                    escritor.rellenar (codigo.rellenos[r]);
+                ctx.estadisticas.msSalida += milisegundosDesde (inicio);
+            }
+
+            if (i == codigo.size())
+                break;
+
+            size_t fin = min (codigo.size(), i + TAMANYO_BLOQUE);              // El bloque acaba en la siguiente directiva
+            if (r < codigo.rellenos.size())
+                fin = min (fin, codigo.rellenos[r].antesDe);
+
+            codificarBloque (codigo, ctx.etiquetas, i, fin - i, palabras.data(), nBits.data());
+
+            auto inicio = chrono::steady_clock::now();                          // Pasa el bloque al escritor
+            escritor.escribir(palabras.data(), nBits.data(), fin - i);
+            ctx.estadisticas.msSalida += milisegundosDesde (inicio);
+            i = fin;
+        }
+        return;
+    }
+
+    const size_t VENTANA_BLOQUES = 4 * nHilos;                                  // Bloques que se pueden adelantar al escritor
+
+    vector<string> textos (nBloques);                                           // Texto formateado de cada bloque
+    vector<exception_ptr> errores (nBloques);                                   // Error al codificar cada bloque
+    vector<char> terminado (nBloques, false);                                   // Bloques ya procesados
+    atomic<size_t> siguiente {0};                                               // Siguiente bloque libre
+    size_t escritos = 0;                                                        // Bloques ya pasados al escritor
+    size_t primerError = nBloques;                                              // Primer bloque con error
+    mutex cerrojo;
+    condition_variable aviso;
+
+    auto trabajador = [&] ()
+    {
+        vector<palabra_t> palabras (TAMANYO_BLOQUE);
+        vector<uint8_t> nBits (TAMANYO_BLOQUE);
+
+        for (size_t b = siguiente++; b < nBloques; b = siguiente++)
+        {
+            {
+                unique_lock<mutex> lock (cerrojo);                              // No se adelanta demasiado al escritor
+                aviso.wait (lock, [&] { return b < escritos + VENTANA_BLOQUES || b > primerError; });
+                if (b > primerError)
+                    break;
+            }
+
+            size_t inicio = b * TAMANYO_BLOQUE;
+            size_t n = min (TAMANYO_BLOQUE, codigo.size() - inicio);
+            exception_ptr error;
+
+            try
+            {
+                codificarBloque (codigo, ctx.etiquetas, inicio, n, palabras.data(), nBits.data());
+
+                textos[b].resize (n * MAX_BYTES_PALABRA);
+                textos[b].resize (formatearPalabras (escritor.obtenerModo(), palabras.data(), nBits.data(), n, inicio, &textos[b][0]));
+            }
+            catch (...)
+            {
+                error = current_exception();
+            }
+
+            {
+                lock_guard<mutex> lock (cerrojo);
+                errores[b] = error;
+                terminado[b] = true;
+                if (error && b < primerError)
+                    primerError = b;
+            }
+            aviso.notify_all();
+        }
+    };
+
+    vector<thread> hilos;
+    for (int h = 0; h < nHilos; h++)
+        hilos.emplace_back (trabajador);
+
+    exception_ptr error;
+    for (size_t b = 0; b < nBloques; b++)                                       // Escribe los bloques en orden
+    {
+        unique_lock<mutex> lock (cerrojo);
+        aviso.wait (lock, [&] { return (bool) terminado[b]; });
+
+        if (errores[b])
+        {
+            error = errores[b];
+            primerError = b;                                                    // Detiene al resto de hilos
+            lock.unlock();
+            aviso.notify_all();
+            break;
+        }
+
+        lock.unlock();
+
+        size_t n = min (TAMANYO_BLOQUE, codigo.size() - b * TAMANYO_BLOQUE);
+        auto inicio = chrono::steady_clock::now();
+        escritor.anyadirFormateadas (textos[b], n);
+        ctx.estadisticas.msSalida += milisegundosDesde (inicio);
+        string().swap (textos[b]);                                              // Libera el bloque ya escrito
+
+        lock.lock();
+        escritos = b + 1;
+        lock.unlock();
+        aviso.notify_all();
+    }
+
+    for (thread &hilo : hilos)
+        hilo.join();
+
+    if (error)
+        rethrow_exception (error);
+}
+
+
+
+
+// Palabra ya escrita en la salida a la que le faltan campos por etiquetas aún no definidas
+template <typename palabra_t>
+struct palabra_pendiente
+{
+    size_t posicion;                                 // Posición de la palabra en la salida
+    size_t indice;                                   // Posición de la palabra en el programa
+    palabra_t palabra;                               // Palabra con los campos ya conocidos
+    uint8_t nBits;                                   // Bits de la codificación
+    int nPendientes;                                 // Campos que faltan por resolver
+};
+
+// Campo de una palabra escrita que espera a que se defina su etiqueta
+struct referencia_pendiente
+{
+    size_t palabra;                                  // Índice de la palabra en el programa
+    const campo_instruccion *campo;                  // Campo a completar
+    int i_PC;                                        // PC de la instrucción, para los saltos relativos
+    int i_linea;                                     // Línea de la instrucción, para los errores
+};
+
+
+// Ensamblado en una sola pasada, con memoria acotada
+// Cada instrucción se codifica y se escribe en cuanto se lee. Los campos que usan etiquetas aún no definidas
+// se apuntan como referencias pendientes, y al definirse la etiqueta se corrigen sus palabras en la salida.
+// La memoria crece con el número de referencias sin resolver, no con el tamaño del programa.
+// A diferencia de las dos pasadas, una etiqueta que se redefine vale en cada uso lo último definido antes de él.
+
+template <typename palabra_t>
+void ensamblarStreaming (string_view texto, escritor_salida &escritor, contexto_ensamblado &ctx)
+{
+    const size_t TAMANYO_BLOQUE = 4096;                                         // Instrucciones que se guardan antes de vaciar el almacén
+
+    almacen_instrucciones codigo (ctx.isa, texto.data(), ctx.etiquetas);                  // Instrucciones del bloque actual
+    unordered_map <int, vector<referencia_pendiente>> referencias;              // Referencias pendientes por id de etiqueta
+    unordered_map <size_t, palabra_pendiente<palabra_t>> pendientes;            // Palabras escritas con campos sin resolver
+    vector<int> camposPendientes;                                               // Campos sin resolver de la instrucción actual
+    vector<char> formateada (MAX_BYTES_PALABRA);                                // Palabra reformateada para corregirla
+
+    lexer lex (texto);                                          // Analizador léxico sobre el fichero
+    int i_PC = 0;                                               // Lleva la cuenta del número de línea para almacenar etiquetas de salto
+    int i_numLinea = 0;                                         // Lleva la cuenta del número de línea para mostrar errores
+    relleno_memoria relleno;                                    // Palabras de la última directiva
+
+    auto definir = [&] (string_view nombre, int valor)          // Define una etiqueta y corrige las palabras que la esperaban
+    {
+        int id = ctx.etiquetas.internar(nombre);
+        ctx.etiquetas.definir (id, valor);
+        ctx.estadisticas.definiciones++;
+
+        auto it = referencias.find(id);
+        if (it == referencias.end())
+            return;
+
+        for (const referencia_pendiente &ref : it->second)
+        {
+            palabra_pendiente<palabra_t> &pendiente = pendientes[ref.palabra];
+            int valorCampo = ref.campo->tipo == CAMPO_RELATIVO ? valor - (ref.i_PC + 1) : valor;
+
+            pendiente.palabra |= instruccion::colocarCampo<palabra_t>(*ref.campo, valorCampo);
+
+            if (--pendiente.nPendientes == 0)                                   // Palabra completa, la corrige en la salida
+            {
+                size_t n = formatearPalabras (escritor.obtenerModo(), &pendiente.palabra, &pendiente.nBits, 1, pendiente.indice, formateada.data());
+                escritor.sobrescribir (pendiente.posicion, formateada.data(), n);
+                pendientes.erase(ref.palabra);
+            }
+        }
+
+        referencias.erase(it);
+    };
+
+    while (lex.siguienteLinea())                                // Lee la siguiente línea, ya sin comentarios
+    {
+        i_numLinea++;                                           // Incrementa el número de línea
+
+        if (leerGlobal (lex, i_numLinea))                       // Solo cuenta en los objetos
+            continue;
+
+        if (!lex.tokens.empty() && leerDirectiva (lex, ctx.isa.tamanyoInstruccion, i_numLinea, i_PC, relleno))   // Es una directiva
+        {
+            escritor.rellenar (relleno);
+        }
+        else if (lex.tokens.size() > 1)                         // Es una instrucción 
+        {
+            if (i_PC == INT_MAX)                                                // La instrucción acabaría tras el último PC
+                throw exception_pc_overflow (string(lex.tokens[0]), i_numLinea);
+            if (codigo.size() == TAMANYO_BLOQUE)
+                codigo.vaciar();
+
+            codigo.anyadir (lex.tokens, i_numLinea, i_PC);
+            instruccion inst (codigo, codigo.size() - 1);
+
+            camposPendientes.clear();
+            palabra_t palabra = inst.codificar<palabra_t>(ctx.etiquetas, &camposPendientes);
+            uint8_t nBits = inst.bits();
+            size_t indice = escritor.palabras();
+
+            if (!camposPendientes.empty())                                      // Apunta las referencias a etiquetas futuras
+            {
+                pendientes[indice] = {escritor.posicion(), indice, palabra, nBits, (int) camposPendientes.size()};
+
+                for (int c : camposPendientes)
+                    referencias[codigo.simbolo(codigo.size() - 1, c)].push_back({indice, &inst.obtenerPlan().campos[c], i_PC, i_numLinea});
+            }
+
+            escritor.escribir (&palabra, &nBits, 1);
+            i_PC++;                                                             // Incrementa el contador de instrucción (Para etiquetas de salto)
+            ctx.estadisticas.instrucciones++;
+        }
+        else if (lex.tokens.size() == 1)                        // Es una etiqueta de salto
+        {
+            string_view etiqueta = lex.tokens[0];
+            size_t igual = etiqueta.find('=');
+
+            if (igual != string_view::npos)                                    // Almacena el valor de la etiqueta
+                definir (etiqueta.substr(0, igual), to_decimal(etiqueta.substr(igual + 1), i_numLinea));
+            else
+                definir (etiqueta, i_PC);                                       // Almacena la posición de la etiqueta
+        }
+    }
+
+    ctx.estadisticas.almacen = codigo.contadores();
+
+    if (!referencias.empty())                                                   // Informa de todas las etiquetas que no se han definido
+    {
+        vector<pair<int, string>> desconocidas;
+
+        for (const auto &par : referencias)
+            desconocidas.push_back({par.second.front().i_linea, string(ctx.etiquetas.nombre(par.first))});
+
+        sort (desconocidas.begin(), desconocidas.end());
+        throw exception_wrong_label (desconocidas);
+    }
+}
+
+
+// Carga en isa, que debe estar vacía, la configuración del texto de un fichero de configuración
+void cargarConfiguracion (string_view texto, configuracion_isa &isa);
+
+
+// Juego de instrucciones compilado
+
+// Escribe la configuración isa, cargada del texto textoConfig, como una imagen binaria plana que se proyecta en memoria
+// Lleva la tabla hash de los nombres tal cual, los planes y los campos en registros de tamaño fijo y los textos
+// juntos al final; todas las posiciones son desde el inicio, así que no depende de dónde se proyecte
+// Las constantes de la configuración no se guardan: solo se usan al leerla
+void escribirIsaCompilada (ostream &salida, const configuracion_isa &isa, string_view textoConfig);
+
+
+// Carga en isa, que debe estar vacía, la imagen escrita con escribirIsaCompilada, sin leer el texto de la configuración
+// Devuelve false, sin cambiar isa, si la imagen es de otro texto de configuración o de otra versión o no cuadra
+bool cargarIsaCompilada (string_view imagen, string_view textoConfig, configuracion_isa &isa);
+
+
+// Llama a funcion con una palabra a 0 del tipo más pequeño en el que cabe la instrucción más larga de la configuración
+// Así el tipo de palabra se elige una sola vez, y cada tamaño usa su propia especialización
+
+template <typename funcion_t>
+void conTipoPalabra (const configuracion_isa &isa, funcion_t funcion)
+{
+    int maxBits = isa.tamanyoInstruccion;                                       // Bits de la palabra más larga
+    for (const plan_instruccion &plan : isa.planes)
+        maxBits = max(maxBits, plan.nBits);
+
+    if (maxBits <= 16)
+        funcion (uint16_t (0));
+    else if (maxBits <= 32)
+        funcion (uint32_t (0));
+    else if (maxBits <= 64)
+        funcion (uint64_t (0));
+    else
+        funcion (palabra128 ());
+}
+
+
+// Ensambla el programa con palabras de tipo palabra_t, que deben tener al menos tantos bits como la instrucción más larga
+
+template <typename palabra_t>
+void ensamblar (string_view texto, int nHilos, bool streaming, escritor_salida &escritor, contexto_ensamblado &ctx)
+{
+    auto inicio = chrono::steady_clock::now();
+
+    if (streaming && !escritor.obtenerModo().compacta())                        // Lee, ensambla y escribe en una sola pasada
+    {
+        ensamblarStreaming<palabra_t> (texto, escritor, ctx);
+
+        double msVolcado = escritor.milisegundosVolcado();                     // La lectura y las etiquetas cuentan como codificación
+        ctx.estadisticas.msSalida += msVolcado;
+        ctx.estadisticas.msCodificacion += milisegundosDesde (inicio) - msVolcado;
+        return;
+    }
+
+    // Comienza la lectura y tokenizado del código
+
+    double msEtiquetasAntes = ctx.estadisticas.msEtiquetas;
+
+    almacen_instrucciones codigo (ctx.isa, texto.data(), ctx.etiquetas);                 // Instrucciones del programa, en orden
+    primeraPasada (texto, nHilos, codigo, ctx);
+
+    ctx.estadisticas.msLectura += milisegundosDesde (inicio) - (ctx.estadisticas.msEtiquetas - msEtiquetasAntes);
+    ctx.estadisticas.almacen = codigo.contadores();
+    ctx.estadisticas.instrucciones = codigo.size();
+
+
+
+    // Comienza el ensamblado
+
+    inicio = chrono::steady_clock::now();
+    double msSalidaAntes = ctx.estadisticas.msSalida;
+
+    segundaPasada<palabra_t> (codigo, nHilos, escritor, ctx);
+
+    ctx.estadisticas.msCodificacion += milisegundosDesde (inicio) - (ctx.estadisticas.msSalida - msSalidaAntes);
+}
+
+
+// Programa ensamblado en memoria
+struct programa_ensamblado
+{
+    vector<palabra128> palabras;                     // Codificación de cada instrucción, en sus bits de menor peso
+    vector<uint8_t> nBits;                           // Bits de la codificación de cada instrucción
+    vector<int> lineas;                              // Línea del código de cada instrucción
+    vector<int> direcciones;                         // Dirección de cada instrucción, vacío si el programa no tiene directivas
+    vector<relleno_memoria> rellenos;                // Palabras de las directivas .org, .align y .fill, en orden
+    map<string, int> simbolos;                       // Etiquetas definidas en el programa y su valor
+};
+
+
+// Ensambla el texto de un programa con la configuración isa, sin ficheros ni estado global
+// Con varios hilos, la lectura se reparte como en primeraPasada y la codificación por bloques
+// Los errores se lanzan como excepciones, igual que al ensamblar un fichero
+programa_ensamblado ensamblarPrograma (const configuracion_isa &isa, string_view texto, int nHilos = 1);
+
+
+// Escribe en salida las palabras de un programa ensamblado en el modo de salida dado
+// El programa no se modifica, así que se puede escribir a la vez en varios modos desde varios hilos
+void escribirPrograma (ostream &salida, const modo_salida &modo, const programa_ensamblado &programa);
+
+
+// Formatea las palabras de un programa ensamblado en el modo de salida dado
+// Devuelve el contenido que tendría el fichero de salida
+string formatearPrograma (const modo_salida &modo, const programa_ensamblado &programa);
+
+
+
+// Objetos reubicables
+
+// Atributos de un símbolo de un objeto
+enum atributo_simbolo : uint8_t
+{
+    SIMBOLO_DEFINIDO = 1,                            // Se define en el módulo; si no, es externo y lo da otro módulo
+    SIMBOLO_POSICION = 2,                            // Marca una posición del módulo (no tiene '='), que se desplaza al enlazar
+    SIMBOLO_GLOBAL = 4                               // Se exporta con .global y lo pueden usar los demás módulos
+};
+
+// Campo de una palabra del objeto que se corrige al enlazar con el valor de un símbolo
+struct reubicacion
+{
+    uint32_t palabra;                                // Palabra del objeto
+    int32_t simbolo;                                 // Símbolo del objeto cuyo valor va en el campo
+    uint8_t desplazamiento;                          // Posición del bit menos significativo del campo
+    uint8_t nBits;                                   // Bits del campo
+    uint8_t relativo;                                // Campo ##: se guarda el valor menos el PC siguiente
+    uint8_t reservado = 0;
+};
+
+// Módulo ensamblado por separado, con sus PCs contados desde 0
+// Las instrucciones y los datos de las directivas son palabras, salvo los huecos de .org, .align y .space, que
+// se guardan aparte. En un módulo .org y .align son relativos a su inicio. Los campos con etiquetas externas o con
+// posiciones del módulo en campos absolutos # se dejan a 0 y se apuntan en reubicaciones
+struct objeto_ensamblado
+{
+    uint64_t huella = 0;                             // Huella de la configuración con la que se ensambló
+    vector<palabra128> palabras;                     // Codificación de cada palabra, en sus bits de menor peso
+    vector<uint8_t> nBits;                           // Bits de la codificación de cada palabra
+    vector<int32_t> lineas;                          // Línea de cada instrucción en el módulo, 0 en los datos
+    vector<uint64_t> antesDeHueco;                   // Palabra delante de la que va cada hueco, en orden
+    vector<int32_t> palabrasHueco;                   // Palabras que ocupa cada hueco
+    vector<string> simbolos;                         // Nombre de cada símbolo: todas las etiquetas definidas o usadas
+    vector<int32_t> valores;                         // Valor de cada símbolo definido, posición dentro del módulo o valor tras '='
+    vector<uint8_t> atributos;                       // Atributos de cada símbolo, atributo_simbolo
+    vector<reubicacion> reubicaciones;               // Campos que se corrigen al enlazar, en orden de palabra
+    string nombre;                                   // Nombre del módulo en los errores del enlazado, no se guarda
+};
+
+
+// Huella de una configuración: cambia si cambia la codificación de alguna instrucción
+uint64_t huellaConfiguracion (const configuracion_isa &isa);
+
+
+// Ensambla el texto de un módulo con la configuración isa a un objeto reubicable
+// Las palabras de .incbin se empaquetan en el orden de littleEndian, como en la salida de texto
+objeto_ensamblado ensamblarObjeto (const configuracion_isa &isa, string_view texto, bool littleEndian = true);
+
+
+// Escribe un objeto en un fichero binario
+void escribirObjeto (ostream &salida, const objeto_ensamblado &objeto);
+
+
+// Lee un objeto escrito con escribirObjeto. Los errores se lanzan como exception_link
+objeto_ensamblado leerObjeto (string_view contenido, const string &nombre);
+
+
+// Enlaza los objetos, en orden y uno tras otro desde el PC 0, en un programa que se escribe con escribirPrograma
+// Los símbolos externos se buscan entre los globales de los demás objetos. En simbolos quedan los globales
+// Los errores (otra configuración, símbolos globales repetidos o sin definir) se lanzan como exception_link
+programa_ensamblado enlazarObjetos (const configuracion_isa &isa, const vector<objeto_ensamblado> &objetos);
+
+
+
+
+// Desensamblado
+
+// Decodificador de las instrucciones de una configuración
+// Es un trie de decisión sobre los bits fijos de cada instrucción (opcode y relleno &): cada nodo mira un grupo de
+// hasta MAX_BITS_NODO bits contiguos que todas sus instrucciones tienen fijos y salta al hijo de su valor, hasta
+// una hoja con las pocas instrucciones que quedan, de la más concreta a la menos.
+// Las palabras son de TAMANYO_INSTRUCCION bits, como en las salidas HEX y binarias: de las instrucciones más
+// largas solo están los bits de mayor peso, y las más cortas tienen ceros a la izquierda.
+
+class decodificador
+{
+    private:
+
+    static const int MAX_BITS_NODO = 8;              // Bits que mira como mucho cada nodo, 256 hijos
+
+    struct patron_instruccion
+    {
+        palabra128 fijos;                            // Bits fijos de la instrucción dentro de la palabra
+        palabra128 base;                             // Valor de esos bits
+        int nFijos;                                  // Número de bits fijos
+        int id;                                      // Id del plan de la instrucción
+    };
+
+    struct nodo_trie
+    {
+        int desplazamiento;                          // Bit de menor peso del grupo que decide
+        int nBits;                                   // Bits del grupo, 0 en las hojas
+        uint64_t mascara;                            // nBits bits a 1
+        size_t primero;                              // Nodos: primer hijo en hijos. Hojas: primer candidato
+        size_t nCandidatos;                          // Hojas: instrucciones que hay que comprobar
+    };
+
+    const configuracion_isa &isa;
+    vector<nodo_trie> nodos;                         // El primero es la raíz
+    vector<int> hijos;                               // Nodo hijo de cada valor del grupo de cada nodo
+    vector<patron_instruccion> candidatos;           // Instrucciones de las hojas
+    vector<patron_instruccion> completos;            // Patrón de cada instrucción con todos sus bits, de la más concreta a la menos
+    int profundidadMaxima = 0;                       // Nodos que se recorren como mucho hasta una hoja
+
+    int construir (vector<patron_instruccion> &patrones, int profundidad);
+
+    public:
+
+    decodificador (const configuracion_isa &_isa);
+
+    // Devuelve el id del plan de la instrucción codificada en palabra, o -1 si no coincide con ninguna
+    int decodificar (const palabra128 &palabra) const
+    {
+        const nodo_trie *nodo = &nodos[0];
+
+        while (nodo->nBits != 0)
+            nodo = &nodos[hijos[nodo->primero + ((uint64_t) (palabra >> nodo->desplazamiento) & nodo->mascara)]];
+
+        for (size_t c = nodo->primero; c < nodo->primero + nodo->nCandidatos; c++)
+            if ((palabra & candidatos[c].fijos) == candidatos[c].base)
+                return candidatos[c].id;
+
+        return -1;
+    }
+
+    // Devuelve el id del plan de la instrucción de exactamente nBits bits codificada en palabra, o -1 si no coincide con
+    // ninguna. En BIN cada palabra tiene los bits de su instrucción, y así se distingue de las más cortas o más largas
+    // que coinciden en los TAMANYO_INSTRUCCION bits que mira decodificar
+    int decodificar (const palabra128 &palabra, int nBits) const;
+
+    // Devuelve la codificación de plan->nBits bits de la instrucción id a partir de su palabra de nBitsPalabra bits
+    // Los bits que la palabra no tiene, en instrucciones más largas que ella, quedan a 0
+    palabra128 codificacion (int id, const palabra128 &palabra, int nBitsPalabra) const;
+
+    size_t size () const { return nodos.size(); }
+    int profundidad () const { return profundidadMaxima; }
+};
+
+
+// Lee las palabras de una imagen en el modo dado, al revés que formatearPrograma
+// Cada palabra tiene TAMANYO_INSTRUCCION bits, salvo en BIN, donde tiene los de su instrucción, y en nBits quedan
+// los de cada una. Los errores se lanzan como exception_wrong_image
+vector<palabra128> leerImagen (const modo_salida &modo, string_view contenido, vector<uint8_t> &nBits);
+
+
+// Desensambla palabras de nBits bits, como las de leerImagen, a un programa con la sintaxis de la configuración
+// Con anchoExacto (la salida BIN) cada palabra tiene los bits de su instrucción, y solo se buscan las de ese tamaño
+// Los saltos relativos ## que caen dentro del programa se escriben con etiquetas etiqueta_PC, y las palabras que
+// no son ninguna instrucción, como comentarios. Si a una instrucción le faltan bits de sus campos, porque la imagen
+// la recorta a TAMANYO_INSTRUCCION, se lanza exception_wrong_image
+string desensamblarPrograma (const configuracion_isa &isa, const vector<palabra128> &palabras, const vector<uint8_t> &nBits,
+                             bool anchoExacto);
+
+
+
+// Generación de un juego de instrucciones fijo
+
+// Genera una cabecera de C++ con la configuración cargada en isa desde textoConfig, para compilar con -DCUMPILADOR_ISA
+// Tiene, en el espacio de nombres isa_fija, el texto de la configuración, sus opciones, las tablas constexpr de las
+// instrucciones, un hash perfecto de los mnemónicos y un codificador con los campos de cada instrucción ya colocados
+string generarCabeceraIsa (const configuracion_isa &isa, string_view textoConfig);
+
+
+
+// Diagnóstico
+
+// Error o aviso encontrado al revisar un programa
+struct diagnostico
+{
+    int linea;                                       // Línea del problema
+    int columna;                                     // Columna del token que lo causa, desde 1
+    bool esError;                                    // Impide ensamblar el programa; si no, es un aviso
+    string mensaje;                                  // Descripción, sin la línea
+
+    bool operator< (const diagnostico &o) const
+    {
+        if (linea != o.linea) return linea < o.linea;
+        if (columna != o.columna) return columna < o.columna;
+        if (esError != o.esError) return esError;
+        return mensaje < o.mensaje;
+    }
+
+    bool operator== (const diagnostico &o) const
+    {
+        return linea == o.linea && columna == o.columna && esError == o.esError && mensaje == o.mensaje;
+    }
+};
+
+
+// Revisa el programa en una sola pasada sin detenerse en el primer error, y devuelve todos los errores y avisos
+// ordenados por línea y columna y sin repetir. Además de los errores que detiene el ensamblado (instrucciones,
+// número de parámetros, sintaxis de operandos, números y etiquetas desconocidas), avisa de los valores y
+// etiquetas que no caben en su campo y se recortan, de los hexadecimales que se saturan a INT_MAX y de las
+// etiquetas definidas más de una vez
+vector<diagnostico> diagnosticarPrograma (const configuracion_isa &isa, string_view texto);
+
+
+
+// Simulador funcional
+
+// Operación de una instrucción en el simulador, según su mnemónico en la configuración
+enum operacion_simulador : uint8_t
+{
+    OP_NOP,                                          // NOP: no hace nada
+    OP_ADD,                                          // ADD rs rt rd: rd = rs + rt
+    OP_SUB,                                          // SUB rs rt rd: rd = rs - rt
+    OP_AND,                                          // AND rs rt rd: rd = rs & rt
+    OP_OR,                                           // OR rs rt rd: rd = rs | rt
+    OP_LW,                                           // LW rs rt #d: rt = memoria[rs + d]
+    OP_SW,                                           // SW rs rt #d: memoria[rs + d] = rt
+    OP_BEQ,                                          // BEQ rs rt #dir: salta a dir si rs == rt
+    OP_ADDFP,                                        // ADDFP rs rt rd: fd = fs + ft, en coma flotante
+    OP_SUBFP,                                        // SUBFP rs rt rd: fd = fs - ft, en coma flotante
+    OP_LWFP,                                         // LWFP rs rt #d: ft = memoria[rs + d]
+    OP_SWFP,                                         // SWFP rs rt #d: memoria[rs + d] = ft
+    OP_DESCONOCIDA,                                  // Palabra sin instrucción o sin semántica en el simulador
+    OP_FIN,                                          // Centinela tras la última instrucción
+    OP_PC_INVALIDO,                                  // Centinela al que van los saltos fuera del programa
+    N_OPERACIONES
+};
+
+// Motivo por el que se detiene la simulación
+enum motivo_parada
+{
+    PARADA_FIN,                                      // Se ha ejecutado la última instrucción
+    PARADA_BUCLE,                                    // Salto a sí misma, como el "fin: BEQ r0 r0 fin" de los ejemplos
+    PARADA_LIMITE,                                   // Se ha alcanzado el máximo de pasos
+    PARADA_PC_INVALIDO,                              // Salto fuera del programa
+    PARADA_DESCONOCIDA                               // Instrucción sin semántica en el simulador
+};
+
+// Instrucción decodificada una sola vez antes de simular: operación y valor de sus campos
+struct instruccion_predecodificada
+{
+    uint8_t operacion;                               // operacion_simulador
+    uint16_t a, b, c;                                // Registros, en el orden de los campos de la configuración
+    uint32_t inmediato;                              // Desplazamiento de memoria, o PC de destino ya resuelto en saltos
+};
+
+
+// Simulador funcional de un programa ensamblado
+// La semántica de cada instrucción se asigna por su mnemónico (ADD, SUB, AND, OR, LW, SW, BEQ, NOP y las
+// variantes FP), y sus operandos se sacan de los campos de la configuración, en su orden. Cada palabra se
+// decodifica una vez al construir el simulador, con el decodificador de la configuración.
+// La memoria es de palabras de 32 bits, con las direcciones recortadas a su tamaño (potencia de 2).
+
+class simulador
+{
+    private:
+
+    vector<instruccion_predecodificada> codigo;      // Programa predecodificado, con los dos centinelas al final
+    vector<int> planes;                              // Plan de cada instrucción, -1 si no coincide ninguno
+
+    template <bool PERFIL>
+    motivo_parada ejecutarBucle (uint64_t maxPasos);
+
+    public:
+
+    vector<uint32_t> registros;                      // Banco de registros enteros
+    vector<float> registrosFP;                       // Banco de registros de coma flotante
+    vector<uint32_t> memoria;                        // Memoria de datos
+    size_t pc = 0;                                   // Siguiente instrucción a ejecutar
+    uint64_t pasos = 0;                              // Instrucciones ejecutadas
+    vector<uint64_t> perfil;                         // Veces que se ha ejecutado cada instrucción, si se pide
+
+    simulador (const configuracion_isa &isa, const programa_ensamblado &programa, size_t palabrasMemoria = 1 << 16);
+
+    // Ejecuta desde pc hasta que se detenga o haga maxPasos pasos más (0 sin límite)
+    // Con conPerfil cuenta en perfil las ejecuciones de cada instrucción
+    motivo_parada ejecutar (uint64_t maxPasos = 0, bool conPerfil = false);
+
+    size_t size () const { return codigo.size() - 2; }
+    int plan (size_t i) const { return planes[i]; }
+    operacion_simulador operacion (size_t i) const { return (operacion_simulador) codigo[i].operacion; }
+};
+
+}
+
+#endif